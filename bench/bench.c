@@ -0,0 +1,24 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * bench/bench.c
+ * Helpers shared by the benchmarks
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    8/11/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Includes */
+#include "bench.h"
+#include <time.h>
+
+
+
+/* Public functions */
+/// now
+/// Monotonic time in nanoseconds
+double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
@@ -0,0 +1,20 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * bench/bench.h
+ * Header for helpers shared by the benchmarks
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    8/11/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef __bench_bench__h__
+#define __bench_bench__h__
+
+
+/* Public function prototypes */
+/// now
+/// Monotonic time in nanoseconds
+double now();
+
+
+#endif
@@ -0,0 +1,76 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * bench/endless.c
+ * Benchmark: endless board memory and reveal time as a player explores
+ * Run by "make bench-endless"
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    4/11/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Includes */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "endless.h"
+#include "bench.h"
+
+
+/* Defines */
+#define N_REVEALS   200000 // safe reveals made by the explorer
+#define N_REPORTS   8      // progress lines printed
+#define STEP        24     // farthest the explorer moves between reveals
+
+
+/// main
+/// Reveals safe tiles along a drifting random walk out from (0, 0), as a
+/// player who never guesses wrong, reporting memory against the bounding box
+int main()
+{
+	srand(42);
+	EndlessGame game;
+	initEndless(&game, 42);
+	Buffer out = {0};
+	TileEncoder reply;
+
+	int x = 0, y = 0, minX = 0, maxX = 0, minY = 0, maxY = 0;
+	int dx = 1, dy = 0;
+	long nTiles = 0;
+	double revealTime = 0;
+
+	for (int r=1; r<=N_REVEALS; r++) {
+		// Drift, then pick the next safe unrevealed tile nearby
+		if (rand() % 64 == 0) {
+			dx = rand() % 3 - 1;
+			dy = rand() % 3 - 1;
+		}
+		do {
+			x += dx * (rand() % STEP) + rand() % 3 - 1;
+			y += dy * (rand() % STEP) + rand() % 3 - 1;
+		} while (isMine(&game, x, y) || isRevealed(&game, x, y));
+
+		clearBuffer(&out);
+		initTileEncoder(&reply, &out, true);
+		double start = now();
+		nTiles += endlessReveal(&game, x, y, &reply);
+		revealTime += now() - start;
+
+		minX = x < minX ? x : minX;
+		maxX = x > maxX ? x : maxX;
+		minY = y < minY ? y : minY;
+		maxY = y > maxY ? y : maxY;
+
+		if (r % (N_REVEALS / N_REPORTS) == 0) {
+			double area = (double)(maxX - minX + 1) * (maxY - minY + 1);
+			printf("%7d reveals %9ld tiles  %6.2f us/reveal  chunks %3d generated %6d known  "
+			       "%8.2f MiB held, %9.2f MiB as a bounding box of bit planes\n",
+			       r, nTiles, revealTime / r / 1e3, game.nGenerated, game.nKnown,
+			       endlessMemory(&game) / 1048576.0, area * 3 / 8 / 1048576.0);
+		}
+	}
+
+	printf("%ld generations, %ld evictions\n", game.generations, game.evictions);
+	freeBuffer(&out);
+	freeEndless(&game);
+	return 0;
+}
@@ -0,0 +1,139 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * bench/flood.c
+ * Benchmark: flood fill reveal, recursive vs iterative vs region index
+ * Run by "make bench-flood"
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    29/10/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Includes */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "minesweeper.h"
+#include "bench.h"
+
+
+/* Defines */
+#define TILE_BUDGET   20000000 // tiles revealed per variant, bounds run time
+#define BENCH_STACK   (1024L*1024*1024) // lets the recursive fill finish on big boards
+#define DENSITY       2 // percent of tiles that are mines
+
+static const int SIZES[] = {100, 250, 500, 1000};
+
+
+/// revealRecursive
+/// The previous revealTile: recurses into all 8 neighbours of every zero
+int revealRecursive(GameState* game, int x, int y)
+{
+	if (tileIsMine(game, x, y) || tileIsRevealed(game, x, y))
+		return 0;
+	game->revealed[tileWord(game, x, y)] |= tileBit(x);
+
+	int revealed = 1;
+	if (tileAdjacentMines(game, x, y) == 0) {
+		for (int nj = (y > 0 ? y-1 : y); nj <= y+1 && nj < game->height; nj++)
+			for (int ni = (x > 0 ? x-1 : x); ni <= x+1 && ni < game->width; ni++)
+				revealed += revealRecursive(game, ni, nj);
+	}
+	return revealed;
+}
+
+
+/// clearRevealed
+/// Hides every tile again so a board can be reused
+void clearRevealed(GameState* game)
+{
+	memset(game->revealed, 0, game->planeWords * sizeof(uint64_t));
+}
+
+
+/// benchSize
+/// Reveals the opening under random zero tiles of fresh boards with each variant
+void benchSize(GameState* game, const BoardConfig* config)
+{
+	double recursiveTime = 0, iterativeTime = 0, regionTime = 0, buildTime = 0;
+	long nTiles = 0;
+	int nReveals = 0;
+
+	while (nTiles < TILE_BUDGET || nReveals < 5) {
+		// Fresh board without the region index, pick a random opening
+		freeGame(game);
+		initGame(game, config);
+		placeFirstMines(game, -1, -1);
+		freeRegionIndex(game);
+		int x, y;
+		do {
+			x = rand() % config->width;
+			y = rand() % config->height;
+		} while (tileIsMine(game, x, y) || tileAdjacentMines(game, x, y) != 0);
+
+		double start = now();
+		int revealed = revealRecursive(game, x, y);
+		recursiveTime += now() - start;
+		clearRevealed(game);
+
+		game->changed.count = 0;
+		start = now();
+		revealTile(game, x, y, &game->changed);
+		iterativeTime += now() - start;
+		clearRevealed(game);
+
+		start = now();
+		buildRegionIndex(game);
+		buildTime += now() - start;
+
+		game->changed.count = 0;
+		start = now();
+		revealTile(game, x, y, &game->changed);
+		regionTime += now() - start;
+
+		if (game->changed.count != revealed) {
+			printf("Mismatch: recursive revealed %d, region index %d\n", revealed, game->changed.count);
+			exit(1);
+		}
+		nTiles += revealed;
+		nReveals++;
+	}
+
+	printf("%4dx%-4d %6d mines %9.0f tiles/opening  recursive %9.3f ms  iterative %9.3f ms  region %9.3f ms (index build %9.3f ms)\n",
+	       config->width, config->height, config->nMines, (double)nTiles / nReveals,
+	       recursiveTime / nReveals / 1e6, iterativeTime / nReveals / 1e6,
+	       regionTime / nReveals / 1e6, buildTime / nReveals / 1e6);
+}
+
+
+/// runBench
+/// Benchmarks every board size
+void* runBench(void* data)
+{
+	GameState game = {0};
+	for (int s=0; s<sizeof(SIZES)/sizeof(SIZES[0]); s++) {
+		BoardConfig config = {CUSTOM, SIZES[s], SIZES[s], SIZES[s] * SIZES[s] * DENSITY / 100};
+		benchSize(&game, &config);
+	}
+	freeGame(&game);
+	return NULL;
+}
+
+
+/// main
+int main()
+{
+	srand(42);
+
+	// Run on a thread with a stack deep enough for the recursive variant
+	pthread_t thread;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, BENCH_STACK);
+	if (pthread_create(&thread, &attr, runBench, NULL) != 0) {
+		perror("Failed to start benchmark thread");
+		return 1;
+	}
+	pthread_join(thread, NULL);
+	return 0;
+}
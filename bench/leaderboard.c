@@ -0,0 +1,113 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * bench/leaderboard.c
+ * Benchmark: leaderboard insert, rank and top-K cost as wins pile up
+ * Run by "make bench-leaderboard"
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    7/11/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Includes */
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "leaderboard.h"
+#include "rng.h"
+#include "bench.h"
+
+
+/* Defines */
+#define N_RESULTS  4000000 // games recorded, about three in four won
+#define N_ACTIVE   20000   // players active at once; each plays about
+#define CHURN      40      // this many games before the next player replaces them
+#define MAX_TIME   600     // seconds, win times are uniform up to it
+#define N_REPORTS  8
+#define N_QUERIES  100000  // rank and top-K lookups per report
+#define TOP_K      10
+
+
+/// pickPlayer
+/// Names a random active player after r games; players join in order and
+/// leave after playing about CHURN games
+void pickPlayer(Rng* rng, int r, char* name)
+{
+	sprintf(name, "user%u", r / CHURN + boundedRng(rng, N_ACTIVE));
+}
+
+
+/// main
+/// Records random game results, reporting the cost of each operation as
+/// the board grows; a result's cost is its share of queueing a report's
+/// results and waiting for the leaderboard thread to record them all, whose
+/// logging goes to /dev/null
+int main()
+{
+	Rng rng;
+	seedRng(&rng, 42);
+	FILE* console = fdopen(dup(STDOUT_FILENO), "w");
+	int devNull = open("/dev/null", O_WRONLY);
+	dup2(devNull, STDOUT_FILENO);
+
+	startLeaderboard();
+	long nWins = 0;
+	double insertTime = 0;
+	Buffer page = {0};
+	for (int r=1; r<=N_RESULTS; r++) {
+		char name[MAX_NAME_LENGTH];
+		pickPlayer(&rng, r, name);
+		bool win = boundedRng(&rng, 4) != 0;
+		long time = 1 + boundedRng(&rng, MAX_TIME);
+		nWins += win;
+
+		double start = now();
+		newRecord(name, win, time);
+		insertTime += now() - start;
+
+		if (r % (N_RESULTS / N_REPORTS) != 0)
+			continue;
+		start = now();
+		flushLeaderboard();
+		insertTime += now() - start;
+
+		// Rank of random users' best wins, a page of K rows from a random rank,
+		// and the top K as cached until the next result
+		double rankTime = 0, topTime = 0, cachedTime = 0;
+		long checksum = 0;
+		for (int q=0; q<N_QUERIES; q++) {
+			pickPlayer(&rng, r, name);
+			UserRecord* user = findUser(name);
+			double start = now();
+			if (user != NULL && user->records != NULL)
+				checksum += winRank(user->records);
+			rankTime += now() - start;
+
+			clearBuffer(&page);
+			start = now();
+			checksum += requestLeaderboard(&page, boundedRng(&rng, nWins), TOP_K);
+			topTime += now() - start;
+
+			start = now();
+			RefBuffer* reply = requestLeaderboardReply(0, TOP_K, true);
+			checksum += reply->len;
+			releaseRefBuffer(reply);
+			cachedTime += now() - start;
+		}
+		fprintf(console, "%8d results %8ld wins  newRecord %6.0f ns  "
+		        "rank %5.0f ns  page of %d %5.0f ns, cached top %4.0f ns  (%ld)\n",
+		        r, nWins, insertTime / (N_RESULTS / N_REPORTS),
+		        rankTime / N_QUERIES, TOP_K, topTime / N_QUERIES, cachedTime / N_QUERIES, checksum % 10);
+		insertTime = 0;
+	}
+
+	freeBuffer(&page);
+	stopLeaderboard();
+	fflush(stdout);
+	dup2(fileno(console), STDOUT_FILENO);
+	printLeaderboardStats();
+	cleanupLeaderboard();
+	close(devNull);
+	fclose(console);
+	return 0;
+}
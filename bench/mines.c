@@ -0,0 +1,104 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * bench/mines.c
+ * Benchmark: mine placement, rejection sampling vs Floyd sampling
+ * Run by "make bench-mines"
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    31/10/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Includes */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "minesweeper.h"
+#include "bench.h"
+
+
+/* Defines */
+#define TILE_BUDGET 20000000 // tiles placed per variant, bounds run time
+
+static const int SIZES[][2] = {{9, 9}, {30, 16}, {100, 100}, {1000, 1000}};
+static const int DENSITIES[] = {10, 20, 50, 80, 95, 99}; // percent of tiles that are mines
+
+
+/// placeByRejection
+/// The previous placeMines: redraw (x, y) until it misses the mines so far,
+/// then increment the adjacency count of all 8 neighbours
+void placeByRejection(GameState* game, int* adjacent)
+{
+	Rng rng;
+	seedRng(&rng, game->seed);
+
+	for (int i=0; i<game->nMines; i++) {
+		int x, y;
+		do {
+			x = boundedRng(&rng, game->width);
+			y = boundedRng(&rng, game->height);
+		} while (tileIsMine(game, x, y));
+		game->mines[tileWord(game, x, y)] |= tileBit(x);
+
+		for (int nj = (y > 0 ? y-1 : y); nj <= y+1 && nj < game->height; nj++)
+			for (int ni = (x > 0 ? x-1 : x); ni <= x+1 && ni < game->width; ni++)
+				if (ni != x || nj != y)
+					adjacent[nj*game->width + ni]++;
+	}
+}
+
+
+/// benchBoard
+/// Places the mines of one board size and density repeatedly with each variant
+void benchBoard(GameState* game, const BoardConfig* config)
+{
+	int nTiles = config->width * config->height;
+	int* adjacent = malloc(nTiles * sizeof(int));
+	double rejectionTime = 0, floydTime = 0;
+	int nBoards = 0;
+
+	freeGame(game);
+	initGame(game, config);
+	while ((long)nBoards * nTiles < TILE_BUDGET || nBoards < 5) {
+		game->seed = nBoards;
+
+		memset(game->mines, 0, game->planeWords * sizeof(uint64_t));
+		memset(adjacent, 0, nTiles * sizeof(int));
+		double start = now();
+		placeByRejection(game, adjacent);
+		rejectionTime += now() - start;
+
+		memset(game->mines, 0, game->planeWords * sizeof(uint64_t));
+		Rng rng;
+		start = now();
+		seedRng(&rng, game->seed);
+		placeMines(game, &rng, 0, 0, -1);
+		findOpenings(game);
+		floydTime += now() - start;
+
+		nBoards++;
+	}
+	free(adjacent);
+
+	printf("%4dx%-4d %3d%% %7d mines  rejection+increments %11.1f us  floyd+count pass %9.1f us\n",
+	       config->width, config->height, config->nMines * 100 / nTiles, config->nMines,
+	       rejectionTime / nBoards / 1e3, floydTime / nBoards / 1e3);
+}
+
+
+/// main
+int main()
+{
+	GameState game = {0};
+	for (int s=0; s<sizeof(SIZES)/sizeof(SIZES[0]); s++) {
+		for (int d=0; d<sizeof(DENSITIES)/sizeof(DENSITIES[0]); d++) {
+			int nTiles = SIZES[s][0] * SIZES[s][1];
+			int nMines = nTiles * DENSITIES[d] / 100;
+			if (nMines < 1 || nMines >= nTiles)
+				continue;
+			BoardConfig config = {CUSTOM, SIZES[s][0], SIZES[s][1], nMines};
+			benchBoard(&game, &config);
+		}
+	}
+	freeGame(&game);
+	return 0;
+}
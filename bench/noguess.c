@@ -0,0 +1,68 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * bench/noguess.c
+ * Benchmark: no-guess board generation latency
+ * Run by "make bench-noguess"
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    3/11/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Includes */
+#include <stdlib.h>
+#include <stdio.h>
+#include "minesweeper.h"
+#include "solver.h"
+#include "bench.h"
+
+
+/* Defines */
+#define BOARDS 500 // boards generated per size
+
+static const BoardConfig SIZES[] = {
+	{BEGINNER, 9, 9, 10, true},
+	{INTERMEDIATE, 16, 16, 40, true},
+	{EXPERT, 30, 16, 99, true},
+	{CUSTOM, 50, 50, 500, true},
+	{CUSTOM, 100, 100, 2000, true},
+};
+
+
+/// compareDoubles
+/// qsort comparator for ascending doubles
+int compareDoubles(const void* a, const void* b)
+{
+	double d = *(const double*)a - *(const double*)b;
+	return (d > 0) - (d < 0);
+}
+
+
+/// main
+int main()
+{
+	GameState game = {0};
+	double latency[BOARDS];
+
+	for (int s=0; s<sizeof(SIZES)/sizeof(SIZES[0]); s++) {
+		const BoardConfig* config = &SIZES[s];
+		int nSolvable = 0;
+
+		for (int n=0; n<BOARDS; n++) {
+			freeGame(&game);
+			double start = now();
+			bool made = initGameFromSeed(&game, config, n);
+			latency[n] = now() - start;
+			if (made)
+				nSolvable += solveBoard(&game, game.startX, game.startY);
+		}
+
+		qsort(latency, BOARDS, sizeof(double), compareDoubles);
+		printf("%4dx%-4d %5d mines  p50 %8.3f ms  p90 %8.3f ms  p99 %8.3f ms  max %8.3f ms  %d/%d solvable\n",
+		       config->width, config->height, config->nMines,
+		       latency[BOARDS/2] / 1e6, latency[BOARDS*9/10] / 1e6, latency[BOARDS*99/100] / 1e6,
+		       latency[BOARDS-1] / 1e6, nSolvable, BOARDS);
+	}
+
+	freeGame(&game);
+	return 0;
+}
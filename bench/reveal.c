@@ -0,0 +1,106 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * bench/reveal.c
+ * Microbenchmark: reveal reply cost, clone-and-diff vs delta list
+ * Run by "make bench-reveal"
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    28/10/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Includes */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "minesweeper.h"
+#include "bench.h"
+
+
+/* Defines */
+#define ITERATIONS 2000
+#define DENSITY    12 // percent of tiles that are mines
+
+static const int SIZES[] = {9, 16, 32, 64, 128, 256};
+
+
+/// revealByDiff
+/// The previous requestReveal: clone the game, reveal, then scan every tile
+/// Only the revealed plane needs cloning now the board is bit-packed
+int revealByDiff(GameState* game, int x, int y, TileEncoder* reply)
+{
+	GameState old = *game;
+	old.revealed = malloc(game->planeWords * sizeof(uint64_t));
+	memcpy(old.revealed, game->revealed, game->planeWords * sizeof(uint64_t));
+
+	game->changed.count = 0;
+	int err = revealTile(game, x, y, &game->changed);
+	if (err == 0) {
+		for (int j=0; j<game->height; j++) {
+			for (int i=0; i<game->width; i++) {
+				if (!tileIsRevealed(&old,i,j) && tileIsRevealed(game,i,j))
+					encodeTile(reply, i, j, tileAdjacentMines(game,i,j), tileIsFlagged(game,i,j), tileIsMine(game,i,j));
+			}
+		}
+		err = finishTiles(reply);
+	}
+
+	free(old.revealed);
+	return err;
+}
+
+
+/// clearRevealed
+/// Hides every tile again so a board can be reused
+void clearRevealed(GameState* game)
+{
+	memset(game->revealed, 0, game->planeWords * sizeof(uint64_t));
+}
+
+
+/// main
+int main()
+{
+	srand(42);
+	GameState game = {0};
+	Buffer out = {0};
+	TileEncoder reply;
+
+	for (int s=0; s<sizeof(SIZES)/sizeof(SIZES[0]); s++) {
+		BoardConfig config = {CUSTOM, SIZES[s], SIZES[s], SIZES[s] * SIZES[s] * DENSITY / 100};
+		double diffTime = 0, deltaTime = 0;
+		long nTiles = 0;
+
+		for (int n=0; n<ITERATIONS; n++) {
+			// Fresh board, reveal a random safe tile with each variant
+			freeGame(&game);
+			initGame(&game, &config);
+			placeFirstMines(&game, -1, -1);
+			int x, y;
+			do {
+				x = rand() % config.width;
+				y = rand() % config.height;
+			} while (tileIsMine(&game, x, y));
+
+			clearBuffer(&out);
+			initTileEncoder(&reply, &out, true);
+			double start = now();
+			revealByDiff(&game, x, y, &reply);
+			diffTime += now() - start;
+			clearRevealed(&game);
+
+			clearBuffer(&out);
+			initTileEncoder(&reply, &out, true);
+			start = now();
+			nTiles += requestReveal(&game, x, y, &reply);
+			deltaTime += now() - start;
+		}
+
+		printf("%4dx%-4d %6d mines  %8.1f tiles/reveal  clone+diff %10.0f ns  delta list %10.0f ns\n",
+		       config.width, config.height, config.nMines, (double)nTiles / ITERATIONS,
+		       diffTime / ITERATIONS, deltaTime / ITERATIONS);
+	}
+
+	freeBuffer(&out);
+	freeGame(&game);
+	return 0;
+}
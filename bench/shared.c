@@ -0,0 +1,128 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * bench/shared.c
+ * Benchmark: shared board move throughput, striped locks vs one lock
+ * Run by "make bench-shared"
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    5/11/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Includes */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "shared.h"
+#include "bench.h"
+
+
+/* Defines */
+#define MOVES_PER_THREAD 200000
+#define REACH            100 // players move within this many tiles of their spot
+#define MAX_THREADS      16
+
+static const int THREADS[] = {1, 2, 4, 8, 16};
+
+static SharedBoard board;
+static pthread_mutex_t boardLock = PTHREAD_MUTEX_INITIALIZER; // the one lock variant
+static bool oneLock;
+static bool hotSpot; // every player at the centre, else spread over the board
+
+
+/// Player structure
+/// One benchmark thread
+typedef struct
+{
+	pthread_t thread;
+	unsigned seed;
+	Buffer out; // where this player's moves are encoded, as for one watcher
+	long tiles;
+} Player;
+
+
+/// publishBench
+/// Encodes the changed tiles once, the work every publish does at least
+void publishBench(SharedBoard* board, const TileList* changed, void* context)
+{
+	Player* player = context;
+	if (changed == NULL)
+		return;
+	TileEncoder encoder;
+	clearBuffer(&player->out);
+	initTileEncoder(&encoder, &player->out, true);
+	player->tiles += encodeSharedTiles(board, changed, &encoder);
+}
+
+
+/// runPlayer
+/// Reveals, flags and chords around one spot
+void* runPlayer(void* data)
+{
+	Player* player = data;
+	int spotX = hotSpot ? board.startX : REACH + rand_r(&player->seed) % (board.config.width - 2*REACH);
+	int spotY = hotSpot ? board.startY : REACH + rand_r(&player->seed) % (board.config.height - 2*REACH);
+
+	for (int m=0; m<MOVES_PER_THREAD; m++) {
+		int x = spotX + rand_r(&player->seed) % (2*REACH + 1) - REACH;
+		int y = spotY + rand_r(&player->seed) % (2*REACH + 1) - REACH;
+		int move = rand_r(&player->seed) % 10;
+
+		if (oneLock)
+			pthread_mutex_lock(&boardLock);
+		if (move < 6)
+			sharedReveal(&board, x, y, publishBench, player);
+		else if (move < 8)
+			sharedFlag(&board, x, y, publishBench, player);
+		else
+			sharedChord(&board, x, y, publishBench, player);
+		if (atomic_exchange(&board.cleared, false))
+			newSharedRound(&board, publishBench, player);
+		if (oneLock)
+			pthread_mutex_unlock(&boardLock);
+	}
+	return NULL;
+}
+
+
+/// benchThreads
+/// Plays nThreads players on a fresh board, returns moves per second
+double benchThreads(int nThreads)
+{
+	BoardConfig config = {CUSTOM, SHARED_WIDTH, SHARED_HEIGHT, SHARED_MINES, false};
+	initSharedBoard(&board, &config);
+
+	Player players[MAX_THREADS];
+	memset(players, 0, sizeof(players));
+	double start = now();
+	for (int t=0; t<nThreads; t++) {
+		players[t].seed = 42 + t;
+		pthread_create(&players[t].thread, NULL, runPlayer, &players[t]);
+	}
+	for (int t=0; t<nThreads; t++) {
+		pthread_join(players[t].thread, NULL);
+		freeBuffer(&players[t].out);
+	}
+	double elapsed = now() - start;
+
+	freeSharedBoard(&board);
+	return (double)nThreads * MOVES_PER_THREAD / (elapsed / 1e9);
+}
+
+
+/// main
+int main()
+{
+	for (int spot=0; spot<2; spot++) {
+		hotSpot = spot;
+		printf("%s\n", hotSpot ? "Every player at the centre:" : "Players spread over the board:");
+		for (int t=0; t<sizeof(THREADS)/sizeof(THREADS[0]); t++) {
+			oneLock = true;
+			double single = benchThreads(THREADS[t]);
+			oneLock = false;
+			double striped = benchThreads(THREADS[t]);
+			printf("%3d threads  one lock %10.0f moves/s  striped %10.0f moves/s\n", THREADS[t], single, striped);
+		}
+	}
+	return 0;
+}
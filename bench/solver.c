@@ -0,0 +1,65 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * bench/solver.c
+ * Benchmark: solver throughput over a corpus of generated boards
+ * Run by "make bench-solver"
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    2/11/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Includes */
+#include <stdlib.h>
+#include <stdio.h>
+#include "minesweeper.h"
+#include "solver.h"
+#include "bench.h"
+
+
+/* Defines */
+#define CORPUS_SIZE 2000 // boards per difficulty
+
+static const char* NAMES[] = {"beginner", "intermediate", "expert"};
+
+
+/// firstClick
+/// Picks a random first click and lays the board out around it, as a game does
+void firstClick(GameState* game, Rng* rng, int* x, int* y)
+{
+	*x = boundedRng(rng, game->width);
+	*y = boundedRng(rng, game->height);
+	placeFirstMines(game, *x, *y);
+}
+
+
+/// main
+int main()
+{
+	GameState game = {0};
+	Rng rng;
+	seedRng(&rng, 42);
+
+	for (Difficulty d=BEGINNER; d<=EXPERT; d++) {
+		BoardConfig config = presetConfig(d);
+		double solveTime = 0;
+		int nSolved = 0;
+
+		for (int n=0; n<CORPUS_SIZE; n++) {
+			freeGame(&game);
+			initGameFromSeed(&game, &config, n);
+			int x, y;
+			firstClick(&game, &rng, &x, &y);
+
+			double start = now();
+			nSolved += solveBoard(&game, x, y);
+			solveTime += now() - start;
+		}
+
+		printf("%-12s %2dx%-2d %2d mines  %6.1f%% solved without guessing  %9.0f solves/s  %7.1f us/board\n",
+		       NAMES[d], config.width, config.height, config.nMines, 100.0 * nSolved / CORPUS_SIZE,
+		       CORPUS_SIZE / (solveTime / 1e9), solveTime / CORPUS_SIZE / 1e3);
+	}
+
+	freeGame(&game);
+	return 0;
+}
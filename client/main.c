@@ -23,8 +23,9 @@
 #include <netdb.h>
 
 #include "minesweeper.h"
-//#include "message.h"
-//#include "message.c"
+#include "buffer.h"
+#include "frame.h"
+#include "tilecodec.h"
 
 
 /* Defines */
@@ -32,10 +33,14 @@
 #define MAX_RX_SIZE 1000
 #define MAX_TX_SIZE 50
 #define MAX_NAME_LENGTH 20
+#define MAX_FRAME_SIZE (16*1024*1024)
 static volatile bool terminate = false;
+static FrameReader rx;       // received bytes, split into messages
+static bool framed = false;  // length-prefixed framing agreed with server
+static size_t rxLen = 0;     // length of the last received message
 
 /* Fuction Prototypes */
-bool rcvMsg(int cID, char* rxBuffer);
+bool rcvMsg(int cID, char** rxBuffer);
 bool sndMsg(int cID, char* txBuffer);
 
 /* Function declarations */
@@ -67,29 +72,89 @@ void closeSocket(int sID)
 	}
 }
 
-/// initGame
-/// initialise game
-void initGame(GameState* game){
-	m_initGame(game);
-	printf("\n\n\n\n\n");
-	printf("Remaining mines: %d\n", game->remainingMines); // Display remaining mine count
-	printf("\n    1 2 3 4 5 6 7 8 9\n");
-	printf("-----------------------\n");
-	for(int row = 0; row < 9; row++){
-		char rowChar = 'A' + row;
-		printf("%c | ", rowChar);
+/// printBoard
+/// Displays the board, rows labelled A-Z (or by number on tall boards)
+void printBoard(GameState* game){
+	// Row label width: a letter, or enough digits for the last row number
+	bool letters = (game->height <= 26);
+	int labelWidth = 1;
+	for (int h = game->height; !letters && h >= 10; h /= 10)
+		labelWidth++;
+
+	// Column header, one line per decimal digit of the widest column number
+	int places = 1;
+	for (int w = game->width; w >= 10; w /= 10)
+		places *= 10;
+	printf("\n");
+	for (int place = places; place >= 1; place /= 10) {
+		printf("%*s", labelWidth + 3, "");
+		for(int col = 1; col <= game->width; col++){
+			if (col >= place)
+				printf("%d ", (col / place) % 10);
+			else
+				printf("  ");
+		}
+		printf("\n");
+	}
+	for (int i = 0; i < labelWidth + 4 + 2*game->width; i++)
+		printf("-");
+	printf("\n");
+
+	for(int row = 0; row < game->height; row++){
+		if (letters)
+			printf("%c | ", 'A' + row);
+		else
+			printf("%*d | ", labelWidth, row + 1);
 		
-		for(int col = 0; col < 9; col++){
-			if(getTile(game, row, col) == 0){
+		for(int col = 0; col < game->width; col++){
+			Tile* tile = gameTile(game, col, row);
+			if(game->isOver && !game->isWon) {
+				if(tile->isMine)
+					printf("* ");
+				else
+					printf("  ");
+			}else if(tile->isFlagged){
+				printf("+ ");
+			}else if(!tile->isRevealed && col == game->startX && row == game->startY){
+				printf("o "); // no-guess start tile
+			}else if(!tile->isRevealed){
 				printf("  ");
 			}else{
-				printf("! "); // Debug
+				printf("%d ", tile->nAdjacentMines);
 			}
 		}
 		printf("\n");
 	}
 }
 
+/// initGame
+/// initialise game from the play reply "accept,<width>,<height>,<mines>[,<startX>,<startY>]"
+void initGame(GameState* game, char* data){
+	int width = N_TILES_X, height = N_TILES_Y, nMines = N_MINES, startX = -1, startY = -1;
+	int fields = sscanf(data, "accept,%d,%d,%d,%d,%d", &width, &height, &nMines, &startX, &startY);
+	if (fields < 3) {
+		// Older servers only play the default board
+		width = N_TILES_X;
+		height = N_TILES_Y;
+		nMines = N_MINES;
+	}
+	m_initGame(game, width, height, nMines);
+	if (fields == 5) {
+		game->startX = startX;
+		game->startY = startY;
+	}
+	printf("\n\n\n\n\n");
+	printf("Remaining mines: %d\n", game->remainingMines); // Display remaining mine count
+	printBoard(game);
+	if (fields == 5) {
+		// No-guess board: solvable by logic alone from the marked tile
+		if (height <= 26)
+			printf("\nNo guessing needed: start with tile %d,%c (marked o).\n", startX+1, 'A' + startY);
+		else
+			printf("\nNo guessing needed: start with tile %d,%d (marked o).\n", startX+1, startY+1);
+	}
+}
+
 /// processGame
 /// Reads user input and processes that information
 void processGame(GameState* game, char* data){
@@ -100,24 +165,33 @@ void processGame(GameState* game, char* data){
 	
 	bool flagNoMine = false;
 	if (data != NULL) {
-		// Process tiles
-		int size_rx = strlen(data);
-		int numTiles = ((size_rx - 11)/12) + 1;
-		int x,y,n,f,m;
-		for(int i = 0; i < numTiles; i++){
-			// extract first cell of data into temp
-			char tmp[11];
-			for(int j = 0; j < 11; j++){
-				tmp[j] = data[j];
-			}
-		
+		// Process tiles, text or binary
+		TileDecoder decoder;
+		int x,y,n;
+		bool f,m;
+		initTileDecoder(&decoder, data, rxLen);
+		while (nextTile(&decoder, &x, &y, &n, &f, &m)) {
+			if (x < 0 || x >= game->width || y < 0 || y >= game->height)
+				continue;
+
 			// store data into gameState
-			sscanf(tmp,"t,%d,%d,%d,%d,%d",&x,&y,&n,&f,&m);
+			Tile* tile = gameTile(game, x, y);
+
+			// Flag removed, hidden again
+			if (n == TILE_HIDDEN_COUNT) {
+				if (tile->isFlagged && tile->isMine && !game->isOver)
+					++(game->remainingMines);
+				tile->isFlagged = false;
+				tile->isRevealed = false;
+				continue;
+			}
 
-			((game->tiles)[x][y]).nAdjacentMines = n;
-			((game->tiles)[x][y]).isFlagged = f;
-			((game->tiles)[x][y]).isMine = m;
-			((game->tiles)[x][y]).isRevealed = true;
+			if (!f && !m && !tile->isRevealed)
+				--(game->hiddenSafe);
+			tile->nAdjacentMines = n;
+			tile->isFlagged = f;
+			tile->isMine = m;
+			tile->isRevealed = true;
 
 			// Decrement remaining mine count if Flagged & Mine
 			if (f && m && !game->isOver) {
@@ -127,148 +201,64 @@ void processGame(GameState* game, char* data){
 				// Flag placed but no mine
 				flagNoMine = true;
 			}
-		
-			// truncate data to remove first cell
-			memmove(&data[0],&data[11], strlen(data) - 11);
-		
-			if(i < numTiles - 1){
-				memmove(&data[0],&data[1], strlen(data) - 1);
-			}
 		}
 	}
 
 	// Display result
 	printf("\n\n\n\n\n");
-	if (flagNoMine) printf("Oops! No mine at previously placed flag!\n");
+	if (flagNoMine) printf("Oops! No mine at previously placed flag! Flag it again to remove it.\n");
 	printf("Remaining mines: %d\n", game->remainingMines); // Display remaining mine count
-	printf("\n    1 2 3 4 5 6 7 8 9\n");
-	printf("-----------------------\n");
-	for(int row = 0; row < 9; row++){
-		char rowChar = 'A' + row;
-		printf("%c | ", rowChar);
-		
-		for(int col = 0; col < 9; col++){
-			if(game->isOver && !game->isWon) {
-				if(((game->tiles)[col][row]).isMine)
-					printf("* ");
-				else
-					printf("  ");
-			}else if(((game->tiles)[col][row]).isFlagged){
-				printf("+ ");
-			}else if(!((game->tiles)[col][row]).isRevealed){
-				printf("  ");
-			}else{
-				printf("%d ", ((game->tiles)[col][row]).nAdjacentMines);
-			}
-		}
-		printf("\n");
-	}
+	printBoard(game);
 }
 
 
-/// Doubly linked list Entry for leaderboard
-typedef struct Entry {
-	char name[MAX_NAME_LENGTH];
-	long int time;
-	int wins, plays;
-	struct Entry* prv;
-	struct Entry* next;
-} Entry;
-
 /// leaderBoard
-/// displays sorted leaderboard in descending order, fastest first!
-void leaderBoard(char* data){
+/// Displays leaderboard rows as the server sends them, fastest first
+/// A plain "lb" streams every row over several messages up to "lb,end,<rows>"
+/// when framed; a page, "lb,<offset>,<limit>" or "lb,top,<k>", or the top rows
+/// unframed, come in one message
+/// Returns false if the connection failed
+bool leaderBoard(int cID, char* data, bool stream){
 	// Header
 	printf("========================================== LEADERBOARD ==========================================\n\n");
 
-	// Error
-	if (strncmp(data, "error", 5) == 0) {
-		printf("Leaderboard is currently empty...\n");	
-	}
+	long int shown = 0;
+	while (true) {
+		// End of the stream, or an empty page
+		if (strncmp(data, "lb,end", 6) == 0 || strncmp(data, "error", 5) == 0)
+			break;
 
-	Entry* entries = NULL;
-	Entry* lastEntry = NULL;
-	int entryCount = 0;
-
-	// Extract entries
-	int dataLen = strlen(data);
-	int ptrOffset = 0;
-	while(ptrOffset < dataLen) {
-		// Scan for correct args		
-		Entry* entry = malloc(sizeof(Entry));
-		entry->prv  = NULL;
-		entry->next = NULL;
-		int consumed;
-		if( sscanf(data+ptrOffset, "l,%[^,\n],%ld,%d,%d%n", 
-			       entry->name, &(entry->time), &(entry->wins), &(entry->plays), 
-                   &consumed) < 4
-          ){
-			printf("Failed to extract leaderboard data\n\n");
-			free(entry);
-			break; // Could not extract data
+		// Display each row of the message
+		char name[MAX_NAME_LENGTH];
+		long int time;
+		int wins, plays, consumed;
+		int dataLen = strlen(data);
+		int ptrOffset = 0;
+		while (ptrOffset < dataLen) {
+			if (sscanf(data+ptrOffset, "l,%19[^,\n],%ld,%d,%d%n", name, &time, &wins, &plays, &consumed) < 4) {
+				printf("Failed to extract leaderboard data\n\n");
+				break; // Could not extract data
+			}
+			printf("%-20s %10ld seconds              %5d games won, %d games played\n",
+			       name, time, wins, plays);
+			shown++;
+			ptrOffset += consumed + 1; // skip extra comma
 		}
 
-		// Offset
-		ptrOffset += consumed + 1; // skip extra comma
-		
-		// Push to list
-		if (entries == NULL) {
-			entries = entry;
-			lastEntry = entry;
-		}
-		else {
-			entry->prv = lastEntry;
-			lastEntry->next = entry;
-			lastEntry = entry;
-		}
-		entryCount++;
+		// Pages end here, streams at "lb,end"
+		if (!stream)
+			break;
+		if (!rcvMsg(cID, &data))
+			return false;
 	}
 
-	// Display lb in descending order
-	while (entryCount > 0) {
-		long int highestTime = -1;
-		Entry* highestEntry = NULL;
-		Entry* entry = entries; // problematic if first entry is deleted
-
-		// Find next worst entry
-		while(entry != NULL) {
-			// Store highest time
-			if (entry->time > highestTime) {
-				highestTime = entry->time;
-				highestEntry = entry;
-			}
-			else if (entry->time == highestTime) {
-				// Sort reverse-win count
-				if (entry->wins < highestEntry->wins) {
-					highestEntry = entry;
-				}
-				else if (entry->wins == highestEntry->wins) {
-					// Sort reverse-alphabetically
-					if (strcmp(entry->name, highestEntry->name) < 0)
-						highestEntry = entry;
-				}
-			}
-			entry = entry->next;
-		}
+	// Empty
+	if (shown == 0)
+		printf("Leaderboard is currently empty...\n");
 
-		// Display next worst entry
-		printf("%-20s %10ld seconds              %5d games won, %d games played\n",
-			   highestEntry->name, highestEntry->time, highestEntry->wins, highestEntry->plays);
-
-		// Pop worst entry
-		if (highestEntry->prv != NULL)
-			highestEntry->prv->next = highestEntry->next;
-		else 
-			entries = highestEntry->next; // Replace first list pointer to next entry
-		if (highestEntry->next != NULL)
-			highestEntry->next->prv = highestEntry->prv;
-		free(highestEntry);
-		--entryCount;
-	}
-	
 	// Footer
 	printf("\n=================================================================================================\n\n");
-
+	return true;
 }
 
 
@@ -325,25 +315,27 @@ int main(int argc, char* argv[])
 
 	// Receive and send messages
 	char user[MAX_NAME_LENGTH], pass[MAX_NAME_LENGTH];
-	char rxBuffer[MAX_RX_SIZE];
+	char* rxBuffer = NULL;
 	char txBuffer[MAX_TX_SIZE];
-	memset(rxBuffer, 0, sizeof(rxBuffer)/sizeof(char));
+	initFrameReader(&rx, MAX_RX_SIZE, MAX_FRAME_SIZE);
 	memset(txBuffer, 0, sizeof(txBuffer)/sizeof(char));
 	memset(user, 0, sizeof(user)/sizeof(char));
 	memset(pass, 0, sizeof(pass)/sizeof(char));
 	
 	
 	/* --- initialise the game and game state --- */
-	GameState game;
+	GameState game = {0};
 	GameState* gamePtr = &game;
 	
 	bool auth = false;
 	bool gameStart = false;
+	bool offerFrame = false; // server advertised framing in "connect"
+	bool offerBinary = false; // server advertised binary tiles in "connect"
 	
 	while (!terminate) {
 		
 		/* --- Receive --- */
-		if(!rcvMsg(cID,rxBuffer)){
+		if(!rcvMsg(cID,&rxBuffer)){
 			// Handle auth fail
 			if (!auth) {
 				printf("Failed to authenticate! Disconnected.\n\n");
@@ -354,32 +346,61 @@ int main(int argc, char* argv[])
 		/* --- Check server response and update game state --- */
 		// Main menu
 		if (!gameStart) {
-			if(strstr(txBuffer,"exit")){
+			if(!auth && strncmp(rxBuffer,"connect",7) == 0){
+				offerFrame = (strstr(rxBuffer, "," FRAME_FEATURE) != NULL);
+				offerBinary = (strstr(rxBuffer, "," BINARY_FEATURE) != NULL);
+			}
+			else if(strstr(txBuffer,"exit")){
 				exit(1);
 			}
 			else if(strstr(txBuffer,"lb") != NULL){
-				leaderBoard(rxBuffer);
+				if(!leaderBoard(cID, rxBuffer, framed && txBuffer[2 + strspn(txBuffer + 2, "\r\n")] == '\0'))
+					break;
 			}
 			else if(strstr(rxBuffer,"accept") != NULL){
 				// Accept from authentication
 				if(auth == false){
 					auth = true;
+					framed = offerFrame;
+				}
+				// Endless boards need a scrolling view this client lacks
+				else if(strncmp(rxBuffer,"accept,endless",14) == 0){
+					printf("\nThis client cannot play endless boards.\n");
+					if(!sndMsg(cID, "quit"))
+						break;
+					if(!rcvMsg(cID,&rxBuffer))
+						break;
+				}
+				// Shared boards push other players' moves, which this client cannot follow
+				else if(strncmp(rxBuffer,"accept,shared",13) == 0){
+					printf("\nThis client cannot play on the shared board.\n");
+					if(!sndMsg(cID, "quit"))
+						break;
+					// Skip the tiles pushed until the quit is accepted
+					bool quit = true;
+					while((quit = rcvMsg(cID,&rxBuffer)) && (isTileMessage(rxBuffer, rxLen) || strcmp(rxBuffer,"accept") != 0));
+					if(!quit)
+						break;
 				}
 				// Accept from 'play'
 				else {
 					gameStart = true;
-					initGame(gamePtr);
+					initGame(gamePtr, rxBuffer);
 				}
 			}
 		}
 		// Game
 		else {
 			// Tile revealed
-			if(strstr(rxBuffer,"t,") != NULL){		
+			if(isTileMessage(rxBuffer, rxLen)){		
 				processGame(gamePtr, rxBuffer);		
+
+				// The tiles of a winning move come ahead of "over"
+				if(game.hiddenSafe == 0 && !rcvMsg(cID,&rxBuffer))
+					break;
 			}
 			// Game over
-			else if (strstr(rxBuffer, "over,") != NULL){
+			if (strncmp(rxBuffer, "over,", 5) == 0){
 				if (rxBuffer[5] == '0') {
 					// Game over
 					game.isOver = true;
@@ -388,7 +409,7 @@ int main(int argc, char* argv[])
 					// Receive all tiles
 					if(!sndMsg(cID, "ok"))
 						break;
-					if(!rcvMsg(cID,rxBuffer))
+					if(!rcvMsg(cID,&rxBuffer))
 						break;
 
 					processGame(gamePtr, rxBuffer);
@@ -401,9 +422,28 @@ int main(int argc, char* argv[])
 					game.remainingMines = 0;
 					gameStart = false;
 					processGame(gamePtr, NULL); // Display game with no update
-					printf("\n\nCongratulations! You have located all the mines. You won in %s seconds!\n\n", rxBuffer+7);
+					if (txBuffer[0] == 'f' || strncmp(txBuffer, "winhack", 7) == 0)
+						printf("\n\nCongratulations! You have located all the mines. You won in %s seconds!\n\n", rxBuffer+7);
+					else
+						printf("\n\nCongratulations! You have revealed every safe tile. You won in %s seconds!\n\n", rxBuffer+7);
+				}
+			}
+			// Hint
+			else if (strncmp(rxBuffer, "hint,", 5) == 0) {
+				int x, y, isMine;
+				if (sscanf(rxBuffer, "hint,%d,%d,%d", &x, &y, &isMine) == 3) {
+					if (game.height <= 26)
+						printf("\nHint: tile %d,%c is %s.\n", x+1, 'A' + y, isMine ? "a mine" : "safe");
+					else
+						printf("\nHint: tile %d,%d is %s.\n", x+1, y+1, isMine ? "a mine" : "safe");
 				}
 			}
+			else if (strncmp(rxBuffer, "error", 5) == 0 && strncmp(txBuffer, "hint", 4) == 0) {
+				printf("\nNo hint: every unrevealed tile needs a guess.\n");
+			}
+			else if (strncmp(rxBuffer, "error", 5) == 0 && txBuffer[0] == 'c') {
+				printf("\nChord needs as many flags around the tile as its number.\n");
+			}
 			else {
 				// Some unhandled error
 			}
@@ -422,12 +462,22 @@ int main(int argc, char* argv[])
 		}else if(!gameStart){
 			printf("\nMain menu:\n");
 			printf("Type 'play' to begin the game.\n");
-			printf("Type 'lb' to see the leaderboard.\n");
+			printf("Type 'play,<beginner|intermediate|expert>' to pick a difficulty.\n");
+			printf("Type 'play,<width>,<height>,<mines>' for a custom board.\n");
+			printf("Add ',noguess' to either for a board that never needs a guess.\n");
+			printf("Type 'lb' to see the leaderboard%s.\n", framed ? ", or 'lb,top,<k>' for the k fastest" : "");
 			printf("Type 'exit' to quit program.\n");
 		}else if(!game.isOver){
 			printf("\nGame menu:\n");
-			printf("Type 'r,<1-9>,<A-I>' to reveal a position.\n");
-			printf("Type 'f,<1-9>,<A-I>' to flag a position.\n");
+			char lastRow[8];
+			if (game.height <= 26)
+				snprintf(lastRow, sizeof(lastRow), "A-%c", 'A' + game.height - 1);
+			else
+				snprintf(lastRow, sizeof(lastRow), "1-%d", game.height);
+			printf("Type 'r,<1-%d>,<%s>' to reveal a position.\n", game.width, lastRow);
+			printf("Type 'f,<1-%d>,<%s>' to flag a position, or unflag it.\n", game.width, lastRow);
+			printf("Type 'c,<1-%d>,<%s>' on a number to reveal around its flags.\n", game.width, lastRow);
+			printf("Type 'hint' for a tile that can be worked out.\n");
 			printf("Type 'quit' to end game.\n");
 		}
 		/* --- End user input --- */
@@ -464,53 +514,63 @@ int main(int argc, char* argv[])
 					printf("%s", "Invalid option. Try again!\n");
 			}
 			else { 
-				// Options are "r,<x>,<y>", "f,<x>,<y>", "quit", or "winhack"
-				int x = 0; char y = 0;
+				// Options are "r,<x>,<y>", "f,<x>,<y>", "c,<x>,<y>", "hint", "quit", or "winhack"
+				// y is a row letter, or a row number on boards taller than 26
+				char cmd = 0; int x = 0, y = 0; char row[8] = {0};
 				if (strncmp(txBuffer, "quit", 4) == 0)
 					formatOK = true;
 				else if (strncmp(txBuffer, "winhack", 7) == 0)
 					formatOK = true;
-				else if (strncmp(txBuffer, "r", 1) == 0 &&
-						 sscanf(txBuffer, "r,%1d,%1c", &x, &y) == 2)
-						formatOK = true;
-				else if (strncmp(txBuffer, "f", 1) == 0 &&
-						 sscanf(txBuffer, "f,%1d,%1c", &x, &y) == 2)
-						formatOK = true;
+				else if (strncmp(txBuffer, "hint", 4) == 0)
+					formatOK = true;
+				else if (sscanf(txBuffer, "%c,%d,%7[^,\r\n]", &cmd, &x, row) == 3 &&
+						 (cmd == 'r' || cmd == 'f' || cmd == 'c')) {
+					formatOK = true;
+					if (isalpha((unsigned char)row[0]) && row[1] == '\0')
+						y = tolower((unsigned char)row[0]) - 'a' + 1;
+					else
+						y = atoi(row);
+				}
 				else 
 					printf("%s", "Invalid option. Try again!\n");
 
-				if (formatOK && x && y) {
+				if (formatOK && cmd) {
 					// Check bounds on x, y
-					y = tolower(y);
-					if (x < 1 || x > 9 || y < 'a' || y > 'i') {
+					if (x < 1 || x > game.width || y < 1 || y > game.height) {
 						printf("Selection out of grid bounds. Try again!\n");
 						formatOK = false;
 					}
-					// Make sure tile has not already been revealed
-					else if( game.tiles[x-1][y-'a'].isRevealed ) {
-						printf("Tile %d,%c has already been revealed.\n", x, y);
+					// Chords are made on revealed numbers
+					else if( cmd == 'c' && (!gameTile(&game, x-1, y-1)->isRevealed || gameTile(&game, x-1, y-1)->isFlagged) ) {
+						printf("Tile %d,%s has not been revealed yet.\n", x, row);
 						formatOK = false;
 					}
-					// Make sure tile has not already been flagged
-					else if( game.tiles[x-1][y-'a'].isFlagged ) {
-						printf("Tile %d,%c has already been flagged.\n", x, y);
+					// Make sure tile has not already been revealed (flags are stored as revealed)
+					else if( cmd != 'c' && gameTile(&game, x-1, y-1)->isRevealed && !gameTile(&game, x-1, y-1)->isFlagged ) {
+						printf("Tile %d,%s has already been revealed.\n", x, row);
+						formatOK = false;
+					}
+					// Make sure tile has not been flagged, flagging again removes the flag
+					else if( cmd == 'r' && gameTile(&game, x-1, y-1)->isFlagged ) {
+						printf("Tile %d,%s has been flagged, flag it again to remove the flag.\n", x, row);
 						formatOK = false;
 					}
 					// Convert to array format
 					else {
-						txBuffer[2] = txBuffer[2] - 1;
-						if(txBuffer[4] >= 'a' && txBuffer[4] <= 'i'){
-							txBuffer[4] = txBuffer[4] - 'a' + '1' - 1;
-						}else if(txBuffer[4] >= 'A' && txBuffer[4] <= 'I'){
-							txBuffer[4] = txBuffer[4] - 'A' + '1' - 1;
-						}else{
-							txBuffer[4] = txBuffer[4] - 1;
-						}
+						snprintf(txBuffer, MAX_TX_SIZE, "%c,%d,%d", cmd, x-1, y-1);
 					}
 				}
 			}
 		} // End while: formatOK == true
 
+		// Ask for framing, and binary tiles on top, along with the credentials
+		if (!auth && offerFrame) {
+			txBuffer[strcspn(txBuffer, "\r\n")] = '\0';
+			strncat(txBuffer, "," FRAME_FEATURE, MAX_TX_SIZE - strlen(txBuffer) - 1);
+			if (offerBinary)
+				strncat(txBuffer, "," BINARY_FEATURE, MAX_TX_SIZE - strlen(txBuffer) - 1);
+		}
+
 		// Send message
 		if(!sndMsg(cID, txBuffer))
 			break; // Failed to send message
@@ -519,27 +579,62 @@ int main(int argc, char* argv[])
 	}
 	
 	closeSocket(cID);
+	m_freeGame(gamePtr);
 	return 0;
 }
 
 bool sndMsg(int cID, char* txBuffer){
 	//printf("Sending !%s!\n", txBuffer);
-	if (send(cID, txBuffer, strlen(txBuffer), 0) == -1) {
+	size_t len = strlen(txBuffer);
+
+	// Prefix a header when framed, sent with the payload in one go
+	Buffer frame = {0};
+	if (framed) {
+		appendFrame(&frame, txBuffer, len);
+		txBuffer = frame.data;
+		len = frame.len;
+	}
+
+	bool ok = true;
+	if (send(cID, txBuffer, len, 0) == -1) {
 		perror("Failed to send data");
-		return false;
+		ok = false;
 	}
-	return true;
+	freeBuffer(&frame);
+	return ok;
 }
 
-bool rcvMsg(int cID, char* rxBuffer){
-	memset(rxBuffer, 0, MAX_RX_SIZE*sizeof(char));
+bool rcvMsg(int cID, char** rxBuffer){
+	char* message;
+	size_t len;
+
+	while (true) {
+		// Next complete message already buffered?
+		int status = framed ? nextFrame(&rx, &message, &len) : nextText(&rx, &message, &len);
+		if (status == FRAME_READY)
+			break;
+		if (status == FRAME_ERROR) {
+			printf("Oversized message received\n");
+			closeSocket(cID);
+			return false;
+		}
 
-	if (recv(cID, rxBuffer, MAX_RX_SIZE, 0) <= 0) {
-		perror("Failed to receive data");
-		closeSocket(cID);
-		return false;
+		// Receive more
+		size_t space;
+		char* buffer = frameReaderSpace(&rx, &space);
+		if (!framed && space > MAX_RX_SIZE)
+			space = MAX_RX_SIZE;
+		ssize_t received = recv(cID, buffer, space, 0);
+		if (received <= 0) {
+			perror("Failed to receive data");
+			closeSocket(cID);
+			return false;
+		}
+		frameReaderCommit(&rx, received);
 	}
-	//printf("Received: !%s!\n", rxBuffer);
+
+	//printf("Received: !%s!\n", message);
+	*rxBuffer = message;
+	rxLen = len;
 	return true;
 }
-
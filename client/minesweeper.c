@@ -17,21 +17,36 @@
 
 /* --- Public Functions --- */
 
-void m_initGame(GameState* game){
+void m_initGame(GameState* game, int width, int height, int nMines){
 	// Set defaults
 	game->isOver = false;
 	game->isWon = false;
-	game->remainingMines = N_MINES;
+	game->remainingMines = nMines;
+	game->hiddenSafe = width * height - nMines;
 	game->startTime = time(0);
+	game->width = width;
+	game->height = height;
+	game->startX = -1;
+	game->startY = -1;
 	
 	// Set default tiles
-	for (int i=0; i<N_TILES_X; i++) {
-		for (int j=0; j<N_TILES_Y; j++) {
-			game->tiles[i][j] = (Tile){0, false, false, false}; //c99 shorthand
-		}
+	free(game->tiles);
+	game->tiles = calloc(width * height, sizeof(Tile));
+	if (!game->tiles) {
+		perror("Out of memory in m_initGame");
+		exit(1);
 	}
 }
 
+void m_freeGame(GameState* game){
+	free(game->tiles);
+	game->tiles = NULL;
+}
+
 int getTile(GameState* game, int x, int y){
-	return (((game->tiles)[x][y]).nAdjacentMines);
+	return gameTile(game, x, y)->nAdjacentMines;
+}
+
+Tile* gameTile(GameState* game, int x, int y){
+	return &game->tiles[y * game->width + x];
 }
@@ -17,7 +17,7 @@
 
 
 /* Defines */
-#define N_TILES_X	9
+#define N_TILES_X	9	// default (beginner) board, if the server does not say
 #define N_TILES_Y	9
 #define N_MINES		10
 #define FLAG		-1
@@ -41,22 +41,36 @@ typedef struct
 	bool isOver;
 	bool isWon;
 	int remainingMines;
+	int hiddenSafe; // safe tiles not yet revealed
 	time_t startTime;
 	time_t endTime;
-	Tile tiles[N_TILES_X][N_TILES_Y];
+	int width;
+	int height;
+	int startX; // no-guess games: the tile to open first, -1 otherwise
+	int startY;
+	Tile* tiles; // row-major, width*height
 } GameState;
 
 
 /* --- Public Function Prototypes --- */
 
 // initGame
-// sets up the new game structure
-void m_initGame(GameState* game);
+// sets up the new game structure for a width x height board
+// frees the previous board, so game must be zeroed before first use
+void m_initGame(GameState* game, int width, int height, int nMines);
+
+// freeGame
+// releases the board allocated by m_initGame
+void m_freeGame(GameState* game);
 
 // getTile
 // returns the Tile value at location x,y
 int getTile(GameState* game, int x, int y);
 
+// gameTile
+// returns the Tile at location x,y
+Tile* gameTile(GameState* game, int x, int y);
+
 
 
 
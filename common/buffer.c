@@ -0,0 +1,127 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * common/buffer.c
+ * Growable byte buffers shared by client and server
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    26/10/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Includes */
+#include "buffer.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+
+/* Defines */
+#define MIN_BUFFER_SIZE 64
+
+
+/* Public functions */
+/// reserveBuffer
+/// Ensures room for extra more bytes, returns a pointer to the end of the data
+char* reserveBuffer(Buffer* buffer, size_t extra)
+{
+	if (buffer->len + extra > buffer->cap) {
+		size_t cap = buffer->cap ? buffer->cap : MIN_BUFFER_SIZE;
+		while (cap < buffer->len + extra)
+			cap *= 2;
+
+		char* data = realloc(buffer->data, cap);
+		if (!data) {
+			perror("Out of memory in reserveBuffer");
+			exit(1);
+		}
+		buffer->data = data;
+		buffer->cap = cap;
+	}
+
+	return buffer->data + buffer->len;
+}
+
+
+/// appendBuffer
+/// Appends len bytes of data
+void appendBuffer(Buffer* buffer, const void* data, size_t len)
+{
+	memcpy(reserveBuffer(buffer, len), data, len);
+	buffer->len += len;
+}
+
+
+/// appendFormat
+/// Appends printf-style formatted text, without the terminating NUL
+void appendFormat(Buffer* buffer, const char* format, ...)
+{
+	va_list args;
+
+	// Try to fit into the existing space first
+	size_t space = buffer->cap - buffer->len;
+	va_start(args, format);
+	int len = vsnprintf(space ? buffer->data + buffer->len : NULL, space, format, args);
+	va_end(args);
+
+	// Grow and format again
+	if ((size_t)len >= space) {
+		reserveBuffer(buffer, len + 1);
+		va_start(args, format);
+		vsnprintf(buffer->data + buffer->len, len + 1, format, args);
+		va_end(args);
+	}
+
+	buffer->len += len;
+}
+
+
+/// clearBuffer
+/// Empties the buffer, keeping its allocation
+void clearBuffer(Buffer* buffer)
+{
+	buffer->len = 0;
+}
+
+
+/// freeBuffer
+/// Deallocates the buffer, leaving it empty and valid
+void freeBuffer(Buffer* buffer)
+{
+	free(buffer->data);
+	buffer->data = NULL;
+	buffer->len = 0;
+	buffer->cap = 0;
+}
+
+
+/// newRefBuffer
+/// Returns an immutable copy of the data in buffer, holding one reference
+RefBuffer* newRefBuffer(const Buffer* buffer)
+{
+	RefBuffer* shared = malloc(sizeof(RefBuffer) + buffer->len);
+	if (!shared) {
+		perror("Out of memory in newRefBuffer");
+		exit(1);
+	}
+	atomic_init(&shared->refs, 1);
+	shared->len = buffer->len;
+	memcpy(shared->data, buffer->data, buffer->len);
+	return shared;
+}
+
+
+/// retainRefBuffer
+/// Takes another reference
+void retainRefBuffer(RefBuffer* shared)
+{
+	atomic_fetch_add(&shared->refs, 1);
+}
+
+
+/// releaseRefBuffer
+/// Drops one reference, freeing the bytes when none remain
+void releaseRefBuffer(RefBuffer* shared)
+{
+	if (atomic_fetch_sub(&shared->refs, 1) == 1)
+		free(shared);
+}
@@ -0,0 +1,81 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * common/buffer.h
+ * Header for growable byte buffers shared by client and server
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    26/10/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef __common_buffer__h__
+#define __common_buffer__h__
+
+/* Includes */
+#include <stddef.h>
+#include <stdatomic.h>
+
+
+/* Types */
+/// Buffer structure
+/// Heap allocated, grows on demand. A zeroed Buffer is valid and empty.
+typedef struct
+{
+	char* data;
+	size_t len;
+	size_t cap;
+} Buffer;
+
+
+/// RefBuffer structure
+/// Immutable bytes with several owners, such as one message queued to many
+/// sockets; freed when the last reference is released
+typedef struct
+{
+	atomic_int refs;
+	size_t len;
+	char data[];
+} RefBuffer;
+
+
+/* Public function prototypes */
+/// reserveBuffer
+/// Ensures room for extra more bytes, returns a pointer to the end of the data
+char* reserveBuffer(Buffer* buffer, size_t extra);
+
+
+/// appendBuffer
+/// Appends len bytes of data
+void appendBuffer(Buffer* buffer, const void* data, size_t len);
+
+
+/// appendFormat
+/// Appends printf-style formatted text, without the terminating NUL
+void appendFormat(Buffer* buffer, const char* format, ...);
+
+
+/// clearBuffer
+/// Empties the buffer, keeping its allocation
+void clearBuffer(Buffer* buffer);
+
+
+/// freeBuffer
+/// Deallocates the buffer, leaving it empty and valid
+void freeBuffer(Buffer* buffer);
+
+
+/// newRefBuffer
+/// Returns an immutable copy of the data in buffer, holding one reference
+RefBuffer* newRefBuffer(const Buffer* buffer);
+
+
+/// retainRefBuffer
+/// Takes another reference
+void retainRefBuffer(RefBuffer* shared);
+
+
+/// releaseRefBuffer
+/// Drops one reference, freeing the bytes when none remain
+void releaseRefBuffer(RefBuffer* shared);
+
+
+#endif
@@ -0,0 +1,214 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * common/frame.c
+ * Length-prefixed message framing
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    26/10/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Includes */
+#include "frame.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+
+/* Private functions */
+/// releaseHeld
+/// Restores the byte overwritten when the previous payload was NUL terminated
+void releaseHeld(FrameReader* reader)
+{
+	if (reader->holding) {
+		reader->data[reader->heldAt] = reader->held;
+		reader->holding = false;
+	}
+}
+
+
+/// terminate
+/// NUL terminates the payload at [at, at+len) in place
+char* terminate(FrameReader* reader, size_t at, size_t len)
+{
+	// Bytes past end are unused, only bytes of a following frame need keeping
+	if (at + len < reader->end) {
+		reader->held = reader->data[at + len];
+		reader->heldAt = at + len;
+		reader->holding = true;
+	}
+	reader->data[at + len] = '\0';
+
+	return reader->data + at;
+}
+
+
+/// readHeader
+/// Decodes a big-endian payload length
+size_t readHeader(const char* header)
+{
+	const unsigned char* h = (const unsigned char*)header;
+	return ((uint32_t)h[0] << 24) | ((uint32_t)h[1] << 16) | ((uint32_t)h[2] << 8) | h[3];
+}
+
+
+/// writeHeader
+/// Encodes a big-endian payload length
+void writeHeader(char* header, size_t len)
+{
+	header[0] = (char)(len >> 24);
+	header[1] = (char)(len >> 16);
+	header[2] = (char)(len >> 8);
+	header[3] = (char)len;
+}
+
+
+/* Public functions */
+/// initFrameReader
+/// Sets up an empty reader accepting payloads up to maxFrame bytes
+void initFrameReader(FrameReader* reader, size_t cap, size_t maxFrame)
+{
+	memset(reader, 0, sizeof(FrameReader));
+	reader->maxFrame = maxFrame;
+	reader->cap = cap + 1; // room for a NUL after the last byte
+	reader->data = malloc(reader->cap);
+	if (!reader->data) {
+		perror("Out of memory in initFrameReader");
+		exit(1);
+	}
+}
+
+
+/// freeFrameReader
+/// Deallocates the receive buffer
+void freeFrameReader(FrameReader* reader)
+{
+	free(reader->data);
+	reader->data = NULL;
+	reader->cap = 0;
+}
+
+
+/// frameReaderSpace
+/// Returns where the next recv should write, and how many bytes fit
+/// Compacts or grows the buffer so a partial frame can always complete
+char* frameReaderSpace(FrameReader* reader, size_t* space)
+{
+	releaseHeld(reader);
+
+	// Everything consumed, rewind for free
+	if (reader->start == reader->end) {
+		reader->start = 0;
+		reader->end = 0;
+	}
+
+	// Bytes still needed for the pending frame, if its header has arrived
+	size_t pending = reader->end - reader->start;
+	size_t needed = FRAME_HEADER_SIZE;
+	if (pending >= FRAME_HEADER_SIZE)
+		needed += readHeader(reader->data + reader->start);
+
+	// Move only the pending partial frame to the front when out of room,
+	// or once the consumed prefix dominates the buffer
+	size_t remaining = needed > pending ? needed - pending : 0;
+	if (reader->start > 0 && (reader->cap - 1 - reader->end < remaining || reader->start >= (reader->cap - 1) / 2)) {
+		memmove(reader->data, reader->data + reader->start, pending);
+		reader->start = 0;
+		reader->end = pending;
+	}
+
+	// Grow to fit a frame larger than the buffer
+	if (needed > reader->cap - 1 - reader->start && needed <= reader->maxFrame + FRAME_HEADER_SIZE) {
+		char* data = realloc(reader->data, reader->start + needed + 1);
+		if (!data) {
+			perror("Out of memory in frameReaderSpace");
+			exit(1);
+		}
+		reader->data = data;
+		reader->cap = reader->start + needed + 1;
+	}
+
+	*space = reader->cap - 1 - reader->end;
+	return reader->data + reader->end;
+}
+
+
+/// frameReaderCommit
+/// Marks received bytes as written into the space returned above
+void frameReaderCommit(FrameReader* reader, size_t received)
+{
+	reader->end += received;
+}
+
+
+/// nextFrame
+/// Returns FRAME_READY and the next complete payload, FRAME_PARTIAL if more
+/// bytes are needed, or FRAME_ERROR on an oversized frame
+/// The payload stays valid until the next call on the reader
+int nextFrame(FrameReader* reader, char** payload, size_t* len)
+{
+	releaseHeld(reader);
+
+	size_t pending = reader->end - reader->start;
+	if (pending < FRAME_HEADER_SIZE)
+		return FRAME_PARTIAL;
+
+	size_t frameLen = readHeader(reader->data + reader->start);
+	if (frameLen > reader->maxFrame)
+		return FRAME_ERROR;
+	if (pending < FRAME_HEADER_SIZE + frameLen)
+		return FRAME_PARTIAL;
+
+	// Consume frame
+	size_t at = reader->start + FRAME_HEADER_SIZE;
+	reader->start = at + frameLen;
+	*payload = terminate(reader, at, frameLen);
+	*len = frameLen;
+	return FRAME_READY;
+}
+
+
+/// nextText
+/// Unframed fallback: returns every buffered byte as a single message
+int nextText(FrameReader* reader, char** payload, size_t* len)
+{
+	releaseHeld(reader);
+
+	if (reader->start == reader->end)
+		return FRAME_PARTIAL;
+
+	size_t at = reader->start;
+	*len = reader->end - reader->start;
+	reader->start = reader->end;
+	*payload = terminate(reader, at, *len);
+	return FRAME_READY;
+}
+
+
+/// beginFrame
+/// Reserves a header in out, returns its offset for endFrame
+size_t beginFrame(Buffer* out)
+{
+	size_t header = out->len;
+	reserveBuffer(out, FRAME_HEADER_SIZE);
+	out->len += FRAME_HEADER_SIZE;
+	return header;
+}
+
+
+/// endFrame
+/// Fills in the header reserved by beginFrame with the payload length since
+void endFrame(Buffer* out, size_t header)
+{
+	writeHeader(out->data + header, out->len - header - FRAME_HEADER_SIZE);
+}
+
+
+/// appendFrame
+/// Appends a header and payload to out
+void appendFrame(Buffer* out, const void* payload, size_t len)
+{
+	writeHeader(reserveBuffer(out, FRAME_HEADER_SIZE + len), len);
+	out->len += FRAME_HEADER_SIZE;
+	appendBuffer(out, payload, len);
+}
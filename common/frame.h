@@ -0,0 +1,93 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * common/frame.h
+ * Header for length-prefixed message framing
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    26/10/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef __common_frame__h__
+#define __common_frame__h__
+
+/* Includes */
+#include <stddef.h>
+#include <stdbool.h>
+#include "buffer.h"
+
+
+/* Defines */
+#define FRAME_FEATURE     "frame" // negotiated in "connect" and "user,pass"
+#define FRAME_HEADER_SIZE 4       // big-endian payload length
+#define FRAME_READY       1
+#define FRAME_PARTIAL     0
+#define FRAME_ERROR      -1
+
+
+/* Types */
+/// FrameReader structure
+/// Incremental decoder over a receive buffer. Complete frames are returned
+/// in place, NUL terminated, without being copied out of the buffer.
+typedef struct
+{
+	char* data;
+	size_t cap;
+	size_t start;    // first unconsumed byte
+	size_t end;      // end of received bytes
+	size_t maxFrame; // largest payload accepted
+	size_t heldAt;   // position overwritten by the last NUL terminator
+	char held;       // byte that was there
+	bool holding;
+} FrameReader;
+
+
+/* Public function prototypes */
+/// initFrameReader
+/// Sets up an empty reader accepting payloads up to maxFrame bytes
+void initFrameReader(FrameReader* reader, size_t cap, size_t maxFrame);
+
+
+/// freeFrameReader
+/// Deallocates the receive buffer
+void freeFrameReader(FrameReader* reader);
+
+
+/// frameReaderSpace
+/// Returns where the next recv should write, and how many bytes fit
+/// Compacts or grows the buffer so a partial frame can always complete
+char* frameReaderSpace(FrameReader* reader, size_t* space);
+
+
+/// frameReaderCommit
+/// Marks received bytes as written into the space returned above
+void frameReaderCommit(FrameReader* reader, size_t received);
+
+
+/// nextFrame
+/// Returns FRAME_READY and the next complete payload, FRAME_PARTIAL if more
+/// bytes are needed, or FRAME_ERROR on an oversized frame
+/// The payload stays valid until the next call on the reader
+int nextFrame(FrameReader* reader, char** payload, size_t* len);
+
+
+/// nextText
+/// Unframed fallback: returns every buffered byte as a single message
+int nextText(FrameReader* reader, char** payload, size_t* len);
+
+
+/// beginFrame
+/// Reserves a header in out, returns its offset for endFrame
+size_t beginFrame(Buffer* out);
+
+
+/// endFrame
+/// Fills in the header reserved by beginFrame with the payload length since
+void endFrame(Buffer* out, size_t header);
+
+
+/// appendFrame
+/// Appends a header and payload to out
+void appendFrame(Buffer* out, const void* payload, size_t len);
+
+
+#endif
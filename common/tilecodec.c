@@ -0,0 +1,244 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * common/tilecodec.c
+ * Tile message encoding shared by client and server
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    27/10/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Includes */
+#include "tilecodec.h"
+#include <string.h>
+#include <stdint.h>
+
+
+/* Private functions */
+/// appendVarint
+/// Appends a signed value as a zigzag LEB128 varint
+void appendVarint(Buffer* out, int value)
+{
+	uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+	unsigned char* at = (unsigned char*)reserveBuffer(out, 5);
+	int len = 0;
+
+	while (zigzag >= 0x80) {
+		at[len++] = (unsigned char)(zigzag | 0x80);
+		zigzag >>= 7;
+	}
+	at[len++] = (unsigned char)zigzag;
+	out->len += len;
+}
+
+
+/// readVarint
+/// Reads a zigzag LEB128 varint, returns false if truncated
+bool readVarint(TileDecoder* decoder, int* value)
+{
+	uint32_t zigzag = 0;
+	int shift = 0;
+
+	while (decoder->at < decoder->end && shift < 35) {
+		unsigned char byte = *decoder->at++;
+		zigzag |= (uint32_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			*value = (int)(zigzag >> 1) ^ -(int)(zigzag & 1);
+			return true;
+		}
+		shift += 7;
+	}
+
+	return false;
+}
+
+
+/// readNumber
+/// Reads a decimal field followed by ',' or the end of the message
+bool readNumber(TileDecoder* decoder, int* value)
+{
+	bool negative = false;
+	if (decoder->at < decoder->end && *decoder->at == '-') {
+		negative = true;
+		decoder->at++;
+	}
+
+	const unsigned char* start = decoder->at;
+	int number = 0;
+	while (decoder->at < decoder->end && *decoder->at >= '0' && *decoder->at <= '9')
+		number = number * 10 + (*decoder->at++ - '0');
+	if (decoder->at == start)
+		return false;
+
+	// Skip separator
+	if (decoder->at < decoder->end)
+		decoder->at++;
+
+	*value = negative ? -number : number;
+	return true;
+}
+
+
+/// stateNibble
+/// Packs tile data into a binary state nibble
+int stateNibble(int n, bool flagged, bool mine)
+{
+	if (n == TILE_HIDDEN_COUNT)
+		return TILE_HIDDEN;
+	if (mine)
+		return flagged ? TILE_FLAGGED_MINE : TILE_MINE;
+	if (flagged)
+		return TILE_FLAGGED;
+	return n;
+}
+
+
+/// closeRun
+/// Writes the count of the open binary run
+void closeRun(TileEncoder* encoder)
+{
+	if (encoder->runLen > 0)
+		encoder->out->data[encoder->runAt] = (char)encoder->runLen;
+	encoder->runLen = 0;
+}
+
+
+/* Public functions */
+/// initTileEncoder
+/// Starts a tile message in out
+void initTileEncoder(TileEncoder* encoder, Buffer* out, bool binary)
+{
+	memset(encoder, 0, sizeof(TileEncoder));
+	encoder->out = out;
+	encoder->binary = binary;
+
+	if (binary) {
+		char marker = BINARY_TILES;
+		appendBuffer(out, &marker, 1);
+	}
+}
+
+
+/// encodeTile
+/// Appends one tile: n adjacent mines, flagged, mine
+void encodeTile(TileEncoder* encoder, int x, int y, int n, bool flagged, bool mine)
+{
+	Buffer* out = encoder->out;
+	encoder->nTiles++;
+
+	if (!encoder->binary) {
+		appendFormat(out, "t,%d,%d,%d,%d,%d,", x, y, n, flagged, mine);
+		return;
+	}
+
+	// Start a new run unless the tile directly follows the open one
+	bool extends = encoder->runLen > 0 && encoder->runLen < MAX_TILE_RUN &&
+	               y == encoder->runY && x == encoder->runX + encoder->runLen;
+	if (!extends) {
+		closeRun(encoder);
+		appendVarint(out, x);
+		appendVarint(out, y);
+		encoder->runAt = out->len;
+		appendBuffer(out, "", 1); // count, filled in by closeRun
+		encoder->runX = x;
+		encoder->runY = y;
+	}
+
+	// Pack two tiles per byte, low nibble first
+	int nibble = stateNibble(n, flagged, mine);
+	if (encoder->runLen % 2 == 0) {
+		char byte = (char)nibble;
+		appendBuffer(out, &byte, 1);
+	}
+	else {
+		out->data[out->len - 1] |= (char)(nibble << 4);
+	}
+	encoder->runLen++;
+}
+
+
+/// finishTiles
+/// Completes the message, returns the number of tiles encoded
+size_t finishTiles(TileEncoder* encoder)
+{
+	if (encoder->binary) {
+		closeRun(encoder);
+	}
+	else if (encoder->nTiles > 0) {
+		// Replace last , with 0
+		encoder->out->data[encoder->out->len - 1] = '\0';
+	}
+
+	return encoder->nTiles;
+}
+
+
+/// isTileMessage
+/// Returns whether a received message carries tiles, in either encoding
+bool isTileMessage(const char* message, size_t len)
+{
+	return len > 0 && (message[0] == BINARY_TILES || strncmp(message, "t,", 2) == 0);
+}
+
+
+/// initTileDecoder
+/// Starts iterating the tiles of a message accepted by isTileMessage
+void initTileDecoder(TileDecoder* decoder, const char* message, size_t len)
+{
+	memset(decoder, 0, sizeof(TileDecoder));
+	decoder->at = (const unsigned char*)message;
+	decoder->end = decoder->at + len;
+	decoder->binary = (len > 0 && message[0] == BINARY_TILES);
+	if (decoder->binary)
+		decoder->at++;
+}
+
+
+/// nextTile
+/// Decodes the next tile, returns false once the message is exhausted
+bool nextTile(TileDecoder* decoder, int* x, int* y, int* n, bool* flagged, bool* mine)
+{
+	if (!decoder->binary) {
+		// "t,<x>,<y>,<n>,<flagged>,<mine>", separated by ','
+		int f, m;
+		if (decoder->end - decoder->at < 2 || decoder->at[0] != 't' || decoder->at[1] != ',')
+			return false;
+		decoder->at += 2;
+		if (!readNumber(decoder, x) || !readNumber(decoder, y) || !readNumber(decoder, n) ||
+		    !readNumber(decoder, &f) || !readNumber(decoder, &m))
+			return false;
+		*flagged = f;
+		*mine = m;
+		return true;
+	}
+
+	// Open the next run
+	if (decoder->runLen == 0) {
+		if (!readVarint(decoder, &decoder->runX) || !readVarint(decoder, &decoder->runY) ||
+		    decoder->at >= decoder->end)
+			return false;
+		decoder->runLen = *decoder->at++;
+		decoder->nibble = 0;
+		if (decoder->runLen == 0 || decoder->end - decoder->at < (decoder->runLen + 1) / 2)
+			return false;
+	}
+
+	// Unpack state nibble
+	int state = decoder->at[decoder->nibble / 2];
+	state = (decoder->nibble % 2) ? state >> 4 : state & 0xf;
+	*x = decoder->runX + decoder->nibble;
+	*y = decoder->runY;
+	*n = state <= 8 ? state : 0;
+	*flagged = (state == TILE_FLAGGED || state == TILE_FLAGGED_MINE);
+	*mine = (state == TILE_FLAGGED_MINE || state == TILE_MINE);
+	if (state == TILE_FLAGGED || state == TILE_FLAGGED_MINE)
+		*n = 9; // matches the text flag reply
+	else if (state == TILE_HIDDEN)
+		*n = TILE_HIDDEN_COUNT;
+
+	// Step past the run once exhausted
+	decoder->nibble++;
+	if (--decoder->runLen == 0)
+		decoder->at += (decoder->nibble + 1) / 2;
+
+	return true;
+}
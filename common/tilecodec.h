@@ -0,0 +1,94 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * common/tilecodec.h
+ * Header for tile message encoding shared by client and server
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    27/10/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef __common_tilecodec__h__
+#define __common_tilecodec__h__
+
+/* Includes */
+#include <stddef.h>
+#include <stdbool.h>
+#include "buffer.h"
+
+
+/* Defines */
+#define BINARY_FEATURE "bin" // negotiated in "connect" and "user,pass", requires framing
+#define BINARY_TILES   'B'   // first byte of a binary tile message
+#define MAX_TILE_RUN   255
+
+// Binary tile state nibbles
+#define TILE_FLAGGED      9  // flagged, no mine
+#define TILE_FLAGGED_MINE 10 // flagged, mine
+#define TILE_MINE         11 // unflagged mine, only sent once the game is over
+#define TILE_HIDDEN       12 // unrevealed and unflagged, sent when a flag is removed
+#define TILE_HIDDEN_COUNT -1 // adjacent mines given for a TILE_HIDDEN tile, in either encoding
+
+
+/* Types */
+/// TileEncoder structure
+/// Appends tiles to a buffer as "t,<x>,<y>,<n>,<flagged>,<mine>" text, or as
+/// binary runs: zigzag varint x, zigzag varint y, count byte, then count
+/// state nibbles (low nibble first) for tiles x..x+count-1 on row y
+typedef struct
+{
+	Buffer* out;
+	bool binary;
+	size_t nTiles; // tiles encoded so far
+	size_t runAt;  // offset of the open run's count byte
+	int runX;
+	int runY;
+	int runLen;    // 0 when no run is open
+} TileEncoder;
+
+
+/// TileDecoder structure
+/// Iterates the tiles of a text or binary tile message
+typedef struct
+{
+	const unsigned char* at;
+	const unsigned char* end;
+	bool binary;
+	int runX;
+	int runY;
+	int runLen;    // tiles left in the current run
+	int nibble;    // index of the next nibble in the current run
+} TileDecoder;
+
+
+/* Public function prototypes */
+/// initTileEncoder
+/// Starts a tile message in out
+void initTileEncoder(TileEncoder* encoder, Buffer* out, bool binary);
+
+
+/// encodeTile
+/// Appends one tile: n adjacent mines, flagged, mine
+void encodeTile(TileEncoder* encoder, int x, int y, int n, bool flagged, bool mine);
+
+
+/// finishTiles
+/// Completes the message, returns the number of tiles encoded
+size_t finishTiles(TileEncoder* encoder);
+
+
+/// isTileMessage
+/// Returns whether a received message carries tiles, in either encoding
+bool isTileMessage(const char* message, size_t len);
+
+
+/// initTileDecoder
+/// Starts iterating the tiles of a message accepted by isTileMessage
+void initTileDecoder(TileDecoder* decoder, const char* message, size_t len);
+
+
+/// nextTile
+/// Decodes the next tile, returns false once the message is exhausted
+bool nextTile(TileDecoder* decoder, int* x, int* y, int* n, bool* flagged, bool* mine);
+
+
+#endif
@@ -0,0 +1,213 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * server/boardpool.c
+ * Server-side pool of pre-generated no-guess boards
+ * Background workers keep a bounded ring of laid out no-guess boards per
+ * preset, so starting one only pops it
+ * Standard boards are not pooled: their mines wait for the first reveal, so
+ * setting one up inline costs no more than popping it
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    1/11/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Includes */
+#include "boardpool.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+
+/* Types */
+/// BoardRing structure
+/// Ready boards of one preset, popped from head
+typedef struct
+{
+	GameState boards[POOL_SIZE];
+	int head;
+	int count;
+	PoolStats stats;
+} BoardRing;
+
+
+/* Defines */
+static BoardRing rings[POOL_PRESETS];
+static pthread_t workers[POOL_WORKERS];
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolNotFull = PTHREAD_COND_INITIALIZER;
+static int pending[POOL_PRESETS]; // boards being generated, counted against the ring
+static bool running = false;
+
+
+/* Private functions */
+/// ringIndex
+/// Returns the index of the ring holding a preset's boards, or -1 if not pooled
+int ringIndex(Difficulty difficulty, bool noGuess)
+{
+	if (!noGuess || difficulty < 0 || difficulty >= POOL_PRESETS)
+		return -1;
+	return difficulty;
+}
+
+
+/// pooledRing
+/// Returns the ring holding boards of config, or NULL if it is not pooled
+BoardRing* pooledRing(const BoardConfig* config)
+{
+	int r = ringIndex(config->difficulty, config->noGuess);
+	return (r < 0) ? NULL : &rings[r];
+}
+
+
+/// emptiestRing
+/// Returns the ring with the most room left, or -1 if every ring is full
+/// Requires poolLock
+int emptiestRing()
+{
+	int best = -1, bestRoom = 0;
+	for (int p=0; p<POOL_PRESETS; p++) {
+		int room = POOL_SIZE - rings[p].count - pending[p];
+		if (room > bestRoom) {
+			best = p;
+			bestRoom = room;
+		}
+	}
+	return best;
+}
+
+
+/// fillRings
+/// Worker loop: generates boards outside the lock until told to stop
+void* fillRings(void* data)
+{
+	pthread_mutex_lock(&poolLock);
+	while (running) {
+		int r = emptiestRing();
+		if (r < 0) {
+			pthread_cond_wait(&poolNotFull, &poolLock);
+			continue;
+		}
+
+		// Generate without holding the lock
+		pending[r]++;
+		pthread_mutex_unlock(&poolLock);
+		BoardConfig config = presetConfig(r);
+		config.noGuess = true;
+		GameState board = {0};
+		bool made = initGame(&board, &config);
+		pthread_mutex_lock(&poolLock);
+		pending[r]--;
+		if (!made)
+			continue; // no-guess layouts all stuck, try a fresh seed
+
+		// Push to tail
+		BoardRing* ring = &rings[r];
+		ring->boards[(ring->head + ring->count) % POOL_SIZE] = board;
+		ring->count++;
+	}
+	pthread_mutex_unlock(&poolLock);
+	return NULL;
+}
+
+
+
+/* Public functions */
+/// initBoardPool
+/// Starts the workers that keep every ring filled
+void initBoardPool()
+{
+	running = true;
+	for (int i=0; i<POOL_WORKERS; i++) {
+		if (pthread_create(&workers[i], NULL, fillRings, NULL) != 0) {
+			perror("Failed to start board pool worker");
+			exit(1);
+		}
+	}
+}
+
+
+/// destroyBoardPool
+/// Stops the workers and frees every ready board
+void destroyBoardPool()
+{
+	pthread_mutex_lock(&poolLock);
+	running = false;
+	pthread_cond_broadcast(&poolNotFull);
+	pthread_mutex_unlock(&poolLock);
+	for (int i=0; i<POOL_WORKERS; i++)
+		pthread_join(workers[i], NULL);
+
+	for (int p=0; p<POOL_PRESETS; p++) {
+		BoardRing* ring = &rings[p];
+		for (; ring->count > 0; ring->count--) {
+			freeGame(&ring->boards[ring->head]);
+			ring->head = (ring->head + 1) % POOL_SIZE;
+		}
+	}
+}
+
+
+/// acquireGame
+/// Sets up a new game as initGame does, taking a ready board when one is pooled
+/// Any previous game in the structure must have been released with freeGame
+/// Returns false, leaving the game freed, as initGame does
+bool acquireGame(GameState* game, const BoardConfig* config)
+{
+	BoardRing* ring = pooledRing(config);
+	if (ring != NULL) {
+		pthread_mutex_lock(&poolLock);
+		bool hit = (ring->count > 0);
+		if (hit) {
+			// Pop from head
+			*game = ring->boards[ring->head];
+			ring->head = (ring->head + 1) % POOL_SIZE;
+			ring->count--;
+			ring->stats.hits++;
+			pthread_cond_signal(&poolNotFull);
+		}
+		else {
+			ring->stats.misses++;
+		}
+		pthread_mutex_unlock(&poolLock);
+
+		// The clock starts when the game does, not when the board was made
+		if (hit) {
+			game->startTime = time(0);
+			return true;
+		}
+		printf("Board pool empty, generating a %dx%d board inline\n", config->width, config->height);
+	}
+
+	// Standard or custom board, or the ring ran dry
+	return initGame(game, config);
+}
+
+
+/// getPoolStats
+/// Returns the counters of the ring of a preset's no-guess boards
+PoolStats getPoolStats(Difficulty difficulty)
+{
+	PoolStats stats = {0};
+	int r = ringIndex(difficulty, true);
+	if (r < 0)
+		return stats;
+
+	pthread_mutex_lock(&poolLock);
+	stats = rings[r].stats;
+	stats.ready = rings[r].count;
+	pthread_mutex_unlock(&poolLock);
+	return stats;
+}
+
+
+/// printPoolStats
+/// Prints the counters of every ring
+void printPoolStats()
+{
+	static const char* names[POOL_PRESETS] = {"beginner", "intermediate", "expert"};
+	for (int p=0; p<POOL_PRESETS; p++) {
+		PoolStats stats = getPoolStats(p);
+		printf("Board pool %-12s noguess %ld hits, %ld misses, %d ready\n", names[p],
+		       stats.hits, stats.misses, stats.ready);
+	}
+}
@@ -0,0 +1,63 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * server/boardpool.h
+ * Header for the server-side pool of pre-generated no-guess boards
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    1/11/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef __server_boardpool__h__
+#define __server_boardpool__h__
+
+/* Includes */
+#include <stdbool.h>
+#include "minesweeper.h"
+
+
+/* Defines */
+#define POOL_PRESETS 3 // BEGINNER, INTERMEDIATE and EXPERT no-guess boards are pooled
+#define POOL_SIZE    16 // ready boards kept per ring
+#define POOL_WORKERS 2
+
+
+/* Types */
+/// PoolStats structure
+/// Counters of one ring, for sizing the pool
+typedef struct
+{
+	long hits;   // games started from a ready board
+	long misses; // games generated inline because the ring was empty
+	int ready;   // boards in the ring now
+} PoolStats;
+
+
+/* Public function prototypes */
+/// initBoardPool
+/// Starts the workers that keep every ring filled
+void initBoardPool();
+
+
+/// destroyBoardPool
+/// Stops the workers and frees every ready board
+void destroyBoardPool();
+
+
+/// acquireGame
+/// Sets up a new game as initGame does, taking a ready board when one is pooled
+/// Any previous game in the structure must have been released with freeGame
+/// Returns false, leaving the game freed, as initGame does
+bool acquireGame(GameState* game, const BoardConfig* config);
+
+
+/// getPoolStats
+/// Returns the counters of the ring of a preset's no-guess boards
+PoolStats getPoolStats(Difficulty difficulty);
+
+
+/// printPoolStats
+/// Prints the counters of every ring
+void printPoolStats();
+
+
+#endif
@@ -12,6 +12,8 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <errno.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -20,6 +22,23 @@
 #include "comms.h"
 #include "leaderboard.h"
 #include "minesweeper.h"
+#include "threadpool.h"
+#include "boardpool.h"
+#include "solver.h"
+#include "shared.h"
+
+
+/* Defines */
+static Session* closedSessions = NULL; // closed sessions awaiting reaping by the event loop
+static pthread_mutex_t closedLock = PTHREAD_MUTEX_INITIALIZER;
+static SharedBoard* sharedBoard = NULL; // created by the first player to join, freed with the last
+static Session* sharedPlayers[MAX_SHARED_PLAYERS];
+static int nSharedPlayers = 0;
+static pthread_rwlock_t sharedLock = PTHREAD_RWLOCK_INITIALIZER; // the players, and the board's lifetime
+static Session* liveSessions = NULL; // authenticated sessions that have not closed
+static pthread_mutex_t watchLock = PTHREAD_MUTEX_INITIALIZER; // live sessions, and who watches whom
+static Session* raceQueue = NULL; // sessions waiting for an opponent, oldest first
+static pthread_mutex_t raceLock = PTHREAD_MUTEX_INITIALIZER; // the race queue, and who races whom
 
 
 /* Private functions */
@@ -28,9 +47,9 @@
 int authUser(const char* message, char* user, char* pass)
 {
 	// Get username and password from message
-	if (sscanf(message, "%[^,\n],%[^,\n]", user, pass) != 2) {
+	if (sscanf(message, "%19[^,\n],%19[^,\n]", user, pass) != 2) {
 		printf("Received: %d results, user %s, pass %s\n",
-               sscanf(message, "%[^,\n],%[^,\n]", user, pass),
+               sscanf(message, "%19[^,\n],%19[^,\n]", user, pass),
                user, pass);
 		printf("%s", "Invalid user/pass format!\n");
 		fflush(stdout);
@@ -67,7 +86,7 @@ int authUser(const char* message, char* user, char* pass)
 
 
 /// parseMenuOption
-/// Parses received string as a menu option: play, lb, or exit
+/// Parses received string as a menu option: play, race, lb, watch, or exit
 MenuOption parseMenuOption(const char* buffer)
 {
 	// Check string matches
@@ -75,18 +94,88 @@ MenuOption parseMenuOption(const char* buffer)
 		return PLAY;
 	else if (strncmp(buffer, "lb", 2) == 0)
 		return LB;
+	else if (strncmp(buffer, "watch,", 6) == 0)
+		return WATCH;
+	else if (strncmp(buffer, "race,", 5) == 0)
+		return RACE;
 	else if (strncmp(buffer, "exit", 4) == 0)
 		return EXIT;
 	
 	// Invalid option
-	printf("%s", "Invalid option detected. Send 'play', 'lb', or 'exit'. Defaulting to 'exit'.\n");
+	printf("%s", "Invalid option detected. Send 'play', 'race,<difficulty>', 'lb', 'watch,<user>', or 'exit'. Defaulting to 'exit'.\n");
 	fflush(stdout);
 	return -1;
 }
 
 
+/// parsePlayOption
+/// Parses the board requested by
+/// "play[,beginner|intermediate|expert|<w>,<h>,<mines>][,noguess]"
+/// Returns false for an unknown preset or an invalid custom board
+bool parsePlayOption(const char* buffer, BoardConfig* config)
+{
+	const char* option = buffer + 4;
+	bool noGuess = strstr(option, ",noguess") != NULL;
+	*config = presetConfig(BEGINNER);
+	config->noGuess = noGuess;
+
+	// Plain "play" keeps the original beginner board
+	if (*option != ',' || strncmp(option, ",noguess", 8) == 0)
+		return validConfig(config);
+	option++;
+
+	if (strncmp(option, "beginner", 8) == 0)
+		return validConfig(config);
+	if (strncmp(option, "intermediate", 12) == 0) {
+		*config = presetConfig(INTERMEDIATE);
+		config->noGuess = noGuess;
+		return validConfig(config);
+	}
+	if (strncmp(option, "expert", 6) == 0) {
+		*config = presetConfig(EXPERT);
+		config->noGuess = noGuess;
+		return validConfig(config);
+	}
+
+	// Custom dimensions
+	config->difficulty = CUSTOM;
+	if (sscanf(option, "%d,%d,%d", &config->width, &config->height, &config->nMines) != 3 ||
+	    !validConfig(config)) {
+		printf("%s", "Invalid board! Expects 'play,<width>,<height>,<mines>'.\n");
+		fflush(stdout);
+		return false;
+	}
+
+	return true;
+}
+
+
+/// parseLeaderboardOption
+/// Parses "lb,<offset>,<limit>" or "lb,top,<k>" as the page of rows ranked
+/// offset+1 to offset+limit; plain "lb" asks for every row, streamed
+/// Returns false if malformed or the page is empty or too long
+bool parseLeaderboardOption(const char* buffer, bool* stream, long* offset, long* limit)
+{
+	const char* option = buffer + 2;
+	*stream = (option[strspn(option, "\r\n")] == '\0');
+	*offset = 0;
+	*limit = 0;
+	if (*stream)
+		return true;
+
+	if (strncmp(option, ",top,", 5) == 0) {
+		if (sscanf(option, ",top,%ld", limit) != 1)
+			return false;
+	}
+	else if (sscanf(option, ",%ld,%ld", offset, limit) != 2)
+		return false;
+	return *offset >= 0 && *limit > 0 && *limit <= MAX_LB_PAGE;
+}
+
+
 /// parseGameOption
-/// Parses received string as a game option: r, f, or quit
+/// Parses received string as a game option: r, f, c, b, hint, or quit
+/// Returns -1 if invalid, including a move without both coordinates
 GameOption parseGameOption(const char* buffer, int* x, int* y)
 {
 	// Check string matches
@@ -100,19 +189,41 @@ GameOption parseGameOption(const char* buffer, int* x, int* y)
 		fflush(stdout);
 		return WINHACK;
 	} 
+	else if (strncmp(buffer, "hint", 4) == 0) {
+		printf("%s", "Hint requested...\n");
+		fflush(stdout);
+		return HINT;
+	}
 	else if (strncmp(buffer, "r", 1) == 0) {
 		if( sscanf(buffer, "r,%d,%d", x, y) != 2) {
 			printf("%s", "Invalid reveal format! Expects 'r,<x>,<y>'.\n");
 			fflush(stdout);
+			return -1;
 		}
 		printf("Revealing tile %d,%d...\n", *x, *y);
 		fflush(stdout);
 		return REVEAL;
 	}
+	else if (strncmp(buffer, "b,", 2) == 0) {
+		printf("%s", "Applying batch of moves...\n");
+		fflush(stdout);
+		return BATCH;
+	}
+	else if (strncmp(buffer, "c", 1) == 0) {
+		if (sscanf(buffer, "c,%d,%d", x, y) != 2) {
+			printf("%s", "Invalid chord format! Expects 'c,<x>,<y>'.\n");
+			fflush(stdout);
+			return -1;
+		}
+		printf("Chording tile %d,%d...\n", *x, *y);
+		fflush(stdout);
+		return CHORD;
+	}
 	else if (strncmp(buffer, "f", 1) == 0) {
 		if (sscanf(buffer, "f,%d,%d", x, y) != 2) {
 			printf("%s", "Invalid flag format! Expects 'f,<x>,<y>'.\n");
 			fflush(stdout);
+			return -1;
 		}
 		printf("Flagging tile %d,%d...\n", *x, *y);
 		fflush(stdout);
@@ -120,208 +231,1603 @@ GameOption parseGameOption(const char* buffer, int* x, int* y)
 	}
 
 	// Invalid option
-	printf("%s", "Invalid option detected. Send 'r,<x>,<y>', 'f,<x>,<y>', or 'quit'. Defaulting to 'quit'.\n");
+	printf("%s", "Invalid option detected. Send 'r,<x>,<y>', 'f,<x>,<y>', 'c,<x>,<y>', 'b,...', 'hint', or 'quit'. Defaulting to 'quit'.\n");
 	fflush(stdout);
 	return -1;
 }
 
 
-/* Public functions */
-/// handleConnection
-/// Threaded function to handle the connection of a new user
-void handleConnection(int cID)
+/* Session functions */
+/// parseFeatures
+/// Parses the optional ",<feature>..." list following "user,pass"
+int parseFeatures(const char* message)
 {
-	// Create buffers for incoming and outgoing messages
-	char user[MAX_NAME_LENGTH], pass[MAX_NAME_LENGTH];
-	char rxBuffer[MAX_RX_SIZE];
+	int features = 0;
+
+	// Skip user and pass
+	const char* option = strchr(message, ',');
+	if (option)
+		option = strchr(option + 1, ',');
+
+	while (option != NULL) {
+		option++;
+		size_t len = strcspn(option, ",\n");
+		if (len == strlen(FRAME_FEATURE) && strncmp(option, FRAME_FEATURE, len) == 0)
+			features |= FEATURE_FRAME;
+		else if (len == strlen(BINARY_FEATURE) && strncmp(option, BINARY_FEATURE, len) == 0)
+			features |= FEATURE_BINARY;
+		option = strchr(option, ',');
+	}
+
+	// Binary messages can contain NULs, so are only usable when framed
+	if (!(features & FEATURE_FRAME))
+		features &= ~FEATURE_BINARY;
+
+	return features;
+}
+
+
+/// newPushMessage
+/// Frames payload as a message for pushMessage, holding one reference
+RefBuffer* newPushMessage(const void* payload, size_t len)
+{
+	Buffer framed = {0};
+	appendFrame(&framed, payload, len);
+	RefBuffer* message = newRefBuffer(&framed);
+	freeBuffer(&framed);
+	return message;
+}
+
+
+/// appendSegment
+/// Queues a shared message after everything queued so far, under txLock
+void appendSegment(Session* session, RefBuffer* message)
+{
+	TxSegment* segment = malloc(sizeof(TxSegment));
+	if (!segment) {
+		perror("Out of memory in appendSegment");
+		exit(1);
+	}
+	retainRefBuffer(message);
+	segment->message = message;
+	segment->at = session->txQueue.len; // after everything queued so far
+	segment->next = NULL;
+	if (session->txTail != NULL)
+		session->txTail->next = segment;
+	else
+		session->txHead = segment;
+	session->txTail = segment;
+	session->segmentBytes += message->len;
+}
+
+
+/// pushMessage
+/// Queues a message shared with other sessions, without copying it, and
+/// wakes the session to send it; callable from any thread
+/// Unless forced, the message is dropped once the session has fallen
+/// MAX_PUSH_BACKLOG bytes behind
+/// Returns false if dropped
+bool pushMessage(Session* session, RefBuffer* message, bool force)
+{
+	pthread_mutex_lock(&session->txLock);
+	bool dropped = !force &&
+	               session->txQueue.len - session->txSent + session->segmentBytes > MAX_PUSH_BACKLOG;
+	if (!dropped)
+		appendSegment(session, message);
+	pthread_mutex_unlock(&session->txLock);
+
+	if (!dropped)
+		notifySession(session, EVENT_WRITE);
+	return !dropped;
+}
+
+
+/// isWatchable
+/// Returns whether the session's replies belong to a game spectators can follow
+bool isWatchable(Session* session)
+{
+	return (session->state == SESSION_GAME || session->state == SESSION_GAMEOVER) &&
+	       session->endless == NULL && session->shared == NULL;
+}
+
+
+/// transcodeTiles
+/// Returns a tile message as a pushed message in the given encoding,
+/// copied as it is when already in that encoding
+RefBuffer* transcodeTiles(const char* payload, size_t len, bool binary)
+{
+	if ((payload[0] == BINARY_TILES) == binary)
+		return newPushMessage(payload, len);
+
+	Buffer framed = {0};
+	TileDecoder decoder;
+	TileEncoder encoder;
+	int x, y, n;
+	bool flagged, mine;
+	size_t header = beginFrame(&framed);
+	initTileDecoder(&decoder, payload, len);
+	initTileEncoder(&encoder, &framed, binary);
+	while (nextTile(&decoder, &x, &y, &n, &flagged, &mine))
+		encodeTile(&encoder, x, y, n, flagged, mine);
+	finishTiles(&encoder);
+	endFrame(&framed, header);
+
+	RefBuffer* message = newRefBuffer(&framed);
+	freeBuffer(&framed);
+	return message;
+}
+
+
+/// mirrorReply
+/// Pushes a reply of a watched game to its spectators, encoded once per
+/// tile encoding in use and shared by every spectator using it
+/// Tile messages and hints are dropped for spectators that fell behind,
+/// who get every visible tile once they catch up, see serveWatchers;
+/// the rest, and the tiles sent at game over, always get through
+void mirrorReply(Session* session, const char* payload, size_t len)
+{
+	if (atomic_load(&session->nWatchers) == 0 || !isWatchable(session) || strncmp(payload, "error", 5) == 0)
+		return;
+
+	bool isTiles = isTileMessage(payload, len);
+	bool final = isTiles && session->state == SESSION_GAMEOVER; // every tile of the board
+	bool force = final || (!isTiles && strncmp(payload, "hint", 4) != 0);
+	RefBuffer* encoded[2] = {NULL, NULL};
+	pthread_mutex_lock(&watchLock);
+	for (int w=0; w<atomic_load(&session->nWatchers); w++) {
+		Watcher* watcher = &session->watchers[w];
+		if (!watcher->started || (watcher->needsSnapshot && !force))
+			continue;
+
+		bool binary = isTiles && (watcher->session->features & FEATURE_BINARY);
+		if (encoded[binary] == NULL)
+			encoded[binary] = isTiles ? transcodeTiles(payload, len, binary) : newPushMessage(payload, len);
+		if (!pushMessage(watcher->session, encoded[binary], force))
+			watcher->needsSnapshot = true;
+		else if (final)
+			watcher->needsSnapshot = false;
+	}
+	pthread_mutex_unlock(&watchLock);
+
+	for (int e=0; e<2; e++) {
+		if (encoded[e] != NULL)
+			releaseRefBuffer(encoded[e]);
+	}
+}
+
+
+/// queueReply
+/// Appends one message to the session's outgoing queue, framed if agreed
+void queueReply(Session* session, const char* data, size_t len)
+{
+	pthread_mutex_lock(&session->txLock);
+	if (session->features & FEATURE_FRAME)
+		appendFrame(&session->txQueue, data, len);
+	else
+		appendBuffer(&session->txQueue, data, len);
+	pthread_mutex_unlock(&session->txLock);
+
+	mirrorReply(session, data, len);
+}
+
+
+/// queueMessage
+/// Appends an encoded message shared with other sessions to the session's
+/// own outgoing queue, without copying it; not mirrored to spectators
+void queueMessage(Session* session, RefBuffer* message)
+{
+	pthread_mutex_lock(&session->txLock);
+	appendSegment(session, message);
+	pthread_mutex_unlock(&session->txLock);
+}
+
+
+/// beginTiles
+/// Starts a tile reply directly in the outgoing queue, returns its offset
+/// The queue stays locked until endTiles
+size_t beginTiles(Session* session, TileEncoder* reply)
+{
+	pthread_mutex_lock(&session->txLock);
+	size_t at = session->txQueue.len;
+	if (session->features & FEATURE_FRAME)
+		beginFrame(&session->txQueue);
+	initTileEncoder(reply, &session->txQueue, session->features & FEATURE_BINARY);
+	return at;
+}
+
+
+/// endTiles
+/// Completes the tile reply started at offset at, or discards it if empty
+/// Unless send, only spectators are given the reply
+void endTiles(Session* session, size_t at, int nTiles, bool send)
+{
+	if (nTiles <= 0) {
+		session->txQueue.len = at;
+		pthread_mutex_unlock(&session->txLock);
+		return;
+	}
+
+	size_t payload = at;
+	if (session->features & FEATURE_FRAME) {
+		endFrame(&session->txQueue, at);
+		payload += FRAME_HEADER_SIZE;
+	}
+	mirrorReply(session, session->txQueue.data + payload, session->txQueue.len - payload);
+	if (!send)
+		session->txQueue.len = at;
+	pthread_mutex_unlock(&session->txLock);
+}
+
+
+/// encodeShared
+/// Encodes tiles of the shared board as a pushed message, text or binary
+RefBuffer* encodeShared(SharedBoard* board, const TileList* changed, bool binary)
+{
+	Buffer framed = {0};
+	TileEncoder encoder;
+	size_t header = beginFrame(&framed);
+	initTileEncoder(&encoder, &framed, binary);
+	encodeSharedTiles(board, changed, &encoder);
+	endFrame(&framed, header);
+
+	RefBuffer* message = newRefBuffer(&framed);
+	freeBuffer(&framed);
+	return message;
+}
+
+
+/// pushShared
+/// Pushes a message to a shared board player, who gets the board resent on
+/// its next move if the message had to be dropped
+void pushShared(Session* session, RefBuffer* message, bool force)
+{
+	if (!pushMessage(session, message, force)) {
+		pthread_mutex_lock(&session->txLock);
+		session->lagged = true;
+		pthread_mutex_unlock(&session->txLock);
+	}
+}
+
+
+/// publishShared
+/// SharedPublish fanning a move out to every player of the shared board,
+/// the mover included: the tiles it changed, or the end of the round
+/// followed by the next one
+/// Each message is encoded once per encoding in use, and queued to every
+/// player without copying
+void publishShared(SharedBoard* board, const TileList* changed, void* context)
+{
+	if (changed == NULL) {
+		char txBuffer[MAX_TX_SIZE];
+		sprintf(txBuffer, "over,1,%ld", (long int)difftime(time(0), board->roundStart));
+		RefBuffer* over = newPushMessage(txBuffer, strlen(txBuffer));
+		sprintf(txBuffer, "accept,shared,%d,%d,%d,%d,%d", board->config.width, board->config.height,
+		        board->config.nMines, board->startX, board->startY);
+		RefBuffer* accept = newPushMessage(txBuffer, strlen(txBuffer) + 1);
+
+		pthread_rwlock_rdlock(&sharedLock);
+		for (int p=0; p<nSharedPlayers; p++) {
+			pushShared(sharedPlayers[p], over, true);
+			pushShared(sharedPlayers[p], accept, true);
+		}
+		pthread_rwlock_unlock(&sharedLock);
+
+		releaseRefBuffer(over);
+		releaseRefBuffer(accept);
+		return;
+	}
+
+	RefBuffer* encoded[2] = {NULL, NULL};
+	pthread_rwlock_rdlock(&sharedLock);
+	for (int p=0; p<nSharedPlayers; p++) {
+		bool binary = sharedPlayers[p]->features & FEATURE_BINARY;
+		if (encoded[binary] == NULL)
+			encoded[binary] = encodeShared(board, changed, binary);
+		pushShared(sharedPlayers[p], encoded[binary], false);
+	}
+	pthread_rwlock_unlock(&sharedLock);
+
+	for (int e=0; e<2; e++) {
+		if (encoded[e] != NULL)
+			releaseRefBuffer(encoded[e]);
+	}
+}
+
+
+/// publishSnapshot
+/// SharedPublish sending the board as it stands to the one session in context
+void publishSnapshot(SharedBoard* board, const TileList* changed, void* context)
+{
+	Session* session = context;
+	RefBuffer* message = encodeShared(board, changed, session->features & FEATURE_BINARY);
+	pushShared(session, message, true);
+	releaseRefBuffer(message);
+}
+
+
+/// joinShared
+/// Adds the session to the shared board, creating the board if nobody is on it
+/// Returns false if the board is full
+bool joinShared(Session* session)
+{
+	pthread_rwlock_wrlock(&sharedLock);
+	if (nSharedPlayers == MAX_SHARED_PLAYERS) {
+		pthread_rwlock_unlock(&sharedLock);
+		return false;
+	}
+	if (sharedBoard == NULL) {
+		BoardConfig config = {CUSTOM, SHARED_WIDTH, SHARED_HEIGHT, SHARED_MINES, false};
+		sharedBoard = malloc(sizeof(SharedBoard));
+		if (!sharedBoard) {
+			perror("Out of memory in joinShared");
+			exit(1);
+		}
+		initSharedBoard(sharedBoard, &config);
+	}
+
+	// Accept before joining, so no push can overtake it
 	char txBuffer[MAX_TX_SIZE];
-	memset(rxBuffer, 0, sizeof(rxBuffer)/sizeof(char));
-	memset(txBuffer, 0, sizeof(txBuffer)/sizeof(char));
-	memset(user, 0, sizeof(user)/sizeof(char));
-	memset(pass, 0, sizeof(pass)/sizeof(char));
-	
-	// Ensure client is still connected
-	if (send(cID, "connect", 8, 0) == -1) {
-		perror("Failed to confirm connection");
-		closeSocket(cID);
+	sprintf(txBuffer, "accept,shared,%d,%d,%d,%d,%d", sharedBoard->config.width, sharedBoard->config.height,
+	        sharedBoard->config.nMines, sharedBoard->startX, sharedBoard->startY);
+	queueReply(session, txBuffer, strlen(txBuffer) + 1);
+
+	sharedPlayers[nSharedPlayers++] = session;
+	session->shared = sharedBoard;
+	session->sharedJoined = time(0);
+	printf("User %s joined the shared board, %d playing\n", session->user, nSharedPlayers);
+	fflush(stdout);
+	pthread_rwlock_unlock(&sharedLock);
+
+	// Everything revealed so far, moves made meanwhile are pushed as usual
+	sharedSnapshot(session->shared, publishSnapshot, session);
+	return true;
+}
+
+
+/// leaveShared
+/// Takes the session off the shared board, freeing the board with its last player
+void leaveShared(Session* session)
+{
+	if (session->shared == NULL)
 		return;
+
+	pthread_rwlock_wrlock(&sharedLock);
+	for (int p=0; p<nSharedPlayers; p++) {
+		if (sharedPlayers[p] == session) {
+			sharedPlayers[p] = sharedPlayers[--nSharedPlayers];
+			break;
+		}
 	}
-	
-	// Receive username,password
-	if (recv(cID, rxBuffer, MAX_RX_SIZE, 0) <= 0) {
-		perror("Failed to receive data");
-		closeSocket(cID);
+	session->shared = NULL;
+	if (nSharedPlayers == 0) {
+		freeSharedBoard(sharedBoard);
+		free(sharedBoard);
+		sharedBoard = NULL;
+	}
+	pthread_rwlock_unlock(&sharedLock);
+}
+
+
+/// formatAccept
+/// Formats the reply accepting a game on the session's board, telling the
+/// client the board size, and where to open first on no-guess boards
+/// Returns the reply length, terminator included
+int formatAccept(GameState* game, char* txBuffer)
+{
+	if (game->noGuess)
+		sprintf(txBuffer, "accept,%d,%d,%d,%d,%d", game->width, game->height, game->nMines,
+		        game->startX, game->startY);
+	else
+		sprintf(txBuffer, "accept,%d,%d,%d", game->width, game->height, game->nMines);
+	return strlen(txBuffer) + 1;
+}
+
+
+/// parseRaceOption
+/// Parses "race,<beginner|intermediate|expert>[,<seed>]"
+/// Returns false if malformed
+bool parseRaceOption(const char* buffer, Difficulty* difficulty, uint64_t* seed)
+{
+	const char* option = buffer + 5;
+	if (strncmp(option, "beginner", 8) == 0)
+		*difficulty = BEGINNER;
+	else if (strncmp(option, "intermediate", 12) == 0)
+		*difficulty = INTERMEDIATE;
+	else if (strncmp(option, "expert", 6) == 0)
+		*difficulty = EXPERT;
+	else
+		return false;
+
+	// Optional seed, to race on a known board
+	*seed = 0;
+	const char* comma = strchr(option, ',');
+	unsigned long long parsed;
+	if (comma != NULL) {
+		if (sscanf(comma, ",%llu", &parsed) != 1 || parsed == 0)
+			return false;
+		*seed = parsed;
+	}
+	return true;
+}
+
+
+/// freeSessionGame
+/// Frees the session's game, and the race board it was played on, if any
+void freeSessionGame(Session* session)
+{
+	freeGame(&session->game);
+	if (session->race != NULL) {
+		releaseRaceBoard(session->race);
+		session->race = NULL;
+	}
+}
+
+
+/// pushRaceAccept
+/// Pushes the accept line of a race on the session's board against opponent
+/// The caller holds raceLock
+void pushRaceAccept(Session* session, Session* opponent)
+{
+	char txBuffer[MAX_TX_SIZE];
+	GameState* board = &session->race->board;
+	sprintf(txBuffer, "accept,race,%d,%d,%d,%d,%d,%llu,%s", board->width, board->height, board->nMines,
+	        board->startX, board->startY, (unsigned long long)board->seed, opponent->user);
+	RefBuffer* message = newPushMessage(txBuffer, strlen(txBuffer) + 1);
+	pushMessage(session, message, true);
+	releaseRefBuffer(message);
+}
+
+
+/// joinRace
+/// Pairs the session with the oldest session waiting for the same preset
+/// and seed, or queues it until another one comes
+/// Both players are pushed their accept line as they are paired, before
+/// either can move, and set up their game on their own thread, see startRace
+/// Returns true if paired; false, with no race board, if none could be laid out
+bool joinRace(Session* session, Difficulty difficulty, uint64_t seed)
+{
+	freeSessionGame(session);
+	RaceBoard* race = NULL;
+	while (true) {
+		pthread_mutex_lock(&raceLock);
+		Session** link = &raceQueue;
+		while (*link != NULL && ((*link)->raceDifficulty != difficulty || (*link)->raceSeed != seed))
+			link = &(*link)->nextWaiting;
+
+		// Race on the waiting player's board
+		Session* waiting = *link;
+		if (waiting != NULL) {
+			*link = waiting->nextWaiting;
+			session->race = waiting->race;
+			retainRaceBoard(session->race);
+			session->opponent = waiting;
+			waiting->opponent = session;
+			session->raceReady = waiting->raceReady = true;
+			pushRaceAccept(waiting, session);
+			pushRaceAccept(session, waiting);
+			pthread_mutex_unlock(&raceLock);
+
+			if (race != NULL)
+				releaseRaceBoard(race); // laid out for nothing
+			return true;
+		}
+
+		// Wait at the back of the queue, with a board ready
+		if (race != NULL) {
+			session->race = race;
+			session->raceDifficulty = difficulty;
+			session->raceSeed = seed;
+			session->raceReady = false;
+			session->nextWaiting = NULL;
+			*link = session;
+			pthread_mutex_unlock(&raceLock);
+			return false;
+		}
+		pthread_mutex_unlock(&raceLock);
+
+		// No one waiting, lay a board out without holding the lock
+		race = acquireRaceBoard(difficulty, seed);
+		if (race == NULL)
+			return false;
+	}
+}
+
+
+/// leaveRaceQueue
+/// Takes the session out of the race queue
+/// Returns false if it was paired already
+bool leaveRaceQueue(Session* session)
+{
+	pthread_mutex_lock(&raceLock);
+	Session** link = &raceQueue;
+	while (*link != NULL && *link != session)
+		link = &(*link)->nextWaiting;
+	if (*link != NULL)
+		*link = session->nextWaiting;
+	bool left = !session->raceReady;
+	pthread_mutex_unlock(&raceLock);
+	return left;
+}
+
+
+/// endRace
+/// Tells the opponent, if still racing, that the session's game ended, and
+/// ends the race; the opponent plays its game on to the end
+/// The caller holds raceLock
+void endRace(Session* session, bool win)
+{
+	Session* opponent = session->opponent;
+	if (opponent == NULL)
+		return;
+
+	char txBuffer[MAX_TX_SIZE];
+	sprintf(txBuffer, "opponent,over,%d,%ld", win, (long int)difftime(time(0), session->game.startTime));
+	RefBuffer* message = newPushMessage(txBuffer, strlen(txBuffer) + 1);
+	pushMessage(opponent, message, true);
+	releaseRefBuffer(message);
+
+	opponent->opponent = NULL;
+	session->opponent = NULL;
+}
+
+
+/// leaveRace
+/// Leaves the race queue, or forfeits the race in progress
+void leaveRace(Session* session)
+{
+	if (session->race == NULL)
 		return;
+
+	leaveRaceQueue(session);
+	pthread_mutex_lock(&raceLock);
+	endRace(session, false);
+	pthread_mutex_unlock(&raceLock);
+}
+
+
+/// stopWatching
+/// Stops the session spectating, if it was
+/// The caller holds watchLock
+void stopWatching(Session* session)
+{
+	Session* target = session->watching;
+	if (target == NULL)
+		return;
+
+	int nWatchers = atomic_load(&target->nWatchers);
+	for (int w=0; w<nWatchers; w++) {
+		if (target->watchers[w].session == session) {
+			target->watchers[w] = target->watchers[nWatchers-1];
+			atomic_store(&target->nWatchers, nWatchers-1);
+			break;
+		}
 	}
-	
-	//Authenticate user
-	if(authUser(rxBuffer, user, pass) == 0) {
-		if (send(cID, "accept", 7, 0) == -1) {
-			perror("Failed to send data (accept user auth)");
-			closeSocket(cID);
+	session->watching = NULL;
+}
+
+
+/// closeSession
+/// Closes the session socket and hands the session to the event loop for reaping
+void closeSession(Session* session)
+{
+	if (session->state == SESSION_CLOSED)
+		return;
+	session->state = SESSION_CLOSED;
+	leaveShared(session); // stops pushes from other sessions
+	leaveRace(session);
+
+	// Leave the live sessions, letting spectators know
+	pthread_mutex_lock(&watchLock);
+	if (session->prevLive != NULL)
+		session->prevLive->nextLive = session->nextLive;
+	else if (liveSessions == session)
+		liveSessions = session->nextLive;
+	if (session->nextLive != NULL)
+		session->nextLive->prevLive = session->prevLive;
+	session->nextLive = session->prevLive = NULL;
+
+	stopWatching(session);
+	if (atomic_load(&session->nWatchers) > 0) {
+		RefBuffer* end = newPushMessage("watch,end", 10);
+		for (int w=0; w<atomic_load(&session->nWatchers); w++) {
+			pushMessage(session->watchers[w].session, end, true);
+			session->watchers[w].session->watching = NULL;
+		}
+		atomic_store(&session->nWatchers, 0);
+		releaseRefBuffer(end);
+	}
+	pthread_mutex_unlock(&watchLock);
+
+	// Closing removes the socket from epoll
+	closeSocket(session->cID);
+
+	pthread_mutex_lock(&closedLock);
+	session->nextClosed = closedSessions;
+	closedSessions = session;
+	pthread_mutex_unlock(&closedLock);
+}
+
+
+/// sendBytes
+/// Sends data[*sent, end) as far as the socket will take it
+/// Returns 1 once all sent, 0 if the socket is full, or -1 if the connection failed
+int sendBytes(Session* session, const char* data, size_t* sent, size_t end)
+{
+	while (*sent < end) {
+		ssize_t n = send(session->cID, data + *sent, end - *sent, MSG_NOSIGNAL);
+		if (n == -1) {
+			// Socket buffer full, wait for EVENT_WRITE
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			if (errno == EINTR)
+				continue;
+
+			perror("Failed to send data");
+			return -1;
+		}
+		*sent += n;
+	}
+	return 1;
+}
+
+
+/// flushSession
+/// Sends as much of the outgoing queue as the socket will take, the
+/// session's own bytes and pushed messages in the order they were queued
+/// Returns false if the connection failed
+bool flushSession(Session* session)
+{
+	Buffer* queue = &session->txQueue;
+	pthread_mutex_lock(&session->txLock);
+
+	int status = 1;
+	while (status == 1) {
+		// Own bytes up to the next pushed message, then the message
+		size_t end = (session->txHead != NULL) ? session->txHead->at : queue->len;
+		status = sendBytes(session, queue->data, &session->txSent, end);
+		if (status != 1 || session->txHead == NULL)
+			break;
+
+		TxSegment* segment = session->txHead;
+		status = sendBytes(session, segment->message->data, &session->segmentSent, segment->message->len);
+		if (status != 1)
+			break;
+		session->txHead = segment->next;
+		if (session->txHead == NULL)
+			session->txTail = NULL;
+		session->segmentBytes -= segment->message->len;
+		session->segmentSent = 0;
+		releaseRefBuffer(segment->message);
+		free(segment);
+	}
+
+	// Everything sent, rewind queue
+	if (status == 1) {
+		session->txSent = 0;
+		clearBuffer(queue);
+	}
+	pthread_mutex_unlock(&session->txLock);
+	return status != -1;
+}
+
+
+/// unsentBytes
+/// Returns the bytes queued for the session but not yet taken by the socket
+size_t unsentBytes(Session* session)
+{
+	pthread_mutex_lock(&session->txLock);
+	size_t unsent = session->txQueue.len - session->txSent + session->segmentBytes;
+	pthread_mutex_unlock(&session->txLock);
+	return unsent;
+}
+
+
+/// endLeaderboardStream
+/// Ends a streamed leaderboard reply with "lb,end,<rows>"
+void endLeaderboardStream(Session* session)
+{
+	char txBuffer[MAX_TX_SIZE];
+	int txLen = sprintf(txBuffer, "lb,end,%ld", session->lbSent) + 1;
+	queueReply(session, txBuffer, txLen);
+	releaseLeaderboard(session->lbStream);
+	session->lbStream = NULL;
+	session->lbSent = 0;
+}
+
+
+/// streamLeaderboard
+/// Queues the next LB_CHUNK_ROWS framed rows of a streamed leaderboard reply at a
+/// time, while less than LB_STREAM_BACKLOG bytes wait to be sent, so the
+/// whole board is never held in the outgoing queue at once; chunks are
+/// cached, shared by every session streaming the same generation
+/// Every chunk comes from the snapshot taken by the request, so games
+/// finishing meanwhile do not shift rows between chunks
+void streamLeaderboard(Session* session)
+{
+	while (session->lbStream != NULL && unsentBytes(session) < LB_STREAM_BACKLOG) {
+		long rows;
+		RefBuffer* chunk = leaderboardReply(session->lbStream, session->lbGeneration,
+		                                    session->lbSent, LB_CHUNK_ROWS, true, &rows);
+		if (chunk != NULL) {
+			queueMessage(session, chunk);
+			releaseRefBuffer(chunk);
+			session->lbSent += rows;
+		}
+		if (rows < LB_CHUNK_ROWS)
+			endLeaderboardStream(session);
+	}
+}
+
+
+/// endGame
+/// Records the finished game and queues the "over,<win>,<time>" message
+void endGame(Session* session, bool win)
+{
+	char txBuffer[MAX_TX_SIZE];
+
+	long int gameTime = (long int)difftime(session->game.endTime, session->game.startTime);
+	newRecord(session->user, win, gameTime);
+	sprintf(txBuffer, "over,%d,%ld", win, gameTime);
+	queueReply(session, txBuffer, strlen(txBuffer));
+}
+
+
+/// parseBatch
+/// Parses the moves of "b,<r|f|c>,<x>,<y>,<r|f|c>,<x>,<y>,..."
+/// Returns the number of moves, or 0 if any is malformed
+int parseBatch(const char* buffer, Move* moves)
+{
+	const char* at = buffer + 1;
+	int nMoves = 0;
+	while (*at == ',' && nMoves < MAX_BATCH_MOVES) {
+		char type;
+		int consumed;
+		if (sscanf(at, ",%c,%d,%d%n", &type, &moves[nMoves].x, &moves[nMoves].y, &consumed) != 3)
+			return 0;
+		if (type == 'r')
+			moves[nMoves].type = MOVE_REVEAL;
+		else if (type == 'f')
+			moves[nMoves].type = MOVE_FLAG;
+		else if (type == 'c')
+			moves[nMoves].type = MOVE_CHORD;
+		else
+			return 0;
+		nMoves++;
+		at += consumed;
+	}
+	return nMoves;
+}
+
+
+/// closeEndless
+/// Frees the session's endless game, if any
+void closeEndless(Session* session)
+{
+	if (session->endless != NULL) {
+		freeEndless(session->endless);
+		free(session->endless);
+		session->endless = NULL;
+	}
+}
+
+
+/// handleEndlessOption
+/// Applies one game option to the session's endless game
+/// Endless games end on a mine and are not recorded on the leaderboard
+void handleEndlessOption(Session* session, const char* rxBuffer)
+{
+	TileEncoder reply;
+	size_t at;
+	int nTiles = WARNING;
+	EndlessGame* game = session->endless;
+
+	int x = 0, y = 0;
+	GameOption option = parseGameOption(rxBuffer, &x, &y);
+	switch (option) {
+		case REVEAL:
+		case CHORD:
+		case FLAG:
+			at = beginTiles(session, &reply);
+			if (option == REVEAL)
+				nTiles = endlessReveal(game, x, y, &reply);
+			else if (option == CHORD)
+				nTiles = endlessChord(game, x, y, &reply);
+			else
+				nTiles = endlessFlag(game, x, y, &reply);
+			endTiles(session, at, nTiles, true);
+
+			// Mine hit! Mines near the explored area are sent once the client acknowledges
+			if (nTiles == 0) {
+				char txBuffer[MAX_TX_SIZE];
+				long int gameTime = (long int)difftime(game->endTime, game->startTime);
+				printf("User %s hit a mine at %d,%d after revealing %ld tiles\n", session->user, x, y, game->nRevealed);
+				fflush(stdout);
+
+				sprintf(txBuffer, "over,0,%ld", gameTime);
+				queueReply(session, txBuffer, strlen(txBuffer));
+				session->state = SESSION_GAMEOVER;
+			}
+			else if (nTiles == WARNING) {
+				queueReply(session, "error", 6);
+			}
+			break;
+
+		case QUIT:
+			closeEndless(session);
+			session->state = SESSION_MENU;
+			queueReply(session, "accept", 7);
+			break;
+
+		default:
+			queueReply(session, "error", 6); // no batches, hints or hacks here
+			break;
+	}
+}
+
+
+/// handleSharedOption
+/// Applies one game option to the shared board, whose changes reach every
+/// player, the mover included, as pushed tile messages
+/// A mine only ends the game of the player who hit it; clearing the board
+/// ends the round for everyone, and the next one starts at once
+void handleSharedOption(Session* session, const char* rxBuffer)
+{
+	SharedBoard* board = session->shared;
+
+	// Pushes were dropped while the client fell behind, resend the board
+	pthread_mutex_lock(&session->txLock);
+	bool lagged = session->lagged;
+	session->lagged = false;
+	pthread_mutex_unlock(&session->txLock);
+	if (lagged)
+		sharedSnapshot(board, publishSnapshot, session);
+
+	int x = 0, y = 0;
+	int result = WARNING;
+	GameOption option = parseGameOption(rxBuffer, &x, &y);
+	switch (option) {
+		case REVEAL:
+			result = sharedReveal(board, x, y, publishShared, NULL);
+			break;
+
+		case CHORD:
+			result = sharedChord(board, x, y, publishShared, NULL);
+			break;
+
+		case FLAG:
+			result = sharedFlag(board, x, y, publishShared, NULL);
+			break;
+
+		case QUIT:
+			leaveShared(session);
+			session->state = SESSION_MENU;
+			queueReply(session, "accept", 7);
 			return;
+
+		default:
+			break; // no batches, hints or hacks here
+	}
+
+	// The reveal that cleared the board starts the next round
+	if (atomic_exchange(&board->cleared, false))
+		newSharedRound(board, publishShared, NULL);
+
+	if (result == MINE_HIT) {
+		// Out of this round: the loss, then the mine
+		char txBuffer[MAX_TX_SIZE];
+		printf("User %s hit a mine on the shared board at %d,%d\n", session->user, x, y);
+		fflush(stdout);
+		sprintf(txBuffer, "over,0,%ld", (long int)difftime(time(0), session->sharedJoined));
+		queueReply(session, txBuffer, strlen(txBuffer));
+
+		TileEncoder reply;
+		size_t at = beginTiles(session, &reply);
+		encodeTile(&reply, x, y, 0, false, true);
+		endTiles(session, at, finishTiles(&reply), true);
+
+		leaveShared(session);
+		session->state = SESSION_MENU;
+	}
+	else if (result == WARNING) {
+		queueReply(session, "error", 6);
+	}
+}
+
+
+/// handleGameOption
+/// Applies one game option received in the SESSION_GAME state
+void handleGameOption(Session* session, const char* rxBuffer)
+{
+	if (session->endless != NULL) {
+		handleEndlessOption(session, rxBuffer);
+		return;
+	}
+	if (session->shared != NULL) {
+		handleSharedOption(session, rxBuffer);
+		return;
+	}
+
+	TileEncoder reply;
+	size_t at;
+	int nTiles;
+	GameState* game = &session->game;
+	bool framed = session->features & FEATURE_FRAME;
+
+	// Parse game option
+	int x, y;
+	GameOption option = parseGameOption(rxBuffer, &x, &y);
+	switch (option) {
+		case REVEAL:
+		case CHORD:
+			// A chord reveals every unflagged neighbour, failing like a reveal
+			// if a flag was misplaced
+			at = beginTiles(session, &reply);
+			if (option == CHORD)
+				nTiles = requestChord(game, x, y, &reply);
+			else
+				nTiles = requestReveal(game, x, y, &reply);
+
+			// Legacy clients read one message a move, so "over" alone tells them of a win
+			endTiles(session, at, nTiles, framed || !game->isWon);
+
+			// Game won, the last safe tile was revealed; its tiles go ahead of "over"
+			if (game->isWon) {
+				endGame(session, true);
+				session->state = SESSION_MENU;
+			}
+			// Mine hit! All tiles are sent once the client acknowledges
+			else if (nTiles == 0) {
+				printf("Mine hit at %d,%d\n", x, y);
+				fflush(stdout);
+
+				endGame(session, false);
+				session->state = SESSION_GAMEOVER;
+			}
+			else if (nTiles == WARNING) {
+				queueReply(session, "error", 6);
+			}
+			break;
+
+		case BATCH: {
+			// One combined reply, ahead of "over" if a move won
+			Move moves[MAX_BATCH_MOVES];
+			int nMoves = parseBatch(rxBuffer, moves);
+			at = beginTiles(session, &reply);
+			nTiles = (nMoves > 0) ? requestMoves(game, moves, nMoves, &reply) : WARNING;
+			endTiles(session, at, nTiles, framed || !game->isWon);
+
+			if (game->isWon) {
+				endGame(session, true);
+				session->state = SESSION_MENU;
+			}
+			else if (nTiles == 0) {
+				printf("Mine hit in batch\n");
+				fflush(stdout);
+
+				endGame(session, false);
+				session->state = SESSION_GAMEOVER;
+			}
+			else if (nTiles == WARNING) {
+				queueReply(session, "error", 6); // malformed, or nothing changed
+			}
+			break;
+		}
+
+		case FLAG:
+			at = beginTiles(session, &reply);
+			nTiles = requestFlag(game, x, y, &reply);
+			endTiles(session, at, nTiles, true);
+
+			// Game won!
+			if (nTiles == 0) {
+				endGame(session, true);
+				session->state = SESSION_MENU;
+			}
+			else if (nTiles == WARNING) {
+				queueReply(session, "error", 6); // tile revealed
+			}
+			break;
+
+		case HINT: {
+			// A tile the revealed tiles prove safe, or a mine, if any
+			bool isMine;
+			if (findHint(game, &x, &y, &isMine)) {
+				char txBuffer[MAX_TX_SIZE];
+				sprintf(txBuffer, "hint,%d,%d,%d", x, y, isMine);
+				queueReply(session, txBuffer, strlen(txBuffer) + 1);
+			}
+			else {
+				queueReply(session, "error", 6); // nothing follows without guessing
+			}
+			break;
+		}
+
+		case WINHACK:
+			forceWin(game);
+			endGame(session, true);
+			session->state = SESSION_MENU;
+			break;
+
+		case QUIT:
+		default:
+			// Set game over and accept game quit, in front of spectators
+			game->isOver = true;
+			queueReply(session, "accept", 7);
+			session->state = SESSION_MENU;
+			break;
+	}
+}
+
+
+/// startWatching
+/// Makes the session a spectator of the live session logged in as user
+/// The target sends the game so far from its own thread, see serveWatchers
+/// Returns false if no such session or it has too many spectators
+bool startWatching(Session* session, const char* user)
+{
+	bool started = false;
+	pthread_mutex_lock(&watchLock);
+	for (Session* target = liveSessions; target != NULL; target = target->nextLive) {
+		if (target == session || strcmp(target->user, user) != 0)
+			continue;
+		int nWatchers = atomic_load(&target->nWatchers);
+		if (nWatchers == MAX_WATCHERS)
+			break;
+
+		// Accepted before the target can push anything, and never mirrored
+		// as the session is in the menu, so taking txLock here is safe
+		queueReply(session, "accept,watch", 13);
+		target->watchers[nWatchers].session = session;
+		target->watchers[nWatchers].started = false;
+		target->watchers[nWatchers].needsSnapshot = false;
+		atomic_store(&target->nWatchers, nWatchers+1);
+		session->watching = target;
+		notifySession(target, EVENT_WATCH);
+		started = true;
+		break;
+	}
+	pthread_mutex_unlock(&watchLock);
+	return started;
+}
+
+
+/// encodeSnapshot
+/// Encodes every visible tile of the session's game as a pushed message,
+/// or returns NULL if none are
+RefBuffer* encodeSnapshot(Session* session, bool binary)
+{
+	Buffer framed = {0};
+	TileEncoder reply;
+	RefBuffer* message = NULL;
+	size_t header = beginFrame(&framed);
+	initTileEncoder(&reply, &framed, binary);
+	if (requestVisibleTiles(&session->game, &reply) > 0) {
+		endFrame(&framed, header);
+		message = newRefBuffer(&framed);
+	}
+	freeBuffer(&framed);
+	return message;
+}
+
+
+/// serveWatchers
+/// Sends new spectators the game so far, its accept line and every visible
+/// tile, and those that fell behind every visible tile again, once they
+/// have caught up
+/// Runs on the session's own thread, so its game cannot change meanwhile
+void serveWatchers(Session* session)
+{
+	if (atomic_load(&session->nWatchers) == 0)
+		return;
+
+	RefBuffer* accept = NULL;
+	RefBuffer* snapshot[2] = {NULL, NULL};
+	bool encoded[2] = {false, false};
+	bool watchable = isWatchable(session);
+	pthread_mutex_lock(&watchLock);
+	for (int w=0; w<atomic_load(&session->nWatchers); w++) {
+		Watcher* watcher = &session->watchers[w];
+		if (watcher->started && !watcher->needsSnapshot)
+			continue;
+		if (!watchable) {
+			// Nothing to show, the next game's accept line starts it afresh
+			watcher->started = true;
+			watcher->needsSnapshot = false;
+			continue;
+		}
+		if (watcher->started && session->state == SESSION_GAMEOVER)
+			continue; // every tile follows game over anyway
+
+		bool binary = watcher->session->features & FEATURE_BINARY;
+		if (!encoded[binary]) {
+			snapshot[binary] = encodeSnapshot(session, binary);
+			encoded[binary] = true;
 		}
-	} else {
-		closeSocket(cID);
+
+		// Still behind, try again on the session's next event
+		if (!watcher->started) {
+			if (accept == NULL) {
+				char txBuffer[MAX_TX_SIZE];
+				accept = newPushMessage(txBuffer, formatAccept(&session->game, txBuffer));
+			}
+			if (!pushMessage(watcher->session, accept, false))
+				continue;
+			if (snapshot[binary] != NULL)
+				pushMessage(watcher->session, snapshot[binary], true);
+			watcher->started = true;
+		}
+		else if (snapshot[binary] != NULL && !pushMessage(watcher->session, snapshot[binary], false)) {
+			continue;
+		}
+		watcher->needsSnapshot = false;
+	}
+	pthread_mutex_unlock(&watchLock);
+
+	if (accept != NULL)
+		releaseRefBuffer(accept);
+	for (int e=0; e<2; e++) {
+		if (snapshot[e] != NULL)
+			releaseRefBuffer(snapshot[e]);
+	}
+}
+
+
+/// startRace
+/// Sets up the game of a paired race on the session's own thread, once
+/// the accept line has been pushed, see joinRace
+void startRace(Session* session)
+{
+	pthread_mutex_lock(&raceLock);
+	bool ready = session->raceReady;
+	pthread_mutex_unlock(&raceLock);
+	if (!ready)
 		return;
+
+	initGameOnBoard(&session->game, &session->race->board);
+	session->racePercent = 0;
+	session->state = SESSION_GAME;
+	printf("User %s started a race, seed %llu, %d race boards in use\n", session->user,
+	       (unsigned long long)session->game.seed, countRaceBoards());
+	fflush(stdout);
+
+	// Spectators see a game like any other
+	char txBuffer[MAX_TX_SIZE];
+	mirrorReply(session, txBuffer, formatAccept(&session->game, txBuffer));
+}
+
+
+/// reportRace
+/// Pushes the opponent how far the session's race game has got, in whole
+/// percent of its safe tiles, when that changed, or its end
+void reportRace(Session* session)
+{
+	GameState* game = &session->game;
+	int nSafe = game->width * game->height - game->nMines;
+	int percent = 100 * (nSafe - game->hiddenSafe) / nSafe;
+	if (!game->isOver && percent == session->racePercent)
+		return;
+	session->racePercent = percent;
+
+	pthread_mutex_lock(&raceLock);
+	if (game->isOver) {
+		endRace(session, game->isWon);
 	}
-	
-	// Keep receiving until user disconnects
-	bool exit = false;
-	int txLen;
-	while (!exit) {
-		// Receive a menu option, "play", "lb" or "exit"
-		if (recv(cID, rxBuffer, MAX_RX_SIZE, 0) <= 0) {
-			perror("Failed to receive data");
+	else if (session->opponent != NULL) {
+		// Dropped if the opponent fell behind, the next one supersedes it
+		char txBuffer[MAX_TX_SIZE];
+		sprintf(txBuffer, "opponent,%d", percent);
+		RefBuffer* message = newPushMessage(txBuffer, strlen(txBuffer) + 1);
+		pushMessage(session->opponent, message, false);
+		releaseRefBuffer(message);
+	}
+	pthread_mutex_unlock(&raceLock);
+}
+
+
+/// handleMessage
+/// Advances the session state machine by one received message
+void handleMessage(Session* session, const char* rxBuffer)
+{
+	char txBuffer[MAX_TX_SIZE];
+
+	// A new request cuts a streamed leaderboard short
+	if (session->lbStream != NULL)
+		endLeaderboardStream(session);
+
+	switch (session->state) {
+		case SESSION_AUTH: {
+			// Authenticate user
+			char pass[MAX_NAME_LENGTH];
+			memset(pass, 0, sizeof(pass)/sizeof(char));
+			if (authUser(rxBuffer, session->user, pass) != 0) {
+				closeSession(session);
+				break;
+			}
+
+			// Reply in text, then switch to the agreed features
+			queueReply(session, "accept", 7);
+			session->features = parseFeatures(rxBuffer);
+			session->state = SESSION_MENU;
+
+			// Others may watch from now on
+			pthread_mutex_lock(&watchLock);
+			session->nextLive = liveSessions;
+			if (liveSessions != NULL)
+				liveSessions->prevLive = session;
+			liveSessions = session;
+			pthread_mutex_unlock(&watchLock);
 			break;
 		}
-	
-		// Parse menu option
-		switch (parseMenuOption(rxBuffer)) {
-			case PLAY:
-				// Accept game start
-				if (send(cID, "accept", 7, 0) == -1) {
-					perror("Failed to send data (accept game start)");
-					exit = true;
-					break;
-				}
-			
-				// Enter game loop
-				GameState game;
-				initGame(&game);
-				while (!game.isOver) {
-					// Receive game option
-					if (recv(cID, rxBuffer, MAX_RX_SIZE, 0) <= 0) {
-						perror("Failed to receive data");
-						exit = true;
+
+		case SESSION_MENU:
+			// Parse menu option
+			switch (parseMenuOption(rxBuffer)) {
+				case PLAY: {
+					// Shared board, pushing other players' moves needs framing
+					if (strncmp(rxBuffer, "play,shared", 11) == 0) {
+						if (!(session->features & FEATURE_FRAME) || !joinShared(session)) {
+							queueReply(session, "error", 6);
+							break;
+						}
+						session->state = SESSION_GAME;
 						break;
 					}
-					
-					// Parse game option
-					int x, y;
-					switch (parseGameOption(rxBuffer, &x, &y)) {
-						case REVEAL:
-							txBuffer[0] = '\0';
-							txLen = requestReveal(&game, x, y, txBuffer);
-
-							// Mine hit!
-							if (txLen == 0) {
-								// Notify
-								printf("Mine hit at %d,%d\n", x, y);
-								fflush(stdout);
-
-								// Store new record and set transmit message
-								long int gameTime = (long int)difftime(game.endTime, game.startTime);
-								newRecord(user, false, gameTime);
-								sprintf(txBuffer, "over,0,%ld", gameTime);
-								txLen = strlen(txBuffer);
-								
-								// Send message
-								if (send(cID, txBuffer, txLen, 0) == -1) {
-									perror("Failed to send data (game over)");
-									game.isOver = true;
-									exit = true;
-								}
-								
-								// Wait for OK
-								if (recv(cID, rxBuffer, MAX_RX_SIZE, 0) <= 0) {
-									perror("Failed to receive data");
-									game.isOver = true;
-									exit = true;
-									break;
-								}
-								
-								// Send all tiles
-								txBuffer[0] = '\0';
-								txLen = requestAllTiles(&game, txBuffer);
-							}
-							
-							// Send reply
-							if (send(cID, txBuffer, txLen, 0) == -1) {
-								perror("Failed to send data (reveal game tile)");
-								game.isOver = true;
-								exit = true;
-							}
-							break;
-						
-						case FLAG:
-							txBuffer[0] = '\0';
-							txLen = requestFlag(&game, x, y, txBuffer);
-							// Game won!
-							if (txLen == 0) {
-								// Store new record and set transmit message
-								long int gameTime = (long int)difftime(game.endTime, game.startTime);
-								newRecord(user, true, gameTime);
-								sprintf(txBuffer, "over,1,%ld", gameTime);
-								txLen = strlen(txBuffer);
-							}
-							
-							// Send reply
-							if (send(cID, txBuffer, txLen, 0) == -1) {
-								perror("Failed to send data (flag game tile)");
-								game.isOver = true;
-								exit = true;
-							}
-							break;
 
-						case WINHACK:
-							txBuffer[0] = '\0';
-							forceWin(&game);
-							// Store new record and set transmit message
-							long int gameTime = (long int)difftime(game.endTime, game.startTime);
-							newRecord(user, true, gameTime);
-							sprintf(txBuffer, "over,1,%ld", gameTime);
-							txLen = strlen(txBuffer);
-							
-							// Send reply
-							if (send(cID, txBuffer, txLen, 0) == -1) {
-								perror("Failed to send data (flag game tile)");
-								game.isOver = true;
-								exit = true;
-							}
-							break;
+					// Endless board, (0, 0) is always safe to open
+					if (strncmp(rxBuffer, "play,endless", 12) == 0) {
+						closeEndless(session);
+						session->endless = malloc(sizeof(EndlessGame));
+						if (!session->endless) {
+							perror("Out of memory starting an endless game");
+							exit(1);
+						}
+						initEndless(session->endless, newGameSeed());
+						printf("User %s started an endless game, seed %llu\n", session->user,
+						       (unsigned long long)session->endless->seed);
+						queueReply(session, "accept,endless", 15);
+						session->state = SESSION_GAME;
+						break;
+					}
 
-						case QUIT:
-						default:
-							// Set game over
-							game.isOver = true;
-							
-							// Accept game quit
-							if (send(cID, "accept", 7, 0) == -1) {
-								perror("Failed to send data (accept game quit)");
-								exit = true;
-							}
-							break;
+					// Board size and difficulty
+					BoardConfig config;
+					if (!parsePlayOption(rxBuffer, &config)) {
+						queueReply(session, "error", 6);
+						break;
 					}
+
+					// Accept game start, telling the client (and spectators) the board size
+					freeSessionGame(session);
+					if (!acquireGame(&session->game, &config)) {
+						queueReply(session, "error", 6); // never an unsolvable no-guess board
+						break;
+					}
+					printf("User %s started a %dx%d game with %d mines, seed %llu\n", session->user,
+					       config.width, config.height, config.nMines, (unsigned long long)session->game.seed);
+					session->state = SESSION_GAME;
+					queueReply(session, txBuffer, formatAccept(&session->game, txBuffer));
+					break;
 				}
-				break;
-				
-			case LB:
-				// Display leaderboard
-				txBuffer[0] = '\0';
-				txLen = requestLeaderboard(txBuffer);
-				if (txLen == 0) {
-					// No leaderboard data
-					if (send(cID, "error", 6, 0) == -1) {
-						perror("Failed to send data (leaderboard)");
-						exit = true;
+
+				case LB: {
+					// Framed: one page, or every row streamed in chunks
+					// Unframed: the top rows, in one message a legacy recv holds
+					bool stream;
+					long offset, limit;
+					bool framed = session->features & FEATURE_FRAME;
+					if (!parseLeaderboardOption(rxBuffer, &stream, &offset, &limit) || (!framed && !stream)) {
+						queueReply(session, "error", 6);
+						break;
+					}
+					if (!framed)
+						limit = LB_TEXT_ROWS;
+					else if (stream) {
+						session->lbStream = acquireLeaderboard(&session->lbGeneration);
+						session->lbSent = 0;
+						streamLeaderboard(session);
+						break;
+					}
+
+					// Cached until the next game is recorded
+					RefBuffer* page = requestLeaderboardReply(offset, limit, framed);
+					if (page == NULL) {
+						queueReply(session, "error", 6); // no rows there
+						break;
 					}
+					queueMessage(session, page);
+					releaseRefBuffer(page);
+					break;
 				}
-				else if (send(cID, txBuffer, txLen, 0) == -1) {
-						perror("Failed to send data (leaderboard)");
-						exit = true;
+
+				case RACE: {
+					// Opponent progress is pushed, which needs framing
+					Difficulty difficulty;
+					uint64_t seed;
+					if (!(session->features & FEATURE_FRAME) || !parseRaceOption(rxBuffer, &difficulty, &seed)) {
+						queueReply(session, "error", 6);
+						break;
+					}
+					session->state = SESSION_RACEWAIT;
+					if (joinRace(session, difficulty, seed))
+						startRace(session);
+					else if (session->race == NULL) {
+						session->state = SESSION_MENU;
+						queueReply(session, "error", 6); // no solvable board with this seed
+					}
+					else
+						queueReply(session, "wait", 5);
+					break;
 				}
+
+				case WATCH:
+					// Spectating is pushed, which needs framing
+					if (!(session->features & FEATURE_FRAME) || !startWatching(session, rxBuffer + 6)) {
+						queueReply(session, "error", 6);
+						break;
+					}
+					session->state = SESSION_WATCH;
+					break;
+
+				case EXIT:
+				default:
+					closeSession(session);
+					break;
+			}
+			break;
+
+		case SESSION_WATCH:
+			// Only quitting is allowed while spectating
+			if (strncmp(rxBuffer, "quit", 4) != 0) {
+				queueReply(session, "error", 6);
 				break;
-				
-			case EXIT:
-			default:
-				exit = true;
+			}
+			pthread_mutex_lock(&watchLock);
+			stopWatching(session);
+			pthread_mutex_unlock(&watchLock);
+			session->state = SESSION_MENU;
+			queueReply(session, "accept", 7);
+			break;
+
+		case SESSION_GAME:
+			handleGameOption(session, rxBuffer);
+			if (session->race != NULL)
+				reportRace(session);
+			break;
+
+		case SESSION_RACEWAIT:
+			// Quit the queue, unless paired meanwhile
+			if (strncmp(rxBuffer, "quit", 4) == 0 && leaveRaceQueue(session)) {
+				freeSessionGame(session);
+				session->state = SESSION_MENU;
+				queueReply(session, "accept", 7);
 				break;
+			}
+
+			// Paired, the message is the first of the game
+			startRace(session);
+			if (session->state == SESSION_GAME) {
+				handleGameOption(session, rxBuffer);
+				reportRace(session);
+			}
+			else {
+				queueReply(session, "error", 6);
+			}
+			break;
+
+		case SESSION_GAMEOVER: {
+			// Client acknowledged game over, send all tiles
+			TileEncoder reply;
+			size_t at = beginTiles(session, &reply);
+			if (session->endless != NULL) {
+				endTiles(session, at, endlessMines(session->endless, &reply), true);
+				closeEndless(session);
+			}
+			else {
+				endTiles(session, at, requestAllTiles(&session->game, &reply), true);
+			}
+			session->state = SESSION_MENU;
+			break;
 		}
+
+		case SESSION_CONNECT:
+		case SESSION_CLOSED:
+			break;
+	}
+}
+
+
+/// readSession
+/// Receives until the socket would block, handling every complete message
+/// Unframed sessions treat each recv as one message
+/// Stops, leaving the rest unread, while more than MAX_TX_BACKLOG bytes wait
+/// to be sent; runSession calls it again once they drain
+/// Returns false if the connection closed or failed
+bool readSession(Session* session)
+{
+	FrameReader* rx = &session->rx;
+	session->readPaused = false;
+
+	while (session->state != SESSION_CLOSED) {
+		// Handle messages in place, the session may switch to framing midway
+		char* message;
+		size_t len;
+		int status;
+		while (session->state != SESSION_CLOSED) {
+			if (unsentBytes(session) > MAX_TX_BACKLOG) {
+				session->readPaused = true; // a client not reading its replies
+				return true;
+			}
+
+			if (session->features & FEATURE_FRAME)
+				status = nextFrame(rx, &message, &len);
+			else
+				status = nextText(rx, &message, &len);
+
+			if (status == FRAME_ERROR) {
+				printf("%s", "Oversized frame received!\n");
+				fflush(stdout);
+				return false;
+			}
+			if (status == FRAME_PARTIAL)
+				break;
+
+			handleMessage(session, message);
+		}
+		if (session->state == SESSION_CLOSED)
+			break;
+
+		bool framed = session->features & FEATURE_FRAME;
+		size_t space;
+		char* buffer = frameReaderSpace(rx, &space);
+		if (!framed && space > MAX_RX_SIZE)
+			space = MAX_RX_SIZE;
+
+		ssize_t received = recv(session->cID, buffer, space, 0);
+		if (received == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return true;
+			if (errno == EINTR)
+				continue;
+
+			perror("Failed to receive data");
+			return false;
+		}
+		if (received == 0)
+			return false; // user disconnected
+		frameReaderCommit(rx, received);
+	}
+
+	return true;
+}
+
+
+/// releaseSession
+/// Drops one reference, freeing the session when none remain
+void releaseSession(Session* session)
+{
+	if (atomic_fetch_sub(&session->refs, 1) == 1) {
+		freeSessionGame(session);
+		closeEndless(session);
+		if (session->lbStream != NULL)
+			releaseLeaderboard(session->lbStream);
+		freeFrameReader(&session->rx);
+		freeBuffer(&session->txQueue);
+		while (session->txHead != NULL) {
+			TxSegment* segment = session->txHead;
+			session->txHead = segment->next;
+			releaseRefBuffer(segment->message);
+			free(segment);
+		}
+		pthread_mutex_destroy(&session->txLock);
+		free(session);
+	}
+}
+
+
+/// runSession
+/// Threadpool callback: handles all pending events of a session
+void runSession(void* data)
+{
+	Session* session = data;
+	int events = atomic_exchange(&session->events, EVENT_QUEUED) & ~EVENT_QUEUED;
+
+	while (true) {
+		// Greet newly accepted connections
+		if (session->state == SESSION_CONNECT) {
+			const char* connect = "connect," FRAME_FEATURE "," BINARY_FEATURE;
+			queueReply(session, connect, strlen(connect) + 1);
+			session->state = SESSION_AUTH;
+		}
+
+		if (session->state != SESSION_CLOSED && (events & EVENT_READ)) {
+			if (!readSession(session))
+				closeSession(session);
+		}
+
+		// Start a race once paired
+		if (session->state == SESSION_RACEWAIT)
+			startRace(session);
+
+		// Catch spectators up once the received messages are handled
+		if (session->state != SESSION_CLOSED)
+			serveWatchers(session);
+
+		// Send, queueing more of a streamed leaderboard as the socket takes it
+		if (session->state != SESSION_CLOSED) {
+			bool flushed;
+			do {
+				streamLeaderboard(session);
+				flushed = flushSession(session);
+			} while (flushed && session->lbStream != NULL && unsentBytes(session) == 0);
+			if (!flushed)
+				closeSession(session);
+
+			// Edge triggered, so go back for the requests left unread
+			else if (session->readPaused && unsentBytes(session) <= MAX_TX_BACKLOG)
+				atomic_fetch_or(&session->events, EVENT_READ);
+		}
+
+		// Go idle unless more events arrived while we were busy
+		int expected = EVENT_QUEUED;
+		if (atomic_compare_exchange_strong(&session->events, &expected, 0))
+			break;
+		events = atomic_exchange(&session->events, EVENT_QUEUED) & ~EVENT_QUEUED;
+	}
+
+	releaseSession(session);
+}
+
+
+/* Public functions */
+/// openSession
+/// Allocates a session for a newly accepted, non-blocking connection
+Session* openSession(int cID)
+{
+	Session* session = calloc(1, sizeof(Session));
+	if (!session) {
+		perror("Out of memory in openSession");
+		exit(1);
+	}
+
+	session->cID = cID;
+	session->state = SESSION_CONNECT;
+	atomic_init(&session->events, 0);
+	atomic_init(&session->refs, 1); // held by the event loop until reaped
+	pthread_mutex_init(&session->txLock, NULL);
+	initFrameReader(&session->rx, MAX_RX_SIZE, MAX_FRAME_SIZE);
+
+	return session;
+}
+
+
+/// notifySession
+/// Records socket events and queues the session on the threadpool if idle
+void notifySession(Session* session, int events)
+{
+	int old = atomic_fetch_or(&session->events, events | EVENT_QUEUED);
+	if (old & EVENT_QUEUED)
+		return; // running session will pick the events up
+
+	atomic_fetch_add(&session->refs, 1);
+	newRequest(runSession, session);
+}
+
+
+/// reapSessions
+/// Drops the event loop reference of every session closed since the last call
+/// Must only be called from the event loop thread, between epoll_wait batches
+void reapSessions()
+{
+	pthread_mutex_lock(&closedLock);
+	Session* session = closedSessions;
+	closedSessions = NULL;
+	pthread_mutex_unlock(&closedLock);
+
+	while (session != NULL) {
+		Session* next = session->nextClosed;
+		releaseSession(session);
+		session = next;
 	}
-	
-	// User has exitied, or something went wrong
-	closeSocket(cID);
 }
 
 
@@ -367,11 +1873,10 @@ int openSocket(int port)
 /// Safely shuts down and closes socket defined by sID
 void closeSocket(int sID)
 {
-	// Shutdown socket
+	// Shutdown socket, still closing it if the peer already went away
 	int sErr = shutdown(sID, SHUT_RDWR);
-	if (sErr == -1) {
+	if (sErr == -1 && errno != ENOTCONN) {
 		perror("Failed to shutdown socket");
-		return;
 	}
 
 	// Close socket
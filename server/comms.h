@@ -10,23 +10,148 @@
 #ifndef __server_comms__h__
 #define __server_comms__h__
 
+/* Includes */
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "minesweeper.h"
+#include "endless.h"
+#include "shared.h"
+#include "race.h"
+#include "buffer.h"
+#include "frame.h"
+#include "tilecodec.h"
+
 
 /* Defines */
 #define MAX_RX_SIZE 50
 #define MAX_TX_SIZE 1000
 #define MAX_NAME_LENGTH 20
-#define BACKLOG 10
+#define MAX_FRAME_SIZE 4096 // largest framed message accepted from a client
+#define MAX_BATCH_MOVES 512 // moves in one "b,..." message, past that they are ignored
+#define MAX_SHARED_PLAYERS 1024 // sessions on the shared board at once
+#define MAX_PUSH_BACKLOG (1 << 20) // unsent bytes past which pushed messages are dropped
+#define MAX_TX_BACKLOG (256*1024) // unsent bytes past which a session's requests are left unread
+#define MAX_WATCHERS 16 // spectators of one session at once
+#define MAX_LB_PAGE 100 // rows in one "lb,<offset>,<limit>" reply
+#define LB_CHUNK_ROWS 50 // rows in each message of a streamed "lb" reply
+#define LB_STREAM_BACKLOG (64*1024) // unsent bytes under which the next chunk is queued
+#define LB_TEXT_ROWS 14 // rows in an unframed "lb" reply, at most 67 bytes each so one legacy read holds them
+#define BACKLOG 128
+
+#define FEATURE_FRAME  0x1 // length-prefixed framing, see common/frame.h
+#define FEATURE_BINARY 0x2 // binary tile messages, see common/tilecodec.h
+
+#define EVENT_READ   0x1 // socket readable (or peer hung up)
+#define EVENT_WRITE  0x2 // socket writable again after a short send
+#define EVENT_WATCH  0x4 // a spectator is waiting for a snapshot of the session's game
+#define EVENT_QUEUED 0x8 // session has a pending or running threadpool request
 
 
 /* Types */
-typedef enum {EXIT, PLAY, LB} MenuOption;
-typedef enum {QUIT, REVEAL, FLAG, WINHACK} GameOption;
+typedef enum {EXIT, PLAY, LB, WATCH, RACE} MenuOption;
+typedef enum {QUIT, REVEAL, FLAG, WINHACK, HINT, CHORD, BATCH} GameOption;
+
+/// SessionState
+/// Position of a connection in the protocol: connect -> auth -> menu -> game
+typedef enum
+{
+	SESSION_CONNECT,  // accepted, "connect" not yet sent
+	SESSION_AUTH,     // waiting for "user,pass"
+	SESSION_MENU,     // waiting for "play", "race", "lb", "watch" or "exit"
+	SESSION_GAME,     // waiting for a game option
+	SESSION_GAMEOVER, // mine hit, waiting for "ok" before sending all tiles
+	SESSION_RACEWAIT, // in the race queue, waiting for an opponent or "quit"
+	SESSION_WATCH,    // spectating another session, waiting for "quit"
+	SESSION_CLOSED
+} SessionState;
+
+
+/// TxSegment structure
+/// A message shared with other sessions, queued without being copied
+/// It is sent once the session's own bytes have been sent up to at
+typedef struct TxSegment
+{
+	RefBuffer* message;
+	size_t at;
+	struct TxSegment* next;
+} TxSegment;
+
+
+/// Watcher structure
+/// A spectator of a session's games
+typedef struct
+{
+	struct Session* session;
+	bool started;       // sent the game so far, mirrored messages follow on from it
+	bool needsSnapshot; // tile messages were dropped, resend every visible tile
+} Watcher;
+
+
+/// Session structure
+/// Per-connection state driven by the event loop
+/// Only one threadpool request runs a session at a time (see EVENT_QUEUED);
+/// other sessions push messages to it too (shared board moves, watched
+/// games), so its outgoing queue is only touched under txLock
+typedef struct Session
+{
+	int cID;
+	SessionState state;
+	atomic_int events; // pending EVENT_* bits
+	atomic_int refs;   // event loop + queued request references
+	int features; // FEATURE_* bits agreed at authentication
+	char user[MAX_NAME_LENGTH];
+	GameState game;
+	EndlessGame* endless; // endless game in progress or just lost, else NULL
+	SharedBoard* shared;  // the shared board while playing on it, else NULL
+	time_t sharedJoined;
+	RaceBoard* race;           // board of the race game in game, held until the game is freed
+	struct Session* opponent;  // under the race lock, see comms.c, until either game ends
+	struct Session* nextWaiting; // race queue, under the race lock
+	bool raceReady;            // paired, under the race lock
+	Difficulty raceDifficulty; // preset and seed asked for, 0 for any
+	uint64_t raceSeed;
+	int racePercent;           // share of the safe tiles revealed, as last pushed to the opponent
+	struct LeaderboardSnapshot* lbStream; // leaderboard held while streaming it all, else NULL
+	long lbGeneration;         // its generation, see leaderboard.h
+	long lbSent;               // rows of it queued so far
+
+	FrameReader rx;  // received bytes, split into messages
+	pthread_mutex_t txLock;
+	Buffer txQueue;  // outgoing bytes not yet accepted by the socket
+	size_t txSent;
+	TxSegment* txHead; // pushed messages, in order with txQueue
+	TxSegment* txTail;
+	size_t segmentSent;
+	size_t segmentBytes; // pushed bytes not yet sent
+	bool lagged;     // shared board pushes were dropped, resent on the next move
+	bool readPaused; // requests left unread until the replies drain, see readSession
+
+	Watcher watchers[MAX_WATCHERS]; // under the watch lock, see comms.c
+	atomic_int nWatchers;
+	struct Session* watching;       // session this one spectates, NULL once it closes
+
+	struct Session* nextLive;       // every logged in session, for "watch,<user>"
+	struct Session* prevLive;
+	struct Session* nextClosed;
+} Session;
 
 
 /* Public function prototypes */
-/// handleConnection
-/// Threaded function to handle the connection of a new user
-void handleConnection(int cID);
+/// openSession
+/// Allocates a session for a newly accepted, non-blocking connection
+Session* openSession(int cID);
+
+
+/// notifySession
+/// Records socket events and queues the session on the threadpool if idle
+void notifySession(Session* session, int events);
+
+
+/// reapSessions
+/// Drops the event loop reference of every session closed since the last call
+/// Must only be called from the event loop thread, between epoll_wait batches
+void reapSessions();
 
 
 /// openSocket
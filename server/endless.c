@@ -0,0 +1,594 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * server/endless.c
+ * Server-side endless minesweeper board
+ * Chunks are generated on first use and evicted least recently used first;
+ * an evicted chunk keeps only what the player revealed and flagged there,
+ * as its mines come back from the seed
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    4/11/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Includes */
+#include "endless.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "rng.h"
+
+
+/* Defines */
+#define CHUNK_MASK (CHUNK_SIZE - 1)
+#define ENDLESS_MIN_BUCKETS 64
+
+
+/* Private functions */
+/// hashChunk
+/// Mixes chunk coordinates into a bucket hash
+uint32_t hashChunk(int cx, int cy)
+{
+	uint64_t key = ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cy;
+	return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+
+/// findChunk
+/// Returns the known chunk at (cx, cy), or NULL
+Chunk* findChunk(EndlessGame* game, int cx, int cy)
+{
+	Chunk* chunk = game->buckets[hashChunk(cx, cy) & (game->nBuckets - 1)];
+	while (chunk != NULL && (chunk->cx != cx || chunk->cy != cy))
+		chunk = chunk->nextInBucket;
+	return chunk;
+}
+
+
+/// growBuckets
+/// Doubles the hash map, keeping chains short
+void growBuckets(EndlessGame* game)
+{
+	int nBuckets = game->nBuckets * 2;
+	Chunk** buckets = calloc(nBuckets, sizeof(Chunk*));
+	if (!buckets) {
+		perror("Out of memory in growBuckets");
+		exit(1);
+	}
+
+	for (int b=0; b<game->nBuckets; b++) {
+		Chunk* chunk = game->buckets[b];
+		while (chunk != NULL) {
+			Chunk* next = chunk->nextInBucket;
+			uint32_t at = hashChunk(chunk->cx, chunk->cy) & (nBuckets - 1);
+			chunk->nextInBucket = buckets[at];
+			buckets[at] = chunk;
+			chunk = next;
+		}
+	}
+	free(game->buckets);
+	game->buckets = buckets;
+	game->nBuckets = nBuckets;
+}
+
+
+/// addChunk
+/// Adds a known, not yet generated chunk at (cx, cy)
+Chunk* addChunk(EndlessGame* game, int cx, int cy)
+{
+	Chunk* chunk = calloc(1, sizeof(Chunk));
+	if (!chunk) {
+		perror("Out of memory in addChunk");
+		exit(1);
+	}
+	chunk->cx = cx;
+	chunk->cy = cy;
+
+	uint32_t at = hashChunk(cx, cy) & (game->nBuckets - 1);
+	chunk->nextInBucket = game->buckets[at];
+	game->buckets[at] = chunk;
+	if (++game->nKnown > 2 * game->nBuckets)
+		growBuckets(game);
+	return chunk;
+}
+
+
+/// removeChunk
+/// Forgets an evicted chunk the player never touched
+void removeChunk(EndlessGame* game, Chunk* chunk)
+{
+	Chunk** link = &game->buckets[hashChunk(chunk->cx, chunk->cy) & (game->nBuckets - 1)];
+	while (*link != chunk)
+		link = &(*link)->nextInBucket;
+	*link = chunk->nextInBucket;
+
+	if (game->last == chunk)
+		game->last = NULL;
+	game->nKnown--;
+	free(chunk);
+}
+
+
+/// linkNewest
+/// Puts a generated chunk at the recent end of the recency list
+void linkNewest(EndlessGame* game, Chunk* chunk)
+{
+	chunk->older = game->newest;
+	chunk->newer = NULL;
+	if (game->newest != NULL)
+		game->newest->newer = chunk;
+	else
+		game->oldest = chunk;
+	game->newest = chunk;
+}
+
+
+/// unlinkRecency
+/// Takes a generated chunk off the recency list
+void unlinkRecency(EndlessGame* game, Chunk* chunk)
+{
+	if (chunk->newer != NULL)
+		chunk->newer->older = chunk->older;
+	else
+		game->newest = chunk->older;
+	if (chunk->older != NULL)
+		chunk->older->newer = chunk->newer;
+	else
+		game->oldest = chunk->newer;
+	chunk->newer = chunk->older = NULL;
+}
+
+
+/// generateChunk
+/// Places the mines of a chunk from (seed, cx, cy), then restores its overlay
+/// Floyd's sampling picks exactly CHUNK_MINES distinct tiles
+void generateChunk(EndlessGame* game, Chunk* chunk)
+{
+	ChunkData* data = calloc(1, sizeof(ChunkData));
+	if (!data) {
+		perror("Out of memory in generateChunk");
+		exit(1);
+	}
+
+	Rng rng;
+	seedRng(&rng, game->seed ^ (((uint64_t)(uint32_t)chunk->cx << 32 | (uint32_t)chunk->cy) * 0xD1B54A32D192ED03ULL));
+	for (int j = CHUNK_SIZE*CHUNK_SIZE - CHUNK_MINES; j < CHUNK_SIZE*CHUNK_SIZE; j++) {
+		int t = boundedRng(&rng, j + 1);
+		if (data->mines[t >> CHUNK_SHIFT] >> (t & CHUNK_MASK) & 1)
+			t = j;
+		data->mines[t >> CHUNK_SHIFT] |= (uint64_t)1 << (t & CHUNK_MASK);
+	}
+
+	// Keep (0, 0) and its neighbours clear, for a safe first reveal
+	for (int y=-1; y<=1; y++) {
+		for (int x=-1; x<=1; x++) {
+			if ((x >> CHUNK_SHIFT) == chunk->cx && (y >> CHUNK_SHIFT) == chunk->cy)
+				data->mines[y & CHUNK_MASK] &= ~((uint64_t)1 << (x & CHUNK_MASK));
+		}
+	}
+
+	// Restore what the player did here before the chunk was evicted
+	if (chunk->revealedRows != NULL)
+		memcpy(data->revealed, chunk->revealedRows, sizeof(data->revealed));
+	for (int k=0; k<chunk->nFlags; k++)
+		data->flagged[chunk->flags[k] >> CHUNK_SHIFT] |= (uint64_t)1 << (chunk->flags[k] & CHUNK_MASK);
+	free(chunk->revealedRows);
+	free(chunk->flags);
+	chunk->revealedRows = NULL;
+	chunk->flags = NULL;
+	chunk->nFlags = 0;
+
+	chunk->data = data;
+	linkNewest(game, chunk);
+	game->nGenerated++;
+	game->generations++;
+}
+
+
+/// evictChunk
+/// Drops the tiles of the least recently used chunk, keeping a compact
+/// overlay if the player revealed or flagged anything there
+void evictChunk(EndlessGame* game, Chunk* chunk)
+{
+	ChunkData* data = chunk->data;
+	bool anyRevealed = false;
+	int nFlags = 0;
+	for (int y=0; y<CHUNK_SIZE; y++) {
+		anyRevealed |= (data->revealed[y] != 0);
+		nFlags += __builtin_popcountll(data->flagged[y]);
+	}
+
+	if (anyRevealed) {
+		chunk->revealedRows = malloc(sizeof(data->revealed));
+		if (!chunk->revealedRows) {
+			perror("Out of memory in evictChunk");
+			exit(1);
+		}
+		memcpy(chunk->revealedRows, data->revealed, sizeof(data->revealed));
+	}
+	if (nFlags > 0) {
+		chunk->flags = malloc(nFlags * sizeof(uint16_t));
+		if (!chunk->flags) {
+			perror("Out of memory in evictChunk");
+			exit(1);
+		}
+		for (int y=0; y<CHUNK_SIZE; y++) {
+			for (uint64_t bits = data->flagged[y]; bits != 0; bits &= bits - 1)
+				chunk->flags[chunk->nFlags++] = (uint16_t)(y << CHUNK_SHIFT | __builtin_ctzll(bits));
+		}
+	}
+
+	unlinkRecency(game, chunk);
+	free(data);
+	chunk->data = NULL;
+	game->nGenerated--;
+	game->evictions++;
+
+	if (!anyRevealed && nFlags == 0)
+		removeChunk(game, chunk);
+}
+
+
+/// trimChunks
+/// Evicts the coldest chunks down to ENDLESS_MAX_CHUNKS
+/// Only called between moves, so no move holds a chunk being evicted
+void trimChunks(EndlessGame* game)
+{
+	while (game->nGenerated > ENDLESS_MAX_CHUNKS)
+		evictChunk(game, game->oldest);
+}
+
+
+/// tileChunk
+/// Returns the generated tiles of the chunk holding tile (x, y)
+ChunkData* tileChunk(EndlessGame* game, int x, int y)
+{
+	int cx = x >> CHUNK_SHIFT, cy = y >> CHUNK_SHIFT;
+	Chunk* chunk = game->last;
+	if (chunk == NULL || chunk->cx != cx || chunk->cy != cy) {
+		chunk = findChunk(game, cx, cy);
+		if (chunk == NULL)
+			chunk = addChunk(game, cx, cy);
+		else if (chunk->data != NULL && chunk != game->newest) {
+			unlinkRecency(game, chunk);
+			linkNewest(game, chunk);
+		}
+		game->last = chunk;
+	}
+	if (chunk->data == NULL)
+		generateChunk(game, chunk);
+	return chunk->data;
+}
+
+
+/// onBoard
+/// Returns whether (x, y) lies within ENDLESS_LIMIT
+bool onBoard(int x, int y)
+{
+	return x > -ENDLESS_LIMIT && x < ENDLESS_LIMIT && y > -ENDLESS_LIMIT && y < ENDLESS_LIMIT;
+}
+
+
+/// tileBitOf
+/// Returns the bit of tile (x, y) in its chunk row
+uint64_t tileBitOf(int x)
+{
+	return (uint64_t)1 << (x & CHUNK_MASK);
+}
+
+
+/// isMine, isRevealed, isFlagged
+/// Tile accessors, generating the chunk if needed
+bool isMine(EndlessGame* game, int x, int y)
+{
+	return (tileChunk(game, x, y)->mines[y & CHUNK_MASK] & tileBitOf(x)) != 0;
+}
+
+bool isRevealed(EndlessGame* game, int x, int y)
+{
+	return (tileChunk(game, x, y)->revealed[y & CHUNK_MASK] & tileBitOf(x)) != 0;
+}
+
+bool isFlagged(EndlessGame* game, int x, int y)
+{
+	return (tileChunk(game, x, y)->flagged[y & CHUNK_MASK] & tileBitOf(x)) != 0;
+}
+
+
+/// adjacentMines
+/// Returns the number of mines around (x, y), across chunk boundaries
+int adjacentMines(EndlessGame* game, int x, int y)
+{
+	int count = 0;
+	for (int j=y-1; j<=y+1; j++) {
+		for (int i=x-1; i<=x+1; i++) {
+			if ((i != x || j != y) && onBoard(i, j))
+				count += isMine(game, i, j);
+		}
+	}
+	return count;
+}
+
+
+/// adjacentFlags
+/// Returns the number of flagged tiles around (x, y)
+int adjacentFlags(EndlessGame* game, int x, int y)
+{
+	int count = 0;
+	for (int j=y-1; j<=y+1; j++) {
+		for (int i=x-1; i<=x+1; i++) {
+			if ((i != x || j != y) && onBoard(i, j))
+				count += isFlagged(game, i, j);
+		}
+	}
+	return count;
+}
+
+
+/// appendChanged
+/// Records a tile changed by the current move
+void appendChanged(EndlessGame* game, int x, int y)
+{
+	if (game->nChanged == game->changedCapacity) {
+		game->changedCapacity *= 2;
+		game->changed = realloc(game->changed, game->changedCapacity * sizeof(EndlessTile));
+		if (!game->changed) {
+			perror("Out of memory in appendChanged");
+			exit(1);
+		}
+	}
+	game->changed[game->nChanged++] = (EndlessTile){x, y};
+}
+
+
+/// revealEndlessTile
+/// Reveals a single unrevealed safe tile, clearing any misplaced flag
+void revealEndlessTile(EndlessGame* game, int x, int y)
+{
+	ChunkData* data = tileChunk(game, x, y);
+	data->revealed[y & CHUNK_MASK] |= tileBitOf(x);
+	data->flagged[y & CHUNK_MASK] &= ~tileBitOf(x);
+	game->nRevealed++;
+	appendChanged(game, x, y);
+}
+
+
+/// revealFlood
+/// Reveals (x, y) onto game->changed, flood filling breadth-first through
+/// zeros from chunk to chunk, up to ENDLESS_MAX_FLOOD tiles per move
+/// Returns 0, MINE_HIT, or WARNING if already revealed
+int revealFlood(EndlessGame* game, int x, int y)
+{
+	if (isMine(game, x, y))
+		return MINE_HIT;
+	if (isRevealed(game, x, y))
+		return WARNING;
+
+	int head = game->nChanged;
+	revealEndlessTile(game, x, y);
+
+	// Neighbours of a zero are never mines
+	for (; head < game->nChanged; head++) {
+		EndlessTile tile = game->changed[head];
+		if (adjacentMines(game, tile.x, tile.y) != 0)
+			continue;
+
+		for (int j=tile.y-1; j<=tile.y+1; j++) {
+			for (int i=tile.x-1; i<=tile.x+1; i++) {
+				if (game->nChanged < ENDLESS_MAX_FLOOD && onBoard(i, j) && !isRevealed(game, i, j))
+					revealEndlessTile(game, i, j);
+			}
+		}
+	}
+	return 0;
+}
+
+
+/// compareTiles
+/// qsort comparator, row by row then column
+int compareTiles(const void* a, const void* b)
+{
+	const EndlessTile* ta = a;
+	const EndlessTile* tb = b;
+	if (ta->y != tb->y)
+		return (ta->y > tb->y) - (ta->y < tb->y);
+	return (ta->x > tb->x) - (ta->x < tb->x);
+}
+
+
+/// encodeEndlessChanged
+/// Encodes every tile changed by the current move into reply, once each and
+/// row by row so they encode as runs
+/// Returns the number of tiles encoded
+int encodeEndlessChanged(EndlessGame* game, TileEncoder* reply)
+{
+	qsort(game->changed, game->nChanged, sizeof(EndlessTile), compareTiles);
+	for (int k=0; k<game->nChanged; k++) {
+		EndlessTile tile = game->changed[k];
+		if (k > 0 && compareTiles(&tile, &game->changed[k-1]) == 0)
+			continue;
+		if (isRevealed(game, tile.x, tile.y))
+			encodeTile(reply, tile.x, tile.y, adjacentMines(game, tile.x, tile.y), false, false);
+		else if (isFlagged(game, tile.x, tile.y))
+			encodeTile(reply, tile.x, tile.y, 9, true, false); // mines stay hidden under flags
+		else
+			encodeTile(reply, tile.x, tile.y, TILE_HIDDEN_COUNT, false, false); // unflagged
+	}
+	return finishTiles(reply);
+}
+
+
+/// endMove
+/// Trims the chunks once a move is done with them, passing its result on
+int endMove(EndlessGame* game, int result)
+{
+	trimChunks(game);
+	return result;
+}
+
+
+/// mineHit
+/// Ends the game on a mine
+int mineHit(EndlessGame* game)
+{
+	game->isOver = true;
+	game->endTime = time(0);
+	return endMove(game, 0);
+}
+
+
+
+/* Public functions */
+/// initEndless
+/// Sets up an empty endless game drawing its mines from seed
+void initEndless(EndlessGame* game, uint64_t seed)
+{
+	memset(game, 0, sizeof(EndlessGame));
+	game->seed = seed;
+	game->startTime = time(0);
+	game->nBuckets = ENDLESS_MIN_BUCKETS;
+	game->buckets = calloc(game->nBuckets, sizeof(Chunk*));
+	game->changedCapacity = 64;
+	game->changed = malloc(game->changedCapacity * sizeof(EndlessTile));
+	if (!game->buckets || !game->changed) {
+		perror("Out of memory in initEndless");
+		exit(1);
+	}
+}
+
+
+/// freeEndless
+/// Deallocates every chunk and overlay of an endless game
+void freeEndless(EndlessGame* game)
+{
+	for (int b=0; b<game->nBuckets; b++) {
+		Chunk* chunk = game->buckets[b];
+		while (chunk != NULL) {
+			Chunk* next = chunk->nextInBucket;
+			free(chunk->data);
+			free(chunk->revealedRows);
+			free(chunk->flags);
+			free(chunk);
+			chunk = next;
+		}
+	}
+	free(game->buckets);
+	free(game->changed);
+	game->buckets = NULL;
+	game->changed = NULL;
+}
+
+
+/// endlessReveal
+/// Requests a tile reveal, flood filling across chunks, encoding every newly
+/// revealed tile into reply
+/// Returns the number of tiles encoded, 0 if a mine was hit, or WARNING
+int endlessReveal(EndlessGame* game, int x, int y, TileEncoder* reply)
+{
+	if (!onBoard(x, y))
+		return WARNING;
+
+	game->nChanged = 0;
+	int err = revealFlood(game, x, y);
+	if (err == MINE_HIT)
+		return mineHit(game);
+	if (err == WARNING)
+		return endMove(game, WARNING);
+
+	return endMove(game, encodeEndlessChanged(game, reply));
+}
+
+
+/// endlessFlag
+/// Requests a flag placement, or its removal, encoding the tile into reply
+/// Returns 1, or WARNING
+int endlessFlag(EndlessGame* game, int x, int y, TileEncoder* reply)
+{
+	if (!onBoard(x, y) || isRevealed(game, x, y))
+		return endMove(game, WARNING);
+
+	tileChunk(game, x, y)->flagged[y & CHUNK_MASK] ^= tileBitOf(x);
+	game->nChanged = 0;
+	appendChanged(game, x, y);
+	return endMove(game, encodeEndlessChanged(game, reply));
+}
+
+
+/// endlessChord
+/// Requests a chord on the revealed tile at (x, y), as requestChord does
+/// Returns the number of tiles encoded, 0 if a mine was hit, or WARNING
+int endlessChord(EndlessGame* game, int x, int y, TileEncoder* reply)
+{
+	if (!onBoard(x, y) || !isRevealed(game, x, y) || adjacentFlags(game, x, y) != adjacentMines(game, x, y))
+		return endMove(game, WARNING);
+
+	// Reveal every unflagged neighbour
+	game->nChanged = 0;
+	for (int j=y-1; j<=y+1; j++) {
+		for (int i=x-1; i<=x+1; i++) {
+			if (!onBoard(i, j) || isFlagged(game, i, j) || isRevealed(game, i, j))
+				continue;
+			if (revealFlood(game, i, j) == MINE_HIT)
+				return mineHit(game); // a flag was misplaced
+		}
+	}
+
+	if (game->nChanged == 0)
+		return endMove(game, WARNING);
+	return endMove(game, encodeEndlessChanged(game, reply));
+}
+
+
+/// endlessMines
+/// Encodes every mine of the chunk of the mine hit, and of the chunks around
+/// it the player revealed tiles in, once the game is over
+/// Farther chunks are left out, so the reply stays small however far the
+/// player explored
+/// Returns the number of tiles encoded
+int endlessMines(EndlessGame* game, TileEncoder* reply)
+{
+	Chunk* hit = game->newest; // the mine hit was the last tile looked up
+	int hitX = hit->cx, hitY = hit->cy;
+	for (int cy = hitY - 1; cy <= hitY + 1; cy++) {
+		for (int cx = hitX - 1; cx <= hitX + 1; cx++) {
+			Chunk* chunk = findChunk(game, cx, cy);
+			if (chunk == NULL || (chunk->data == NULL && chunk->revealedRows == NULL))
+				continue;
+			if (chunk->data == NULL)
+				generateChunk(game, chunk);
+
+			ChunkData* data = chunk->data;
+			bool anyRevealed = false;
+			for (int y=0; y<CHUNK_SIZE; y++)
+				anyRevealed |= (data->revealed[y] != 0);
+			if (!anyRevealed && chunk != hit)
+				continue;
+
+			for (int y=0; y<CHUNK_SIZE; y++) {
+				for (uint64_t bits = data->mines[y]; bits != 0; bits &= bits - 1) {
+					int x = __builtin_ctzll(bits);
+					encodeTile(reply, chunk->cx * CHUNK_SIZE + x, chunk->cy * CHUNK_SIZE + y, 0,
+					           (data->flagged[y] >> x) & 1, true);
+				}
+			}
+		}
+	}
+	return endMove(game, finishTiles(reply));
+}
+
+
+/// endlessMemory
+/// Returns the bytes held by chunks and overlays
+size_t endlessMemory(EndlessGame* game)
+{
+	size_t bytes = game->nBuckets * sizeof(Chunk*) + game->changedCapacity * sizeof(EndlessTile);
+	for (int b=0; b<game->nBuckets; b++) {
+		for (Chunk* chunk = game->buckets[b]; chunk != NULL; chunk = chunk->nextInBucket) {
+			bytes += sizeof(Chunk) + chunk->nFlags * sizeof(uint16_t);
+			if (chunk->data != NULL)
+				bytes += sizeof(ChunkData);
+			if (chunk->revealedRows != NULL)
+				bytes += CHUNK_SIZE * sizeof(uint64_t);
+		}
+	}
+	return bytes;
+}
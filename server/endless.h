@@ -0,0 +1,150 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * server/endless.h
+ * Header for the server-side endless minesweeper board
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    4/11/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef __server_endless__h__
+#define __server_endless__h__
+
+/* Includes */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include "tilecodec.h"
+#include "minesweeper.h"
+
+
+/* Defines */
+#define CHUNK_SHIFT 6 // chunks of 64x64 tiles, one word per row and plane
+#define CHUNK_SIZE  (1 << CHUNK_SHIFT)
+#define CHUNK_MINES 655 // per chunk, about 16% of its tiles
+#define ENDLESS_LIMIT (1 << 30) // tiles lie within +-ENDLESS_LIMIT on both axes
+#define ENDLESS_MAX_CHUNKS 256 // chunks kept generated, colder ones are evicted after each move
+#define ENDLESS_MAX_FLOOD 65536 // tiles one reveal may open, flood fills stop there
+
+
+/* Types */
+/// ChunkData structure
+/// Tiles of a generated chunk, bit x of row y being tile (x, y) of the chunk
+typedef struct
+{
+	uint64_t mines[CHUNK_SIZE];
+	uint64_t revealed[CHUNK_SIZE];
+	uint64_t flagged[CHUNK_SIZE];
+} ChunkData;
+
+
+/// Chunk structure
+/// A chunk known to the game: generated, or evicted down to an overlay of
+/// what the player did there, its mines being regenerated from the seed
+typedef struct Chunk
+{
+	int cx;
+	int cy;
+	ChunkData* data;         // NULL once evicted
+	uint64_t* revealedRows;  // evicted: revealed rows, NULL if none
+	uint16_t* flags;         // evicted: flagged tiles as y*CHUNK_SIZE + x
+	int nFlags;
+	struct Chunk* nextInBucket;
+	struct Chunk* newer;     // recency list of generated chunks
+	struct Chunk* older;
+} Chunk;
+
+
+/// EndlessTile structure
+/// Board coordinates of an endless tile
+typedef struct
+{
+	int x;
+	int y;
+} EndlessTile;
+
+
+/// EndlessGame structure
+/// An unbounded board split into chunks generated on demand from
+/// (seed, chunk coordinates), held in a hash map keyed by chunk coordinates
+/// Memory follows the explored area: only recently used chunks are
+/// generated, the rest keep a compact overlay or nothing at all
+/// (0, 0) and its neighbours are never mines
+typedef struct
+{
+	uint64_t seed;
+	bool isOver;
+	time_t startTime;
+	time_t endTime;
+	long nRevealed;           // safe tiles revealed
+
+	Chunk** buckets;          // hash map of every known chunk
+	int nBuckets;
+	int nKnown;
+	int nGenerated;
+	Chunk* newest;            // recency list of generated chunks
+	Chunk* oldest;
+	Chunk* last;              // most recently looked up chunk
+	long generations;         // chunk generations, including regenerations
+	long evictions;
+
+	EndlessTile* changed;     // tiles changed by the current move, also the flood fill queue
+	int nChanged;
+	int changedCapacity;
+} EndlessGame;
+
+
+/* Public function prototypes */
+/// initEndless
+/// Sets up an empty endless game drawing its mines from seed
+void initEndless(EndlessGame* game, uint64_t seed);
+
+
+/// freeEndless
+/// Deallocates every chunk and overlay of an endless game
+void freeEndless(EndlessGame* game);
+
+
+/// endlessReveal
+/// Requests a tile reveal, flood filling across chunks, encoding every newly
+/// revealed tile into reply
+/// Returns the number of tiles encoded, 0 if a mine was hit, or WARNING
+int endlessReveal(EndlessGame* game, int x, int y, TileEncoder* reply);
+
+
+/// endlessFlag
+/// Requests a flag placement, or its removal, encoding the tile into reply
+/// Returns 1, or WARNING
+int endlessFlag(EndlessGame* game, int x, int y, TileEncoder* reply);
+
+
+/// endlessChord
+/// Requests a chord on the revealed tile at (x, y), as requestChord does
+/// Returns the number of tiles encoded, 0 if a mine was hit, or WARNING
+int endlessChord(EndlessGame* game, int x, int y, TileEncoder* reply);
+
+
+/// endlessMines
+/// Encodes every mine of the chunk of the mine hit, and of the chunks around
+/// it the player revealed tiles in, once the game is over
+/// Farther chunks are left out, so the reply stays small however far the
+/// player explored
+/// Returns the number of tiles encoded
+int endlessMines(EndlessGame* game, TileEncoder* reply);
+
+
+/// endlessMemory
+/// Returns the bytes held by chunks and overlays
+size_t endlessMemory(EndlessGame* game);
+
+
+
+/* Internal function prototypes, for the benchmarks */
+/// isMine, isRevealed
+/// Tile accessors, generating the chunk if needed
+bool isMine(EndlessGame* game, int x, int y);
+bool isRevealed(EndlessGame* game, int x, int y);
+
+
+#endif
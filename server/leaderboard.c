@@ -13,20 +13,157 @@
 #include "leaderboard.h"
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include "rng.h"
+#include "frame.h"
+
+
+/* Types */
+/// CachedReply structure
+/// An encoded leaderboard reply, valid for one generation
+typedef struct
+{
+	RefBuffer* reply; // NULL if the slot is empty
+	long generation;
+	long offset;
+	long limit;
+	bool framed;
+	long rows;
+} CachedReply;
+
+
+/// GameResult structure
+/// A finished game waiting in the result queue for the leaderboard thread
+typedef struct GameResult
+{
+	_Atomic(struct GameResult*) next;
+	char name[MAX_NAME_LENGTH];
+	bool win;
+	long int time;
+	bool newUser; // the game created the user, logged once applied
+} GameResult;
 
 
 /* Defines */
-static UserRecord* userRecords = NULL;
-static int readCounter = 0;
-static pthread_mutex_t rcLock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP; // mutex lock for read counter
-static pthread_mutex_t lbLock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP; // mutex lock for leaderboard access
+static UserRecord** userTable = NULL; // hash buckets of users, chained through next
+static size_t nBuckets = 0;
+static size_t nUsers = 0;
+static WinRecord* winHead = NULL; // skiplist head, LB_MAX_LEVEL levels and no wins
+static int winLevel = 1;          // levels in use
+static long totalWins = 0;
+static Rng levelRng;              // skiplist node levels
+static LeaderboardSnapshot* current = NULL; // newest published version, see acquireLeaderboard
+static LeaderboardSnapshot* oldest = NULL;  // oldest version not yet freed, versions chained through next
+static LeaderboardSnapshot* draft = NULL;   // version being written by the leaderboard thread
+static int draftFrom = 0;                   // first slot of the draft whose firstRow may be stale
+static pthread_mutex_t snapLock = PTHREAD_MUTEX_INITIALIZER; // current and the version chain, held briefly
+static atomic_long currentGeneration = 0; // games recorded, bumped under the snapshot lock
+static CachedReply replyCache[LB_CACHE_SLOTS];
+static long cacheHits = 0;
+static long cacheMisses = 0;
+static long rebuildNs = 0;                 // time spent encoding missed replies
+static long rebuildBytes = 0;
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER; // reply cache and its counters
+static GameResult resultStub;                    // first dummy of the result queue
+static _Atomic(GameResult*) resultHead = &resultStub; // last queued, swapped in by newRecord
+static GameResult* resultTail = &resultStub;     // dummy before the next result, leaderboard thread only
+static atomic_bool resultWaiting = false;        // the leaderboard thread is about to sleep
+static sem_t resultSignal;                       // wakes it
+static atomic_bool stopping = false;
+static pthread_t lbThread;
+static atomic_long resultsQueued = 0;
+static atomic_long resultsApplied = 0;
+static long resultBatches = 0;                   // leaderboard thread only
+static pthread_mutex_t flushLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flushCond = PTHREAD_COND_INITIALIZER; // signalled after each batch
 
 
 /* Private functions */
+/// newWinRecord
+/// Allocates a skiplist node with level links
+WinRecord* newWinRecord(int level)
+{
+	WinRecord* record = calloc(1, sizeof(WinRecord) + level * sizeof(WinLink));
+	if (!record) {
+		perror("Out of memory in newWinRecord");
+		exit(1);
+	}
+	record->level = level;
+	return record;
+}
+
+
+/// initLeaderboard
+/// Sets up the empty user table and skiplist on first use
+void initLeaderboard()
+{
+	nBuckets = LB_MIN_BUCKETS;
+	userTable = calloc(nBuckets, sizeof(UserRecord*));
+	if (!userTable) {
+		perror("Out of memory in initLeaderboard");
+		exit(1);
+	}
+	winHead = newWinRecord(LB_MAX_LEVEL);
+	seedRng(&levelRng, 0x6c6561646572ULL); // levels need no secrecy
+}
+
+
+/// hashName
+/// FNV-1a hash of a user name
+uint64_t hashName(const char* name)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (int i=0; i<MAX_NAME_LENGTH && name[i] != '\0'; i++) {
+		hash ^= (unsigned char)name[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+
+/// findUser
+/// Returns the user of a name, or NULL if it has no record yet
+UserRecord* findUser(const char* name)
+{
+	UserRecord* user = userTable[hashName(name) & (nBuckets - 1)];
+	while (user != NULL && strncmp(name, user->name, MAX_NAME_LENGTH) != 0)
+		user = user->next;
+	return user;
+}
+
+
+/// growUsers
+/// Doubles the user table, rehashing every user
+void growUsers()
+{
+	size_t grown = 2 * nBuckets;
+	UserRecord** table = calloc(grown, sizeof(UserRecord*));
+	if (!table) {
+		perror("Out of memory in growUsers");
+		exit(1);
+	}
+	for (size_t b=0; b<nBuckets; b++) {
+		UserRecord* user = userTable[b];
+		while (user != NULL) {
+			UserRecord* next = user->next;
+			size_t bucket = hashName(user->name) & (grown - 1);
+			user->next = table[bucket];
+			table[bucket] = user;
+			user = next;
+		}
+	}
+	free(userTable);
+	userTable = table;
+	nBuckets = grown;
+}
+
+
 /// newUser
-/// Creates a new user and pushes to end of user records
+/// Creates a new user and adds it to the user table
 UserRecord* newUser(const char* name)
 {
 	// Allocate memory for new user
@@ -37,183 +174,936 @@ UserRecord* newUser(const char* name)
     }
 	
 	// Fill data
-	strcpy(user->name, name);
+	strncpy(user->name, name, MAX_NAME_LENGTH - 1);
+	user->name[MAX_NAME_LENGTH - 1] = '\0';
 	user->records = NULL;
 	user->wins = 0;
 	user->plays = 0;
-	user->next = NULL;
 	
-	// Add to userRecords list
-	UserRecord* current = userRecords;
-	if (current == NULL) {
-		userRecords = user;
+	// Add to its bucket, keeping at most one user per bucket on average
+	if (++nUsers > nBuckets)
+		growUsers();
+	size_t bucket = hashName(user->name) & (nBuckets - 1);
+	user->next = userTable[bucket];
+	userTable[bucket] = user;
+
+	return user;
+}
+
+
+/// newSnapshot
+/// Allocates an unpublished, empty version with room for capacity chunks
+LeaderboardSnapshot* newSnapshot(long version, int capacity)
+{
+	LeaderboardSnapshot* snapshot = calloc(1, sizeof(LeaderboardSnapshot));
+	LeaderboardSlot* slots = malloc(capacity * sizeof(LeaderboardSlot));
+	if (!snapshot || !slots) {
+		perror("Out of memory in newSnapshot");
+		exit(1);
+	}
+	atomic_init(&snapshot->refs, 1); // held while current
+	snapshot->version = version;
+	snapshot->capacity = capacity;
+	snapshot->slots = slots;
+	return snapshot;
+}
+
+
+/// initSnapshots
+/// Publishes the empty first version on first use, under the snapshot lock
+void initSnapshots()
+{
+	if (current == NULL)
+		current = oldest = newSnapshot(0, 8);
+}
+
+
+/// freeRetired
+/// Frees the chunks a version replaced
+void freeRetired(LeaderboardSnapshot* snapshot)
+{
+	while (snapshot->retired != NULL) {
+		LeaderboardChunk* chunk = snapshot->retired;
+		snapshot->retired = chunk->nextRetired;
+		free(chunk);
+	}
+}
+
+
+/// keepRetired
+/// Moves the chunks retired in from to the list of to, freeing those no
+/// version up to prev can reach: written after it, or all without prev
+void keepRetired(LeaderboardSnapshot* from, LeaderboardSnapshot* to, const LeaderboardSnapshot* prev)
+{
+	LeaderboardChunk* chunk = from->retired;
+	from->retired = NULL;
+	while (chunk != NULL) {
+		LeaderboardChunk* next = chunk->nextRetired;
+		if (prev != NULL && chunk->version <= prev->version) {
+			chunk->nextRetired = to->retired;
+			to->retired = chunk;
+		}
+		else {
+			free(chunk);
+		}
+		chunk = next;
+	}
+}
+
+
+/// reclaimSnapshots
+/// Frees every released version but the current one, under the snapshot lock
+/// A chunk replaced in a version is reachable from the versions since the
+/// one that wrote it; it goes once none of those is left, so a reader
+/// holding an old version keeps its own chunks, not every version since
+void reclaimSnapshots()
+{
+	LeaderboardSnapshot* prev = NULL;
+	LeaderboardSnapshot** link = &oldest;
+	while (*link != current) {
+		LeaderboardSnapshot* snapshot = *link;
+		if (atomic_load(&snapshot->refs) != 0) {
+			prev = snapshot;
+			link = &snapshot->next;
+			continue;
+		}
+
+		// Its chunks and the next version's retired ones now answer to prev
+		LeaderboardSnapshot* next = snapshot->next;
+		keepRetired(snapshot, next, prev);
+		keepRetired(next, next, prev);
+		*link = next;
+		free(snapshot->slots);
+		free(snapshot);
+	}
+}
+
+
+/// entryBefore
+/// Returns whether entry ranks before the key (time, wins, name)
+bool entryBefore(const LeaderboardEntry* entry, long int time, int wins, const char* name)
+{
+	if (entry->time != time)
+		return entry->time < time;
+	if (entry->wins != wins)
+		return entry->wins > wins;
+	return strncmp(entry->user->name, name, MAX_NAME_LENGTH) < 0;
+}
+
+
+/// locateEntry
+/// Finds the draft's slot and place of record's key: its entry, or where
+/// it would be inserted; past the last entry is the end of the last chunk
+void locateEntry(const WinRecord* record, int* c, int* i)
+{
+	// First chunk whose last entry does not rank before the key
+	int lo = 0, hi = draft->nSlots;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		LeaderboardChunk* chunk = draft->slots[mid].chunk;
+		if (entryBefore(&chunk->entries[chunk->n-1], record->time, record->wins, record->user->name))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == draft->nSlots && lo > 0)
+		lo--;
+	*c = lo;
+	*i = 0;
+	if (lo == draft->nSlots)
+		return; // no chunks
+
+	// First entry in it not ranking before the key
+	LeaderboardChunk* chunk = draft->slots[lo].chunk;
+	lo = 0;
+	hi = chunk->n;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (entryBefore(&chunk->entries[mid], record->time, record->wins, record->user->name))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*i = lo;
+}
+
+
+/// newChunk
+/// Allocates an empty chunk written by the draft
+LeaderboardChunk* newChunk()
+{
+	LeaderboardChunk* chunk = malloc(sizeof(LeaderboardChunk));
+	if (!chunk) {
+		perror("Out of memory in newChunk");
+		exit(1);
+	}
+	chunk->version = draft->version;
+	chunk->n = 0;
+	chunk->nextRetired = NULL;
+	return chunk;
+}
+
+
+/// ownChunk
+/// Returns the chunk of the draft's slot c, first copying it if published,
+/// and marks the rows from that slot on for recounting
+LeaderboardChunk* ownChunk(int c)
+{
+	if (c < draftFrom)
+		draftFrom = c;
+	LeaderboardChunk* chunk = draft->slots[c].chunk;
+	if (chunk->version == draft->version)
+		return chunk;
+
+	LeaderboardChunk* copy = newChunk();
+	memcpy(copy, chunk, offsetof(LeaderboardChunk, entries) + chunk->n * sizeof(LeaderboardEntry));
+	copy->version = draft->version;
+	copy->nextRetired = NULL;
+	chunk->nextRetired = draft->retired;
+	draft->retired = chunk;
+	draft->slots[c].chunk = copy;
+	return copy;
+}
+
+
+/// insertSlot
+/// Inserts a slot for chunk into the draft at c
+void insertSlot(int c, LeaderboardChunk* chunk, long rows)
+{
+	if (draft->nSlots == draft->capacity) {
+		draft->capacity *= 2;
+		draft->slots = realloc(draft->slots, draft->capacity * sizeof(LeaderboardSlot));
+		if (!draft->slots) {
+			perror("Out of memory in insertSlot");
+			exit(1);
+		}
+	}
+	memmove(draft->slots + c + 1, draft->slots + c, (draft->nSlots - c) * sizeof(LeaderboardSlot));
+	draft->slots[c].chunk = chunk;
+	draft->slots[c].rows = rows;
+	draft->nSlots++;
+	if (c < draftFrom)
+		draftFrom = c;
+}
+
+
+/// draftInsert
+/// Adds record's entry to the draft, splitting a full chunk in half
+void draftInsert(const WinRecord* record)
+{
+	int c, i;
+	locateEntry(record, &c, &i);
+	if (draft->nSlots == 0)
+		insertSlot(0, newChunk(), 0);
+	LeaderboardChunk* chunk = ownChunk(c);
+
+	if (chunk->n == LB_CHUNK_ENTRIES) {
+		int half = LB_CHUNK_ENTRIES / 2;
+		LeaderboardChunk* upper = newChunk();
+		long upperRows = 0;
+		upper->n = chunk->n - half;
+		memcpy(upper->entries, chunk->entries + half, upper->n * sizeof(LeaderboardEntry));
+		for (int e=0; e<upper->n; e++)
+			upperRows += upper->entries[e].count;
+		draft->slots[c].rows -= upperRows;
+		chunk->n = half;
+		insertSlot(c + 1, upper, upperRows);
+		if (i > half) {
+			chunk = upper;
+			i -= half;
+			c++;
+		}
+	}
+
+	memmove(chunk->entries + i + 1, chunk->entries + i, (chunk->n - i) * sizeof(LeaderboardEntry));
+	LeaderboardEntry* entry = &chunk->entries[i];
+	entry->user = record->user;
+	entry->time = record->time;
+	entry->wins = record->wins;
+	entry->count = record->count;
+	chunk->n++;
+	draft->slots[c].rows += record->count;
+}
+
+
+/// draftRemove
+/// Removes record's entry from the draft, dropping its chunk once empty
+void draftRemove(const WinRecord* record)
+{
+	int c, i;
+	locateEntry(record, &c, &i);
+	LeaderboardChunk* chunk = ownChunk(c);
+	draft->slots[c].rows -= chunk->entries[i].count;
+	chunk->n--;
+	memmove(chunk->entries + i, chunk->entries + i + 1, (chunk->n - i) * sizeof(LeaderboardEntry));
+	if (chunk->n > 0)
+		return;
+
+	// Written by the draft, so the published original, if any, is retired already
+	draft->nSlots--;
+	memmove(draft->slots + c, draft->slots + c + 1, (draft->nSlots - c) * sizeof(LeaderboardSlot));
+	free(chunk);
+}
+
+
+/// draftUpdate
+/// Sets the wins and count of record's entry in the draft, which keeps its place
+void draftUpdate(const WinRecord* record, int wins, int count)
+{
+	int c, i;
+	locateEntry(record, &c, &i);
+	LeaderboardChunk* chunk = ownChunk(c);
+	draft->slots[c].rows += count - chunk->entries[i].count;
+	chunk->entries[i].wins = wins;
+	chunk->entries[i].count = count;
+}
+
+
+/// beginDraft
+/// Starts the next version from the current one, sharing all its chunks
+void beginDraft()
+{
+	// Only newRecord replaces the current version, so it stays put
+	pthread_mutex_lock(&snapLock);
+	initSnapshots();
+	LeaderboardSnapshot* base = current;
+	pthread_mutex_unlock(&snapLock);
+
+	draft = newSnapshot(base->version + 1, base->nSlots + 8);
+	memcpy(draft->slots, base->slots, base->nSlots * sizeof(LeaderboardSlot));
+	draft->nSlots = base->nSlots;
+	draftFrom = draft->nSlots;
+}
+
+
+/// publishDraft
+/// Makes the draft the current version, for readers acquiring from now on
+void publishDraft()
+{
+	// Recount rows before each slot from the first one that changed
+	long rows = (draftFrom > 0) ? draft->slots[draftFrom-1].firstRow + draft->slots[draftFrom-1].rows : 0;
+	for (int c=draftFrom; c<draft->nSlots; c++) {
+		draft->slots[c].firstRow = rows;
+		rows += draft->slots[c].rows;
+	}
+	draft->rows = rows;
+
+	pthread_mutex_lock(&snapLock);
+	LeaderboardSnapshot* previous = current;
+	previous->next = draft;
+	current = draft;
+	atomic_fetch_add(&currentGeneration, 1);
+	pthread_mutex_unlock(&snapLock);
+	draft = NULL;
+
+	releaseLeaderboard(previous);
+}
+
+
+/// encodeReply
+/// Encodes rows of a snapshot as one message, framed or not, timing it
+RefBuffer* encodeReply(const LeaderboardSnapshot* snapshot, long offset, long limit, bool framed, long* rows)
+{
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	Buffer message = {0};
+	size_t header = framed ? beginFrame(&message) : 0;
+	*rows = leaderboardRows(snapshot, &message, offset, limit);
+	appendBuffer(&message, "", 1);
+	if (framed)
+		endFrame(&message, header);
+	RefBuffer* reply = (*rows > 0) ? newRefBuffer(&message) : NULL;
+	freeBuffer(&message);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	pthread_mutex_lock(&cacheLock);
+	cacheMisses++;
+	rebuildNs += (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+	rebuildBytes += (reply != NULL) ? (long)reply->len : 0;
+	pthread_mutex_unlock(&cacheLock);
+	return reply;
+}
+
+
+/// winBefore
+/// Returns whether record ranks before the key (time, wins, name)
+bool winBefore(const WinRecord* record, long int time, int wins, const char* name)
+{
+	if (record->time != time)
+		return record->time < time;
+	if (record->wins != wins)
+		return record->wins > wins;
+	return strncmp(record->user->name, name, MAX_NAME_LENGTH) < 0;
+}
+
+
+/// findWinPath
+/// Finds the last node before record's key on every level in use, and the
+/// wins up to and including each
+void findWinPath(const WinRecord* record, WinRecord** update, long* rank)
+{
+	WinRecord* node = winHead;
+	for (int i=winLevel-1; i>=0; i--) {
+		rank[i] = (i == winLevel-1) ? 0 : rank[i+1];
+		while (node->links[i].next != NULL &&
+		       winBefore(node->links[i].next, record->time, record->wins, record->user->name)) {
+			rank[i] += node->links[i].span;
+			node = node->links[i].next;
+		}
+		update[i] = node;
+	}
+}
+
+
+/// insertWin
+/// Links a record into the skiplist at its rank
+void insertWin(WinRecord* record)
+{
+	WinRecord* update[LB_MAX_LEVEL];
+	long rank[LB_MAX_LEVEL];
+	findWinPath(record, update, rank);
+
+	// Higher levels start spanning every win from the head
+	for (; winLevel < record->level; winLevel++) {
+		rank[winLevel] = 0;
+		update[winLevel] = winHead;
+		winHead->links[winLevel].next = NULL;
+		winHead->links[winLevel].span = totalWins;
+	}
+
+	for (int i=0; i<record->level; i++) {
+		long before = rank[0] - rank[i]; // wins between update[i] and record
+		record->links[i].next = update[i]->links[i].next;
+		record->links[i].span = update[i]->links[i].span - before;
+		update[i]->links[i].next = record;
+		update[i]->links[i].span = before + record->count;
+	}
+	for (int i=record->level; i<winLevel; i++)
+		update[i]->links[i].span += record->count;
+	totalWins += record->count;
+
+	record->prev = (update[0] == winHead) ? NULL : update[0];
+	if (record->links[0].next != NULL)
+		record->links[0].next->prev = record;
+	draftInsert(record);
+}
+
+
+/// removeWin
+/// Unlinks a record from the skiplist, under the key it was inserted with
+void removeWin(WinRecord* record)
+{
+	WinRecord* update[LB_MAX_LEVEL];
+	long rank[LB_MAX_LEVEL];
+	findWinPath(record, update, rank);
+
+	for (int i=0; i<winLevel; i++) {
+		if (update[i]->links[i].next == record) {
+			update[i]->links[i].span += record->links[i].span - record->count;
+			update[i]->links[i].next = record->links[i].next;
+		}
+		else {
+			update[i]->links[i].span -= record->count;
+		}
+	}
+	while (winLevel > 1 && winHead->links[winLevel-1].next == NULL)
+		winLevel--;
+	totalWins -= record->count;
+
+	if (record->links[0].next != NULL)
+		record->links[0].next->prev = record->prev;
+	draftRemove(record);
+}
+
+
+/// bumpWin
+/// Counts one more win in a linked record, which keeps its place
+void bumpWin(WinRecord* record)
+{
+	WinRecord* update[LB_MAX_LEVEL];
+	long rank[LB_MAX_LEVEL];
+	findWinPath(record, update, rank);
+
+	// Every level's span over the record's place covers its wins
+	for (int i=0; i<winLevel; i++)
+		update[i]->links[i].span++;
+	draftUpdate(record, record->wins, record->count + 1);
+	record->count++;
+	totalWins++;
+}
+
+
+/// randomLevel
+/// Draws a node level, each level a quarter as likely as the one below
+int randomLevel()
+{
+	uint64_t bits = nextRng(&levelRng);
+	int level = 1;
+	while ((bits & 3) == 0 && level < LB_MAX_LEVEL) {
+		level++;
+		bits >>= 2;
+	}
+	return level;
+}
+
+
+/// addWin
+/// Counts a win of user in time
+/// The user's records all rank by its win count, so each moves up past
+/// any record now ranking behind it; one still behind the record before
+/// it keeps its place. Costs O(log n) per record moved, at most one per
+/// time the user has won in
+void addWin(UserRecord* user, long int time)
+{
+	user->wins++;
+	WinRecord* found = NULL;
+	for (WinRecord* record = user->records; record != NULL; record = record->nextOfUser) {
+		if (record->time == time)
+			found = record;
+
+		// More wins only ever move a record forward
+		WinRecord* prev = record->prev;
+		if (prev == NULL || winBefore(prev, record->time, user->wins, user->name)) {
+			draftUpdate(record, user->wins, record->count);
+			record->wins = user->wins;
+			continue;
+		}
+		removeWin(record);
+		record->wins = user->wins;
+		insertWin(record);
+	}
+
+	// One node per time, counting the wins in it
+	if (found != NULL) {
+		bumpWin(found);
 	}
 	else {
-		while(current->next != NULL)
-			current = current->next;
-		current->next = user;
+		found = newWinRecord(randomLevel());
+		found->time = time;
+		found->wins = user->wins;
+		found->count = 1;
+		found->user = user;
+		found->nextOfUser = user->records;
+		user->records = found;
+		insertWin(found);
 	}
+}
 
-	// Success
-	printf("Successfully created new user.\n");
-	fflush(stdout);
 
-	return user;
+/// winRank
+/// Returns the rank of the first win of record, from 1 for the best win
+long winRank(const WinRecord* record)
+{
+	WinRecord* update[LB_MAX_LEVEL];
+	long rank[LB_MAX_LEVEL];
+	findWinPath(record, update, rank);
+	return rank[0] + 1;
 }
 
 
 /// updateUser
 /// Adds or updates user data when a new play finishes
-void updateUser(const char* name, bool win, WinRecord* record)
+void updateUser(GameResult* result)
 {
 	// Check if user exists
-	UserRecord* user = userRecords;
-	bool userExists = false;
-	while(user != NULL) {
-		if (strncmp(name, user->name, MAX_NAME_LENGTH) == 0) {
-			userExists = true;
-			break;
-		}
-		
-		user = user->next;
-	}
-	if (userExists == false)
-		user = newUser(name);
+	UserRecord* user = findUser(result->name);
+	result->newUser = (user == NULL);
+	if (user == NULL)
+		user = newUser(result->name);
 	
 	// Increment play count
 	user->plays++;
-	printf("Incremented playcount for %s\n", name);
-	fflush(stdout);
-	
-	// Stop here if loss
-	if (!win)
-		return;
-	
-	// Update user win count and push record to end
-	user->wins++;
 	
-	WinRecord* latest = user->records;
-	if (latest == NULL) {
-		user->records = record;
+	// Update user win count and rank the record if won
+	if (result->win)
+		addWin(user, result->time);
+}
+
+
+/// popResults
+/// Takes up to max queued results, oldest first, leaving the last taken as
+/// the queue's dummy; the ones before it, and the old dummy, are freed by
+/// freeResults once applied
+int popResults(GameResult** batch, int max)
+{
+	int n = 0;
+	GameResult* tail = resultTail;
+	while (n < max) {
+		GameResult* next = atomic_load_explicit(&tail->next, memory_order_acquire);
+		if (next == NULL)
+			break; // empty, or a result being linked in, picked up next time
+		batch[n++] = next;
+		tail = next;
+	}
+	return n;
+}
+
+
+/// freeResults
+/// Frees the dummy before a batch and every result of it but the last,
+/// which becomes the new dummy
+void freeResults(GameResult** batch, int n)
+{
+	if (resultTail != &resultStub)
+		free(resultTail);
+	for (int r=0; r<n-1; r++)
+		free(batch[r]);
+	resultTail = batch[n-1];
+}
+
+
+/// applyResults
+/// Records a batch of results as one new version of the leaderboard, then
+/// logs them and wakes anyone waiting in flushLeaderboard
+void applyResults(GameResult** batch, int n)
+{
+	if (winHead == NULL)
+		initLeaderboard();
+
+	bool anyWin = false;
+	for (int r=0; r<n; r++)
+		anyWin |= batch[r]->win;
+
+	if (anyWin)
+		beginDraft();
+	for (int r=0; r<n; r++)
+		updateUser(batch[r]);
+	if (anyWin) {
+		publishDraft();
 	}
 	else {
-		while(latest->next != NULL)
-			latest = latest->next;
-		latest->next = record;
+		// Only plays changed, read live, but cached replies hold them
+		pthread_mutex_lock(&snapLock);
+		atomic_fetch_add(&currentGeneration, 1);
+		pthread_mutex_unlock(&snapLock);
 	}
 
-	// Success
-	printf("Added new win record for %s\n", name);
+	// Log once the batch is visible
+	for (int r=0; r<n; r++) {
+		if (batch[r]->newUser)
+			printf("Successfully created new user.\n");
+		printf("Incremented playcount for %s\n", batch[r]->name);
+		if (batch[r]->win)
+			printf("Added new win record for %s\n", batch[r]->name);
+	}
 	fflush(stdout);
+	freeResults(batch, n);
+	resultBatches++;
+
+	pthread_mutex_lock(&flushLock);
+	atomic_fetch_add(&resultsApplied, n);
+	pthread_cond_broadcast(&flushCond);
+	pthread_mutex_unlock(&flushLock);
+}
+
+
+/// runLeaderboard
+/// Leaderboard thread: the only writer of users, records and snapshots,
+/// applying queued results in batches until stopped and drained
+void* runLeaderboard(void* arg)
+{
+	GameResult* batch[LB_BATCH];
+	while (true) {
+		int n = popResults(batch, LB_BATCH);
+		if (n > 0) {
+			applyResults(batch, n);
+			continue;
+		}
+
+		// Sleep until newRecord sees the flag, unless a result beat it
+		atomic_store(&resultWaiting, true);
+		if (atomic_load(&resultTail->next) != NULL) {
+			atomic_store(&resultWaiting, false);
+			continue;
+		}
+		if (atomic_load(&stopping))
+			break;
+		sem_wait(&resultSignal);
+	}
+	return NULL;
 }
 
 
+
 /* Public functions */
+/// startLeaderboard
+/// Starts the leaderboard thread, which records the results of newRecord
+void startLeaderboard()
+{
+	sem_init(&resultSignal, 0, 0);
+	atomic_store(&stopping, false);
+	if (pthread_create(&lbThread, NULL, runLeaderboard, NULL) != 0) {
+		perror("Failed to start the leaderboard thread");
+		exit(1);
+	}
+}
+
+
 /// newRecord
-/// Adds a new record to the end of the list
+/// Queues a finished game for the leaderboard thread, to be counted and
+/// ranked if won; never blocks, callable from any thread
+/// Results are applied in batches, each published as one new version of
+/// the leaderboard, so readers never wait for them
 void newRecord(const char* name, bool win, long int time)
 {
-	// Lock
-	pthread_mutex_lock(&lbLock);
-	
-	// First check if loss
-	if (!win) {
-		updateUser(name, win, NULL);
-		pthread_mutex_unlock(&lbLock); // remember to unlock the mutex!
-		return;
-	}
-	
-	// Allocate memory for new record
-	WinRecord* record = malloc(sizeof(WinRecord));
-	if (!record) {
+	GameResult* result = malloc(sizeof(GameResult));
+	if (!result) {
 		perror("Out of memory in newRecord");
 		exit(1);
 	}
-	
-	record->time = time;
-	record->next = NULL;
-	
-	updateUser(name, win, record);
-	
-	// Unlock
-	pthread_mutex_unlock(&lbLock);
+	strncpy(result->name, name, MAX_NAME_LENGTH - 1);
+	result->name[MAX_NAME_LENGTH - 1] = '\0';
+	result->win = win;
+	result->time = time;
+	result->newUser = false;
+	atomic_store_explicit(&result->next, NULL, memory_order_relaxed);
+	atomic_fetch_add(&resultsQueued, 1);
+
+	// Swap in as the last result, then link the one before to it
+	GameResult* prev = atomic_exchange_explicit(&resultHead, result, memory_order_acq_rel);
+	atomic_store_explicit(&prev->next, result, memory_order_release);
+
+	// Wake the leaderboard thread if it went to sleep
+	if (atomic_exchange(&resultWaiting, false))
+		sem_post(&resultSignal);
 }
 
 
-/// requestLeaderboard
-/// Requests the entire leaderboard in a message
-int requestLeaderboard(char* reply)
-{	
-	// Wait for reader lock
-	pthread_mutex_lock(&rcLock);
-	readCounter++;
-	
-	// First reader must wait for and lock leaderboard, then unlock reader lock
-	if (readCounter == 1)
-		pthread_mutex_lock(&lbLock);
-	pthread_mutex_unlock(&rcLock);
-		
-	
-	int replyLen = 0;
-	char buffer[MAX_NAME_LENGTH+10+5+5+7]; // l,<name>,<time:long>,<wins:int>,<plays:int>
-	
-	// Iterate every user record
-	UserRecord* user = userRecords;
-	while(user != NULL) {
-		// Iterate every win record
-		WinRecord* record = user->records;
-		while(record != NULL) {
-			// Format record
-			memset(buffer, 0, sizeof(buffer)/sizeof(char));
-			sprintf(buffer, "l,%s,%ld,%d,%d,", user->name, record->time, user->wins, user->plays);
-			replyLen += strlen(buffer);
-			
-			// Append record to the reply
-			strcat(reply, buffer);
-			
-			record = record->next;
+/// flushLeaderboard
+/// Waits until every result queued so far has been applied
+void flushLeaderboard()
+{
+	long queued = atomic_load(&resultsQueued);
+	pthread_mutex_lock(&flushLock);
+	while (atomic_load(&resultsApplied) < queued)
+		pthread_cond_wait(&flushCond, &flushLock);
+	pthread_mutex_unlock(&flushLock);
+}
+
+
+/// stopLeaderboard
+/// Applies every queued result, then stops the leaderboard thread
+void stopLeaderboard()
+{
+	atomic_store(&stopping, true);
+	if (atomic_exchange(&resultWaiting, false))
+		sem_post(&resultSignal);
+	pthread_join(lbThread, NULL);
+	sem_destroy(&resultSignal);
+}
+
+
+/// acquireLeaderboard
+/// Returns the current leaderboard, held until releaseLeaderboard, and its
+/// generation, bumped by every game recorded
+/// Never waits for game results being recorded
+LeaderboardSnapshot* acquireLeaderboard(long* generation)
+{
+	pthread_mutex_lock(&snapLock);
+	initSnapshots();
+	LeaderboardSnapshot* snapshot = current;
+	atomic_fetch_add(&snapshot->refs, 1);
+	*generation = atomic_load(&currentGeneration);
+	pthread_mutex_unlock(&snapLock);
+	return snapshot;
+}
+
+
+/// releaseLeaderboard
+/// Drops a hold on a leaderboard snapshot
+void releaseLeaderboard(LeaderboardSnapshot* snapshot)
+{
+	if (atomic_fetch_sub(&snapshot->refs, 1) != 1)
+		return;
+
+	pthread_mutex_lock(&snapLock);
+	reclaimSnapshots();
+	pthread_mutex_unlock(&snapLock);
+}
+
+
+/// leaderboardRows
+/// Appends the rows of a snapshot ranked offset+1 to offset+limit, best
+/// first, as "l,<name>,<time>,<wins>,<plays>" joined by commas, without a NUL
+/// Returns the number of rows appended, 0 past the last
+long leaderboardRows(const LeaderboardSnapshot* snapshot, Buffer* reply, long offset, long limit)
+{
+	if (offset >= snapshot->rows)
+		return 0;
+
+	// Last chunk starting at or before the first row
+	int lo = 0, hi = snapshot->nSlots - 1;
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		if (snapshot->slots[mid].firstRow <= offset)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	long rows = 0;
+	long skip = offset - snapshot->slots[lo].firstRow;
+	for (int c=lo; c<snapshot->nSlots && rows < limit; c++) {
+		const LeaderboardChunk* chunk = snapshot->slots[c].chunk;
+		for (int e=0; e<chunk->n && rows < limit; e++) {
+			const LeaderboardEntry* entry = &chunk->entries[e];
+			if (skip >= entry->count) {
+				skip -= entry->count;
+				continue;
+			}
+			int plays = atomic_load_explicit(&entry->user->plays, memory_order_relaxed);
+			for (long w=skip; w<entry->count && rows < limit; w++) {
+				appendFormat(reply, "%sl,%s,%ld,%d,%d", (rows > 0) ? "," : "",
+				             entry->user->name, entry->time, entry->wins, plays);
+				rows++;
+			}
+			skip = 0;
 		}
-		user = user->next;
 	}
-	
-	// Wait for reader lock
-	pthread_mutex_lock(&rcLock);
-	readCounter--;
-	
-	// Last reader must unlock leaderboard
-	if (readCounter == 0)
-		pthread_mutex_unlock(&lbLock);
-	pthread_mutex_unlock(&rcLock);
-	
-	// Replace last , with 0
-	reply[replyLen-1] = 0;
-	
-	return replyLen; // return size of reply
+	return rows;
+}
+
+
+/// leaderboardReply
+/// Returns the rows of a snapshot ranked offset+1 to offset+limit as one
+/// message, framed or not, with one reference for the caller, or NULL past
+/// the last row; *rows is set to the number of rows in it
+/// Replies are cached, one per slot of a small direct-mapped table, until
+/// the next game is recorded; only replies of the latest generation are
+/// stored, so readers of an older snapshot do not evict them
+RefBuffer* leaderboardReply(const LeaderboardSnapshot* snapshot, long generation,
+                            long offset, long limit, bool framed, long* rows)
+{
+	size_t slot = ((size_t)offset * 31 + (size_t)limit) * 2 + framed;
+	CachedReply* cached = &replyCache[slot % LB_CACHE_SLOTS];
+
+	// Cached bytes, shared with every reader asking for them
+	pthread_mutex_lock(&cacheLock);
+	if (cached->reply != NULL && cached->generation == generation && cached->offset == offset &&
+	    cached->limit == limit && cached->framed == framed) {
+		RefBuffer* reply = cached->reply;
+		retainRefBuffer(reply);
+		*rows = cached->rows;
+		cacheHits++;
+		pthread_mutex_unlock(&cacheLock);
+		return reply;
+	}
+	pthread_mutex_unlock(&cacheLock);
+
+	// Rebuild outside the lock, then keep it if still current
+	RefBuffer* reply = encodeReply(snapshot, offset, limit, framed, rows);
+	if (reply == NULL || generation != atomic_load(&currentGeneration))
+		return reply;
+
+	pthread_mutex_lock(&cacheLock);
+	if (cached->reply != NULL)
+		releaseRefBuffer(cached->reply);
+	retainRefBuffer(reply);
+	cached->reply = reply;
+	cached->generation = generation;
+	cached->offset = offset;
+	cached->limit = limit;
+	cached->framed = framed;
+	cached->rows = *rows;
+	pthread_mutex_unlock(&cacheLock);
+	return reply;
+}
+
+
+/// requestLeaderboardReply
+/// As leaderboardReply, on the current leaderboard
+RefBuffer* requestLeaderboardReply(long offset, long limit, bool framed)
+{
+	long generation, rows;
+	LeaderboardSnapshot* snapshot = acquireLeaderboard(&generation);
+	RefBuffer* reply = leaderboardReply(snapshot, generation, offset, limit, framed, &rows);
+	releaseLeaderboard(snapshot);
+	return reply;
+}
+
+
+/// requestLeaderboard
+/// Appends the rows ranked offset+1 to offset+limit of the current leaderboard
+/// Returns the number of rows appended, 0 past the last
+long requestLeaderboard(Buffer* reply, long offset, long limit)
+{
+	long generation;
+	LeaderboardSnapshot* snapshot = acquireLeaderboard(&generation);
+	long rows = leaderboardRows(snapshot, reply, offset, limit);
+	releaseLeaderboard(snapshot);
+	return rows;
+}
+
+
+/// printLeaderboardStats
+/// Prints the reply cache hit rate and the cost of rebuilding replies
+void printLeaderboardStats()
+{
+	pthread_mutex_lock(&cacheLock);
+	long requests = cacheHits + cacheMisses;
+	printf("Leaderboard applied %ld results in %ld batches\n", atomic_load(&resultsApplied), resultBatches);
+	printf("Leaderboard cache %ld hits, %ld misses (%.1f%% hit), rebuilds %.1f us and %ld bytes on average\n",
+	       cacheHits, cacheMisses, requests ? 100.0 * cacheHits / requests : 0.0,
+	       cacheMisses ? rebuildNs / 1000.0 / cacheMisses : 0.0, cacheMisses ? rebuildBytes / cacheMisses : 0);
+	pthread_mutex_unlock(&cacheLock);
 }
 
 
 /// cleanupLeaderboard
-/// Safely deallocates entire list of user records, including win records
+/// Safely deallocates every user record, including win records
 void cleanupLeaderboard()
 {
-	// Store pointers for the current user record and next 
-	UserRecord* currentUser = NULL;
-	UserRecord* nextUser = userRecords;
-	
-	// Repeatedly shift next into current, and free current
-	while(nextUser != NULL) {
-		currentUser = nextUser;
-		nextUser = currentUser->next;
-		
-		// Do the same with each win record
-		WinRecord* currentWin = NULL;
-		WinRecord* nextWin = currentUser->records;
-		while(nextWin != NULL) {
-			currentWin = nextWin;
-			nextWin = currentWin->next;
-			free(currentWin);
+	for (size_t b=0; b<nBuckets; b++) {
+		UserRecord* user = userTable[b];
+		while (user != NULL) {
+			UserRecord* nextUser = user->next;
+			
+			// Free each win record of the user
+			WinRecord* record = user->records;
+			while (record != NULL) {
+				WinRecord* nextRecord = record->nextOfUser;
+				free(record);
+				record = nextRecord;
+			}
+			
+			free(user);
+			user = nextUser;
+		}
+	}
+	free(userTable);
+	free(winHead);
+
+	// Last dummy of the result queue
+	if (resultTail != &resultStub)
+		free(resultTail);
+	resultTail = &resultStub;
+	atomic_store(&resultStub.next, NULL);
+	atomic_store(&resultHead, &resultStub);
+
+	// Cached replies
+	for (int c=0; c<LB_CACHE_SLOTS; c++) {
+		if (replyCache[c].reply != NULL)
+			releaseRefBuffer(replyCache[c].reply);
+		replyCache[c].reply = NULL;
+	}
+
+	// Every version with the chunks it replaced, and the current chunks
+	while (oldest != NULL) {
+		LeaderboardSnapshot* next = oldest->next;
+		freeRetired(oldest);
+		if (oldest == current) {
+			for (int c=0; c<current->nSlots; c++)
+				free(current->slots[c].chunk);
 		}
-		
-		free(currentUser);
+		free(oldest->slots);
+		free(oldest);
+		oldest = next;
 	}
+	current = NULL;
+	userTable = NULL;
+	winHead = NULL;
+	nBuckets = nUsers = 0;
+	winLevel = 1;
+	totalWins = 0;
 }
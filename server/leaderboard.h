@@ -12,41 +12,181 @@
 
 /* Includes */
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <time.h>
 #include "comms.h" // for MAX_NAME_LENGTH
+#include "buffer.h"
+
+
+/* Defines */
+#define LB_MAX_LEVEL 24 // skiplist levels, each a quarter of the one below
+#define LB_MIN_BUCKETS 64 // user hash table size, doubled as users outgrow it
+#define LB_CHUNK_ENTRIES 256 // snapshot entries per chunk, the unit copied on write
+#define LB_CACHE_SLOTS 64 // encoded replies kept, one per slot, see leaderboardReply
+#define LB_BATCH 256 // game results applied per leaderboard version at most
 
 
 /* Types */
+struct WinRecord;
+struct UserRecord;
+
+/// WinLink structure
+/// One level of a skiplist node: the next node on that level, and the
+/// number of wins from this node (excluded) up to that node (included)
+typedef struct
+{
+	struct WinRecord* next;
+	long span;
+} WinLink;
+
+
 /// WinRecord structure
-/// Linked list recording time to win
+/// Skiplist node holding every win of one user in one time, ranked best
+/// first: by time, then by the user's win count (most first), then by name
+/// Spans count wins rather than nodes, so a win's rank is summed on the way
+/// down, and the win of a given rank found in O(log n)
 typedef struct WinRecord
 {
 	long int time;
-	struct WinRecord* next;
+	int wins;                     // the user's win count, kept here for comparisons
+	int count;                    // wins of the user in this time
+	struct UserRecord* user;
+	struct WinRecord* nextOfUser; // the user's other times, unordered
+	struct WinRecord* prev;       // previous node on the lowest level, NULL for the first
+	int level;
+	WinLink links[];              // level entries
 } WinRecord;
 
 
 /// UserRecord structure
-/// Linked list recording player name, win count, plays
+/// Player name, win count, plays, and the player's win records
+/// Users are found by name in a hash table, chained through next
 typedef struct UserRecord
 {
 	char name[MAX_NAME_LENGTH];
-	int plays;
+	atomic_int plays;             // read by snapshot readers without the lock
 	int wins;
 	WinRecord* records;
 	struct UserRecord* next;
 } UserRecord;
 
 
+/// LeaderboardEntry structure
+/// A win record as readers see it: count wins of user in time
+/// Only the user's name and plays are read, plays being the live count
+typedef struct
+{
+	const struct UserRecord* user;
+	long int time;
+	int wins;
+	int count;
+} LeaderboardEntry;
+
+
+/// LeaderboardChunk structure
+/// Consecutive entries of a snapshot, shared by every later snapshot until
+/// one of its entries changes; then that snapshot copies it, and the copy
+/// is only ever changed before the snapshot is published
+typedef struct LeaderboardChunk
+{
+	long version;                         // snapshot that wrote it
+	int n;
+	struct LeaderboardChunk* nextRetired;
+	LeaderboardEntry entries[LB_CHUNK_ENTRIES];
+} LeaderboardChunk;
+
+
+/// LeaderboardSlot structure
+/// A chunk in a snapshot, with its rows counted alongside so seeking by
+/// rank and publishing never touch the chunks themselves
+typedef struct
+{
+	LeaderboardChunk* chunk;
+	long rows;     // wins in its entries
+	long firstRow; // rows in the chunks before it
+} LeaderboardSlot;
+
+
+/// LeaderboardSnapshot structure
+/// One immutable version of the leaderboard, best first, held by readers
+/// through acquireLeaderboard and freed once all of them released it
+typedef struct LeaderboardSnapshot
+{
+	atomic_int refs;                  // readers, plus one while current
+	long version;
+	int nSlots;
+	int capacity;
+	LeaderboardSlot* slots;
+	long rows;
+	LeaderboardChunk* retired;        // chunks of the previous version replaced in this one
+	struct LeaderboardSnapshot* next; // newer version
+} LeaderboardSnapshot;
+
+
 /* Public function prototypes */
+/// startLeaderboard
+/// Starts the leaderboard thread, the only writer of the leaderboard
+void startLeaderboard();
+
+
 /// newRecord
-/// Adds a new user record
+/// Queues a finished game, recorded by the leaderboard thread soon after
+/// Never blocks, callable from any thread
 void newRecord(const char* name, bool win, long int time);
 
 
+/// flushLeaderboard
+/// Waits until every game queued so far has been recorded
+void flushLeaderboard();
+
+
+/// stopLeaderboard
+/// Records every queued game, then stops the leaderboard thread
+void stopLeaderboard();
+
+
+/// acquireLeaderboard
+/// Returns the current leaderboard, held until releaseLeaderboard, and its
+/// generation, bumped by every game recorded
+/// Never waits for game results being recorded
+LeaderboardSnapshot* acquireLeaderboard(long* generation);
+
+
+/// releaseLeaderboard
+/// Drops a hold on a leaderboard snapshot
+void releaseLeaderboard(LeaderboardSnapshot* snapshot);
+
+
+/// leaderboardRows
+/// Appends the rows of a snapshot ranked offset+1 to offset+limit, best first
+/// Returns the number of rows appended, 0 past the last
+long leaderboardRows(const LeaderboardSnapshot* snapshot, Buffer* reply, long offset, long limit);
+
+
+/// leaderboardReply
+/// Returns the rows of a snapshot ranked offset+1 to offset+limit as one
+/// message, framed or not, with one reference for the caller, or NULL past
+/// the last row; *rows is set to the number of rows in it
+/// Replies are cached until the next game is recorded
+RefBuffer* leaderboardReply(const LeaderboardSnapshot* snapshot, long generation,
+                            long offset, long limit, bool framed, long* rows);
+
+
+/// requestLeaderboardReply
+/// As leaderboardReply, on the current leaderboard
+RefBuffer* requestLeaderboardReply(long offset, long limit, bool framed);
+
+
 /// requestLeaderboard
-/// Requests the entire leaderboard in a message
-int requestLeaderboard(char* reply);
+/// Appends the rows ranked offset+1 to offset+limit of the current leaderboard
+/// Returns the number of rows appended, 0 past the last
+long requestLeaderboard(Buffer* reply, long offset, long limit);
+
+
+/// printLeaderboardStats
+/// Prints the games recorded per batch, the reply cache hit rate and the
+/// cost of rebuilding replies
+void printLeaderboardStats();
 
 
 /// cleanupLeaderboard
@@ -54,4 +194,17 @@ int requestLeaderboard(char* reply);
 void cleanupLeaderboard();
 
 
+
+
+/* Internal function prototypes, for the benchmarks */
+/// findUser
+/// Returns the user of a name, or NULL if it has no record yet
+UserRecord* findUser(const char* name);
+
+
+/// winRank
+/// Returns the rank of the first win of record, from 1 for the best win
+long winRank(const WinRecord* record);
+
+
 #endif
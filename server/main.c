@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * server/main.c
  * Minesweeper server main entrypoint
@@ -13,19 +15,25 @@
 #include <stdbool.h>
 #include <signal.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <unistd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include "leaderboard.h"
 #include "threadpool.h"
 #include "comms.h"
+#include "rng.h"
+#include "boardpool.h"
 
 
 /* Defines */
-#define SEED 42
 #define DEFAULT_PORT 12345
+#define MAX_EVENTS 64
+#define EPOLL_TIMEOUT 1000 // ms, bounds how long closed sessions wait to be reaped
 static volatile bool terminate = false;
 
 
@@ -39,12 +47,44 @@ void intHandler(int dummy)
 }
 
 
+/// acceptConnections
+/// Accepts every pending connection and registers it with the event loop
+void acceptConnections(int epID, int sID)
+{
+	while (true) {
+		struct sockaddr_in cAddr;
+		socklen_t sInSize = sizeof(struct sockaddr_in);
+		int cID = accept4(sID, (struct sockaddr*)&cAddr, &sInSize, SOCK_NONBLOCK);
+		if (cID == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				perror("Failed to accept connection");
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		printf("Server accepted connection from %s\n", inet_ntoa(cAddr.sin_addr));
+
+		// Register for edge-triggered reads and writes
+		Session* session = openSession(cID);
+		struct epoll_event event;
+		event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		event.data.ptr = session;
+		if (epoll_ctl(epID, EPOLL_CTL_ADD, cID, &event) == -1) {
+			perror("Failed to register connection");
+			closeSocket(cID);
+			free(session);
+			continue;
+		}
+
+		// Send "connect"
+		notifySession(session, EVENT_READ);
+	}
+}
+
+
 /// main
 int main(int argc, char* argv[])
 {
-	// Seed random number generator
-	srand(SEED);
-	
 	// Setup signals
 	struct sigaction sa;
 	sa.sa_handler = intHandler;
@@ -61,29 +101,75 @@ int main(int argc, char* argv[])
 	if (argc > 1 && atoi(argv[1]) > 0) {
 		port = atoi(argv[1]);
 	}
+
+	// Seed every game from args, or randomly so boards differ across restarts
+	uint64_t seed = (argc > 2) ? strtoull(argv[2], NULL, 0) : randomMasterSeed();
+	setMasterSeed(seed);
+	printf("Master seed %llu\n", (unsigned long long)seed);
+
+	// Start generating boards ahead of games
+	initBoardPool();
+
+	// Record game results off the worker threads
+	startLeaderboard();
 	
 	// Open socket
-	socklen_t sInSize = sizeof(struct sockaddr_in);
 	int sID = openSocket(port);
-	
+	fcntl(sID, F_SETFL, fcntl(sID, F_GETFL, 0) | O_NONBLOCK);
+
+	// Create event loop, listening socket is identified by a NULL pointer
+	int epID = epoll_create1(0);
+	if (epID == -1) {
+		perror("Failed to create event loop");
+		exit(1);
+	}
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	if (epoll_ctl(epID, EPOLL_CTL_ADD, sID, &event) == -1) {
+		perror("Failed to register listening socket");
+		exit(1);
+	}
+
 	// Run loop
+	struct epoll_event events[MAX_EVENTS];
 	while (!terminate) {
-		// Block until new client connection
-		struct sockaddr_in cAddr;
-		int cID = accept(sID, (struct sockaddr*)&cAddr, &sInSize);
-		if (cID == -1) {
-			perror("Failed to accept connection");
+		// Block until sockets are ready
+		int nEvents = epoll_wait(epID, events, MAX_EVENTS, EPOLL_TIMEOUT);
+		if (nEvents == -1) {
+			if (errno != EINTR)
+				perror("Failed to wait for events");
 			continue;
 		}
-		printf("Server accepted connection from %s\n", inet_ntoa(cAddr.sin_addr));
-		
-		// Add request for threaded processing
-		newRequest(handleConnection, cID);
+
+		for (int i=0; i<nEvents; i++) {
+			// New client connections
+			if (events[i].data.ptr == NULL) {
+				acceptConnections(epID, sID);
+				continue;
+			}
+
+			// Hand session events to the threadpool
+			int sessionEvents = 0;
+			if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+				sessionEvents |= EVENT_READ;
+			if (events[i].events & EPOLLOUT)
+				sessionEvents |= EVENT_WRITE;
+			notifySession(events[i].data.ptr, sessionEvents);
+		}
+
+		// Free sessions closed during this batch
+		reapSessions();
 	}
 
 	// Clean up
+	close(epID);
 	closeSocket(sID);
 	destroyThreadpool();
+	stopLeaderboard();
+	printPoolStats();
+	printLeaderboardStats();
+	destroyBoardPool();
 	cleanupLeaderboard();
 	printf("Server exited safely.\n");
 	
@@ -1,5 +1,3 @@
-#define _GNU_SOURCE
-
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * *
  * server/minesweeper.c
  * Server-side minesweeper game code
@@ -11,115 +9,302 @@
 
 /* Includes */
 #include "minesweeper.h"
+#include "solver.h"
 #include <string.h>
 #include <stdio.h>
-#include <pthread.h>
 
 
 /* Defines */
-static pthread_mutex_t randLock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP; // mutex lock for rand() calls
+// Word-parallel adjacency counting, several plane words per step
+// GCC/Clang vector extensions compile to AVX2 or SSE2 where the target has them
+#if defined(__GNUC__) && defined(__AVX2__)
+#define BOARD_LANES 4
+#elif defined(__GNUC__) && (defined(__SSE2__) || defined(__ARM_NEON))
+#define BOARD_LANES 2
+#endif
+
+#ifdef BOARD_LANES
+typedef uint64_t BoardLanes __attribute__((vector_size(BOARD_LANES * sizeof(uint64_t))));
+#endif
+
+// Adds the neighbour bits b into the bit-sliced 4-bit counters c0..c3
+#define ADD_NEIGHBOURS(c0, c1, c2, c3, b, carry, carry2) \
+	{ carry = c0 & b; c0 ^= b; carry2 = c1 & carry; c1 ^= carry; carry = c2 & carry2; c2 ^= carry2; c3 |= carry; }
 
 
 /* Private functions */
+/// tileWord
+/// Assumes (x < game->width) && (y < game->height)
+/// Returns the index of the word holding tile (x, y) in each bit plane
+size_t tileWord(GameState* game, int x, int y)
+{
+	return (size_t)(y+1)*game->stride + 1 + (x >> 6);
+}
+
+
+/// tileBit
+/// Returns the mask of tile column x within its plane word
+uint64_t tileBit(int x)
+{
+	return (uint64_t)1 << (x & 63);
+}
+
+
 /// tileIsMine
-/// Assumes (x < N_TILES_X) && (y < N_TILES_Y)
+/// Assumes (x < game->width) && (y < game->height)
 /// Returns whether or not the game tile at (x, y) is a mine
 bool tileIsMine(GameState* game, int x, int y)
 {
-	return game->tiles[x][y].isMine;
+	return (game->mines[tileWord(game, x, y)] & tileBit(x)) != 0;
 }
 
 
 /// tileIsRevealed
-/// Assumes (x < N_TILES_X) && (y < N_TILES_Y)
+/// Assumes (x < game->width) && (y < game->height)
 /// Returns whether or not the game tile at (x, y) is revealed
 bool tileIsRevealed(GameState* game, int x, int y)
 {
-	return game->tiles[x][y].isRevealed;
+	return (game->revealed[tileWord(game, x, y)] & tileBit(x)) != 0;
 }
 
 
 /// tileIsFlagged
-/// Assumes (x < N_TILES_X) && (y < N_TILES_Y)
+/// Assumes (x < game->width) && (y < game->height)
 /// Returns whether or not the game tile at (x, y) is revealed
 bool tileIsFlagged(GameState* game, int x, int y)
 {
-	return game->tiles[x][y].isFlagged;
+	return (game->flagged[tileWord(game, x, y)] & tileBit(x)) != 0;
+}
+
+
+/// neighbourBits
+/// Returns the three bits of columns x-1 .. x+1 in a plane row
+/// The guard words make x-1 == -1 and x+1 == width read as zero
+uint64_t neighbourBits(const uint64_t* row, int x)
+{
+	int pos = x + 63; // column x-1, counted from the start of the guard word
+	uint64_t bits = row[pos >> 6] >> (pos & 63);
+	if ((pos & 63) > 61)
+		bits |= row[(pos >> 6) + 1] << (64 - (pos & 63));
+	return bits & 7;
 }
 
 
 /// tileAdjacentMines
-/// Assumes (x < N_TILES_X) && (y < N_TILES_Y)
+/// Assumes (x < game->width) && (y < game->height)
 /// Returns the number of adjacent mines to tile at (x, y)
 int tileAdjacentMines(GameState* game, int x, int y)
 {
-	return game->tiles[x][y].nAdjacentMines;
+	const uint64_t* row = game->mines + (size_t)y*game->stride; // row above (x, y)
+	int count = __builtin_popcountll(neighbourBits(row, x)) +
+	            __builtin_popcountll(neighbourBits(row + game->stride, x)) +
+	            __builtin_popcountll(neighbourBits(row + 2*game->stride, x));
+	return count - tileIsMine(game, x, y);
+}
+
+
+/// tileAdjacentFlags
+/// Assumes (x < game->width) && (y < game->height)
+/// Returns the number of flagged tiles around tile at (x, y)
+int tileAdjacentFlags(GameState* game, int x, int y)
+{
+	const uint64_t* row = game->flagged + (size_t)y*game->stride; // row above (x, y)
+	int count = __builtin_popcountll(neighbourBits(row, x)) +
+	            __builtin_popcountll(neighbourBits(row + game->stride, x)) +
+	            __builtin_popcountll(neighbourBits(row + 2*game->stride, x));
+	return count - tileIsFlagged(game, x, y);
+}
+
+
+/// countAdjacentRow
+/// Sums the adjacent mines of every tile in row y, word-parallel
+/// Writes bit-sliced counts: bit x of count[b][1 + x/64] is bit b of the count
+/// for column x, each of the 4 count arrays holding game->stride words
+void countAdjacentRow(GameState* game, int y, uint64_t* count[4])
+{
+	const uint64_t* rows[3];
+	for (int r=0; r<3; r++)
+		rows[r] = game->mines + (size_t)(y + r)*game->stride; // above, at, below
+	int words = game->stride - 2;
+	int k = 1;
+
+#ifdef BOARD_LANES
+	for (; k + BOARD_LANES - 1 <= words; k += BOARD_LANES) {
+		BoardLanes c0 = {0}, c1 = {0}, c2 = {0}, c3 = {0}, carry, carry2;
+		for (int r=0; r<3; r++) {
+			BoardLanes west, mid, east;
+			memcpy(&west, rows[r] + k - 1, sizeof(west));
+			memcpy(&mid, rows[r] + k, sizeof(mid));
+			memcpy(&east, rows[r] + k + 1, sizeof(east));
+			BoardLanes left = (mid << 1) | (west >> 63);  // mine at x-1, counted at x
+			BoardLanes right = (mid >> 1) | (east << 63); // mine at x+1, counted at x
+			ADD_NEIGHBOURS(c0, c1, c2, c3, left, carry, carry2);
+			ADD_NEIGHBOURS(c0, c1, c2, c3, right, carry, carry2);
+			if (r != 1)
+				ADD_NEIGHBOURS(c0, c1, c2, c3, mid, carry, carry2);
+		}
+		memcpy(count[0] + k, &c0, sizeof(c0));
+		memcpy(count[1] + k, &c1, sizeof(c1));
+		memcpy(count[2] + k, &c2, sizeof(c2));
+		memcpy(count[3] + k, &c3, sizeof(c3));
+	}
+#endif
+
+	// Scalar fallback, and the words left over from the vector loop
+	for (; k <= words; k++) {
+		uint64_t c0 = 0, c1 = 0, c2 = 0, c3 = 0, carry, carry2;
+		for (int r=0; r<3; r++) {
+			uint64_t mid = rows[r][k];
+			uint64_t left = (mid << 1) | (rows[r][k-1] >> 63);
+			uint64_t right = (mid >> 1) | (rows[r][k+1] << 63);
+			ADD_NEIGHBOURS(c0, c1, c2, c3, left, carry, carry2);
+			ADD_NEIGHBOURS(c0, c1, c2, c3, right, carry, carry2);
+			if (r != 1)
+				ADD_NEIGHBOURS(c0, c1, c2, c3, mid, carry, carry2);
+		}
+		count[0][k] = c0;
+		count[1][k] = c1;
+		count[2][k] = c2;
+		count[3][k] = c3;
+	}
+}
+
+
+/// rowMask
+/// Returns the mask of on-board columns within plane word k (1-based) of a row
+uint64_t rowMask(GameState* game, int k)
+{
+	int columns = game->width - (k-1)*64;
+	return columns >= 64 ? ~(uint64_t)0 : tileBit(columns) - 1;
+}
+
+
+/// toggleMine
+/// Flips whether the tile at flat index t is a mine
+void toggleMine(GameState* game, int t)
+{
+	int x = t % game->width, y = t / game->width;
+	game->mines[tileWord(game, x, y)] ^= tileBit(x);
 }
 
 
 /// placeMines
-/// Randomly sets N_MINES game tiles to be mines
-/// Requires synchronisation, since rand() is not thread safe
-void placeMines(GameState* game)
+/// Randomly sets game->nMines game tiles to be mines, drawn from rng
+/// Tiles within radius of (safeX, safeY) are kept clear, none if radius < 0
+/// Floyd's sampling picks exactly one distinct tile per draw at any density;
+/// past half full it picks the safe tiles instead, out of a board of mines
+void placeMines(GameState* game, Rng* rng, int safeX, int safeY, int radius)
 {
-	// Lock
-    pthread_mutex_lock(&randLock);
-	
-	for (int i=0; i<N_MINES; i++) {
-		int x, y;
-		do
-		{
-			x = rand() % N_TILES_X;
-			y = rand() % N_TILES_Y;
-		} while (tileIsMine(game, x, y));
-		
-		// Place mine at (x, y)
-		game->tiles[x][y].isMine = true;
-		
-		// Increment nAdjacentMines on 8 neighbours
-		// north
-		if ( y > 0 )
-			game->tiles[x][y-1].nAdjacentMines++;
-		
-		// northeast
-		if ( y > 0 && x < N_TILES_X-1 )
-			game->tiles[x+1][y-1].nAdjacentMines++;
-		
-		// east
-		if ( x < N_TILES_X-1 )
-			game->tiles[x+1][y].nAdjacentMines++;
-		
-		// southeast
-		if ( x < N_TILES_X-1 && y < N_TILES_Y-1 )
-			game->tiles[x+1][y+1].nAdjacentMines++;
-		
-		// south
-		if ( y < N_TILES_Y-1 )
-			game->tiles[x][y+1].nAdjacentMines++;
-		
-		// southwest
-		if ( y < N_TILES_Y-1 && x > 0 )
-			game->tiles[x-1][y+1].nAdjacentMines++;
-		
-		// west
-		if ( x > 0 )
-			game->tiles[x-1][y].nAdjacentMines++;
-		
-		// northwest
-		if ( x > 0 && y > 0 )
-			game->tiles[x-1][y-1].nAdjacentMines++;
+	int nTiles = game->width * game->height;
+
+	// Kept-clear tiles, in row-major order
+	int nKept = 0;
+	int kept[(2*MAX_SAFE_RADIUS + 1) * (2*MAX_SAFE_RADIUS + 1)];
+	for (int j = safeY - radius; radius >= 0 && j <= safeY + radius; j++) {
+		for (int i = safeX - radius; i <= safeX + radius; i++) {
+			if (tileInBounds(game, i, j))
+				kept[nKept++] = j*game->width + i;
+		}
 	}
-	
-	// Unlock
-    pthread_mutex_unlock(&randLock);
+
+	// Draws range over [0, nAllowed); a kept-clear tile inside that range
+	// stands for one of the allowed tiles past its end instead
+	int nAllowed = nTiles - nKept;
+	int nLow = 0, low[sizeof(kept)/sizeof(kept[0])], high[sizeof(kept)/sizeof(kept[0])];
+	for (int k=0, t=nAllowed; k<nKept; k++) {
+		if (kept[k] >= nAllowed)
+			break;
+		while (t < nTiles) {
+			bool isKept = false;
+			for (int m=0; m<nKept; m++)
+				isKept |= (kept[m] == t);
+			if (!isKept)
+				break;
+			t++;
+		}
+		low[nLow] = kept[k];
+		high[nLow++] = t++;
+	}
+
+	int nPicks = game->nMines;
+	bool pickSafe = (game->nMines > nAllowed / 2);
+	if (pickSafe) {
+		nPicks = nAllowed - game->nMines;
+		for (int j=0; j<game->height; j++) {
+			size_t row = (size_t)(j+1)*game->stride;
+			for (int k=1; k<game->stride-1; k++)
+				game->mines[row + k] = rowMask(game, k);
+		}
+		for (int k=0; k<nKept; k++)
+			toggleMine(game, kept[k]);
+	}
+
+	// Take the drawn tile, or j when the draw was picked before
+	// Toggling marks a pick: sets a mine, or clears one when picking safe tiles
+	for (int j = nAllowed - nPicks; j < nAllowed; j++) {
+		int v = boundedRng(rng, j + 1);
+		int t = v;
+		for (int k=0; k<nLow; k++) {
+			if (low[k] == v)
+				t = high[k];
+		}
+		if (tileIsMine(game, t % game->width, t / game->width) != pickSafe) {
+			t = j;
+			for (int k=0; k<nLow; k++) {
+				if (low[k] == j)
+					t = high[k];
+			}
+		}
+		toggleMine(game, t);
+	}
+}
+
+
+/// isOpening
+/// Returns whether the tile at (x, y) is a zero, i.e. part of an opening
+bool isOpening(GameState* game, int x, int y)
+{
+	return (game->openings[tileWord(game, x, y)] & tileBit(x)) != 0;
+}
+
+
+/// appendTile
+/// Appends a flat tile index to list, growing it as needed
+void appendTile(TileList* list, int tile)
+{
+	if (list->count == list->capacity) {
+		list->capacity *= 2;
+		list->tiles = realloc(list->tiles, list->capacity * sizeof(int));
+		if (!list->tiles) {
+			perror("Out of memory in appendTile");
+			exit(1);
+		}
+	}
+	list->tiles[list->count++] = tile;
+}
+
+
+/// revealOne
+/// Reveals a single unrevealed safe tile and queues it on changed
+/// A misplaced flag on it is cleared
+void revealOne(GameState* game, int x, int y, TileList* changed)
+{
+	size_t word = tileWord(game, x, y);
+	game->revealed[word] |= tileBit(x);
+	game->hiddenSafe--;
+	if (game->flagged[word] & tileBit(x)) {
+		game->flagged[word] &= ~tileBit(x);
+		game->wrongFlags--;
+	}
+	appendTile(changed, y*game->width + x);
 }
 
 
 /// revealTile
-/// Assumes (x < N_TILES_X) && (y < N_TILES_Y)
-/// Sets selected tile to revealed
-/// Recursively reveals tiles if nAdjacentMines == 0
-int revealTile(GameState* game, int x, int y)
+/// Assumes (x < game->width) && (y < game->height)
+/// Sets selected tile to revealed, appending it to changed
+/// Flood fills through tiles with nAdjacentMines == 0, using changed as the queue
+int revealTile(GameState* game, int x, int y, TileList* changed)
 {
 	// Check for mine
 	if (tileIsMine(game, x, y))
@@ -129,43 +314,37 @@ int revealTile(GameState* game, int x, int y)
 	if (tileIsRevealed(game, x, y))
 		return WARNING;
 	
+	// Opening: reveal its precomputed region, which includes (x, y), in one go
+	if (game->regions != NULL && isOpening(game, x, y)) {
+		RegionIndex* index = game->regions;
+		int region = index->regionOf[y*game->width + x];
+		for (int k=index->start[region]; k<index->start[region+1]; k++) {
+			int i = index->tiles[k] % game->width;
+			int j = index->tiles[k] / game->width;
+			if (!tileIsRevealed(game, i, j))
+				revealOne(game, i, j, changed);
+		}
+		return 0;
+	}
+
 	// Reveal tile
-	game->tiles[x][y].isRevealed = true;
-	
-	// Recursively check 8-neighbours if no adjacent mines
-	// Ignore return code
-	if (game->tiles[x][y].nAdjacentMines == 0){
-		// north
-		if ( y > 0 )
-			revealTile(game, x, y-1);
-		
-		// northeast
-		if ( y > 0 && x < N_TILES_X-1 )
-			revealTile(game, x+1, y-1);
-		
-		// east
-		if ( x < N_TILES_X-1 )
-			revealTile(game, x+1, y);
-		
-		// southeast
-		if ( x < N_TILES_X-1 && y < N_TILES_Y-1 )
-			revealTile(game, x+1, y+1);
-		
-		// south
-		if ( y < N_TILES_Y-1 )
-			revealTile(game, x, y+1);
-		
-		// southwest
-		if ( y < N_TILES_Y-1 && x > 0 )
-			revealTile(game, x-1, y+1);
-		
-		// west
-		if ( x > 0 )
-			revealTile(game, x-1, y);
-		
-		// northwest
-		if ( x > 0 && y > 0 )
-			revealTile(game, x-1, y-1);
+	int head = changed->count;
+	revealOne(game, x, y, changed);
+
+	// Flood fill breadth-first through the 8-neighbours of every revealed zero
+	// Neighbours of a zero are never mines
+	for (; head < changed->count; head++) {
+		int i = changed->tiles[head] % game->width;
+		int j = changed->tiles[head] / game->width;
+		if (!isOpening(game, i, j))
+			continue;
+
+		for (int nj = (j > 0 ? j-1 : j); nj <= j+1 && nj < game->height; nj++) {
+			for (int ni = (i > 0 ? i-1 : i); ni <= i+1 && ni < game->width; ni++) {
+				if (!tileIsRevealed(game, ni, nj))
+					revealOne(game, ni, nj, changed);
+			}
+		}
 	}
 	
 	// No error
@@ -173,22 +352,270 @@ int revealTile(GameState* game, int x, int y)
 }
 
 
-/// placeFlag
-/// Places flag at the specified position
-int placeFlag(GameState* game, int x, int y)
+/// findRegion
+/// Union-find root of tile, halving the path on the way
+int findRegion(int* parent, int tile)
+{
+	while (parent[tile] != tile) {
+		parent[tile] = parent[parent[tile]];
+		tile = parent[tile];
+	}
+	return tile;
+}
+
+
+/// findOpenings
+/// Fills the openings plane: tiles that are not a mine and have no adjacent mines
+void findOpenings(GameState* game)
+{
+	uint64_t* openings = game->openings;
+	uint64_t* count = malloc(4 * game->stride * sizeof(uint64_t));
+	if (!count) {
+		perror("Out of memory in findOpenings");
+		exit(1);
+	}
+	uint64_t* slices[4] = {count, count + game->stride, count + 2*game->stride, count + 3*game->stride};
+
+	memset(openings, 0, game->planeWords * sizeof(uint64_t));
+	for (int j=0; j<game->height; j++) {
+		countAdjacentRow(game, j, slices);
+		size_t row = (size_t)(j+1)*game->stride;
+		for (int k=1; k<game->stride-1; k++) {
+			uint64_t nonZero = slices[0][k] | slices[1][k] | slices[2][k] | slices[3][k];
+			openings[row + k] = ~nonZero & ~game->mines[row + k] & rowMask(game, k);
+		}
+	}
+	free(count);
+}
+
+
+/// borderRegions
+/// Collects the distinct regions of the zero tiles around (x, y)
+/// Returns how many were found
+int borderRegions(GameState* game, int* regionOf, int x, int y, int* regions)
+{
+	int count = 0;
+	for (int nj = (y > 0 ? y-1 : y); nj <= y+1 && nj < game->height; nj++) {
+		for (int ni = (x > 0 ? x-1 : x); ni <= x+1 && ni < game->width; ni++) {
+			int region = regionOf[nj*game->width + ni];
+			if (region < 0)
+				continue;
+
+			bool seen = false;
+			for (int k=0; k<count; k++)
+				seen |= (regions[k] == region);
+			if (!seen)
+				regions[count++] = region;
+		}
+	}
+	return count;
+}
+
+
+
+/// placeNoGuess
+/// Places mines so the board can be cleared by logic alone from a random
+/// first click, which is kept clear of mines so it opens up
+/// Stuck layouts are repaired in place; only if that fails is a fresh
+/// layout drawn
+/// Returns false if none of NOGUESS_MAX_BOARDS layouts could be made solvable
+bool placeNoGuess(GameState* game, Rng* rng)
+{
+	for (int n=0; n<NOGUESS_MAX_BOARDS; n++) {
+		game->startX = boundedRng(rng, game->width);
+		game->startY = boundedRng(rng, game->height);
+		memset(game->mines, 0, game->planeWords * sizeof(uint64_t));
+		placeMines(game, rng, game->startX, game->startY, 1);
+		findOpenings(game);
+		if (makeSolvable(game, rng, game->startX, game->startY))
+			return true;
+	}
+	printf("No-guess %dx%d board with %d mines not found after %d layouts\n",
+	       game->width, game->height, game->nMines, NOGUESS_MAX_BOARDS);
+	fflush(stdout);
+	return false;
+}
+
+
+/// toggleFlag
+/// Flags the specified position, or unflags it if already flagged,
+/// keeping the flag counters
+int toggleFlag(GameState* game, int x, int y)
 {
-	// Check for flagged or revealed
-	if (tileIsFlagged(game, x, y) || tileIsRevealed(game, x, y))
+	// Check for revealed
+	if (tileIsRevealed(game, x, y))
 		return WARNING;
 	
-	// Flag tile
-	game->tiles[x][y].isFlagged = true;
+	// Flip flag, counting +1 when placed and -1 when removed
+	uint64_t* word = &game->flagged[tileWord(game, x, y)];
+	*word ^= tileBit(x);
+	int change = (*word & tileBit(x)) ? 1 : -1;
 	
-	// Check for a successful mine coverage
+	// Count against the mine coverage, or as a misplaced flag
 	if (tileIsMine(game, x, y))
-		return FLAGGED_MINE;
-	
-	// Flag placed but no hit
+		game->remainingMines -= change;
+	else
+		game->wrongFlags += change;
+	return 0;
+}
+
+
+/// checkWin
+/// Ends the game as won once every safe tile is revealed, or every mine and
+/// nothing else is flagged; constant time from the counters
+void checkWin(GameState* game)
+{
+	if (game->isOver)
+		return;
+	if (game->hiddenSafe == 0 || (game->remainingMines == 0 && game->wrongFlags == 0)) {
+		game->isOver = true;
+		game->isWon  = true;
+		game->endTime = time(0);
+	}
+}
+
+
+
+/// compareInts
+/// qsort comparator for ascending ints
+int compareInts(const void* a, const void* b)
+{
+	return *(const int*)a - *(const int*)b;
+}
+
+
+/// sortTileList
+/// Sorts tiles into row-major order, insertion sort for typical small moves
+void sortTileList(TileList* list)
+{
+	// Region reveals arrive sorted already
+	int sorted = 1;
+	while (sorted < list->count && list->tiles[sorted-1] < list->tiles[sorted])
+		sorted++;
+	if (sorted >= list->count)
+		return;
+
+	if (list->count > 64) {
+		qsort(list->tiles, list->count, sizeof(int), compareInts);
+		return;
+	}
+
+	for (int i=1; i<list->count; i++) {
+		int tile = list->tiles[i];
+		int j = i;
+		while (j > 0 && list->tiles[j-1] > tile) {
+			list->tiles[j] = list->tiles[j-1];
+			j--;
+		}
+		list->tiles[j] = tile;
+	}
+}
+
+
+/// encodeChanged
+/// Encodes every tile changed by the current moves into reply, once each and
+/// row by row so they encode as runs
+/// Returns the number of tiles encoded
+int encodeChanged(GameState* game, TileEncoder* reply)
+{
+	TileList* changed = &game->changed;
+	sortTileList(changed);
+	for (int k=0; k<changed->count; k++) {
+		if (k > 0 && changed->tiles[k] == changed->tiles[k-1])
+			continue; // changed by more than one move of a batch
+		int i = changed->tiles[k] % game->width;
+		int j = changed->tiles[k] / game->width;
+		if (tileIsFlagged(game, i, j))
+			encodeTile(reply, i, j, 9, true, tileIsMine(game,i,j)); // note impossible 9 adjacent mines
+		else if (!tileIsRevealed(game, i, j))
+			encodeTile(reply, i, j, TILE_HIDDEN_COUNT, false, false); // unflagged
+		else
+			encodeTile(reply, i, j, tileAdjacentMines(game,i,j), tileIsFlagged(game,i,j), tileIsMine(game,i,j));
+	}
+	return finishTiles(reply);
+}
+
+
+/// revealMove
+/// Reveals (x, y) onto game->changed, placing deferred mines first
+/// Returns 0, MINE_HIT (ending the game), or WARNING
+int revealMove(GameState* game, int x, int y)
+{
+	// Off the board
+	if (!tileInBounds(game, x, y))
+		return WARNING;
+
+	// First reveal, lay the board out around it
+	if (!game->minesPlaced)
+		placeFirstMines(game, x, y);
+
+	// Reveal tile, recording each newly revealed tile
+	int err = revealTile(game, x, y, &game->changed);
+
+	// Mine hit!
+	if (err == MINE_HIT){
+		game->isOver = true;
+		game->endTime = time(0);
+	}
+	else if (err == 0) {
+		checkWin(game);
+	}
+	return err;
+}
+
+
+/// chordMove
+/// Reveals the unflagged neighbours of the revealed tile at (x, y) onto
+/// game->changed, if its flags match its number
+/// Returns 0, MINE_HIT (ending the game), or WARNING if nothing was revealed
+int chordMove(GameState* game, int x, int y)
+{
+	// Off the board, unrevealed, or flags not matching the number
+	if (!tileInBounds(game, x, y) || !tileIsRevealed(game, x, y) ||
+	    tileAdjacentFlags(game, x, y) != tileAdjacentMines(game, x, y))
+		return WARNING;
+
+	// Reveal every unflagged neighbour
+	TileList* changed = &game->changed;
+	int before = changed->count;
+	for (int j = (y > 0 ? y-1 : y); j <= y+1 && j < game->height; j++) {
+		for (int i = (x > 0 ? x-1 : x); i <= x+1 && i < game->width; i++) {
+			if (tileIsFlagged(game, i, j) || tileIsRevealed(game, i, j))
+				continue;
+
+			// Mine hit! A flag was misplaced
+			if (revealTile(game, i, j, changed) == MINE_HIT) {
+				game->isOver = true;
+				game->endTime = time(0);
+				return MINE_HIT;
+			}
+		}
+	}
+
+	// Nothing left to reveal
+	if (changed->count == before)
+		return WARNING;
+
+	checkWin(game);
+	return 0;
+}
+
+
+/// flagMove
+/// Flags or unflags (x, y) onto game->changed, ending the game once won
+/// Returns 0, or WARNING (also before the first reveal)
+int flagMove(GameState* game, int x, int y)
+{
+	// Off the board, or nothing to flag before the first reveal
+	if (!tileInBounds(game, x, y) || !game->minesPlaced)
+		return WARNING;
+
+	// Tile revealed
+	if (toggleFlag(game, x, y) == WARNING)
+		return WARNING;
+	appendTile(&game->changed, y*game->width + x);
+
+	checkWin(game);
 	return 0;
 }
 
@@ -196,136 +623,468 @@ int placeFlag(GameState* game, int x, int y)
 
 /* Public functions */
 /// initGame
-/// Sets up a new GameState structure, including mine placement
-void initGame(GameState* game)
+/// Sets up a new GameState structure sized by config
+/// Mines are placed on the first reveal, except on no-guess boards
+/// Any previous game in the structure must have been released with freeGame
+/// Returns false, leaving the game freed, if no no-guess layout was found
+bool initGame(GameState* game, const BoardConfig* config)
+{
+	return initGameFromSeed(game, config, newGameSeed());
+}
+
+
+/// initGameFromSeed
+/// As initGame, seeding mine placement with a given seed rather than a new one
+/// The same config, seed and first reveal always produce the same board
+bool initGameFromSeed(GameState* game, const BoardConfig* config, uint64_t seed)
 {
 	// Set defaults
+	game->seed = seed;
+	game->minesPlaced = false;
+	game->noGuess = config->noGuess;
+	game->startX = game->startY = -1;
+	game->width = config->width;
+	game->height = config->height;
+	game->nMines = config->nMines;
 	game->isOver = false;
 	game->isWon = false;
-	game->remainingMines = N_MINES;
+	game->remainingMines = config->nMines;
+	game->wrongFlags = 0;
+	game->hiddenSafe = config->width * config->height - config->nMines;
 	game->startTime = time(0);
 	game->endTime = 0;
+	game->regions = NULL;
+	game->borrowed = false;
 	
-	// Set default tiles
-	for (int i=0; i<N_TILES_X; i++) {
-		for (int j=0; j<N_TILES_Y; j++) {
-			game->tiles[i][j] = (Tile){0, false, false, false}; //c99 shorthand
-		}
+	// Allocate cleared bit planes, and the scratch list for reveals
+	int nTiles = game->width * game->height;
+	game->stride = (game->width + 63) / 64 + 2;
+	game->planeWords = (size_t)(game->height + 2) * game->stride;
+	game->mines = calloc(4 * game->planeWords, sizeof(uint64_t));
+	game->revealed = game->mines + game->planeWords;
+	game->flagged = game->mines + 2*game->planeWords;
+	game->openings = game->mines + 3*game->planeWords;
+	game->changed.capacity = 64;
+	game->changed.tiles = malloc(game->changed.capacity * sizeof(int));
+	game->changed.count = 0;
+	if (!game->mines || !game->changed.tiles) {
+		perror("Out of memory in initGame");
+		exit(1);
 	}
 	
-	// Place mines
-	placeMines(game);
+	// No-guess boards are laid out around their start tile now, the rest
+	// wait for the first reveal
+	if (game->noGuess) {
+		Rng rng;
+		seedRng(&rng, seed);
+		if (!placeNoGuess(game, &rng)) {
+			freeGame(game); // never played as no-guess when it needs a guess
+			return false;
+		}
+		game->minesPlaced = true;
+
+		// Index openings of large boards
+		if (nTiles >= REGION_INDEX_MIN_TILES)
+			buildRegionIndex(game);
+	}
+	return true;
 }
 
 
-/// requestReveal
-/// Requests a tile reveal
-/// Assumes reply has been cleared with "memset(reply, 0, sizeof(reply)/sizeof(char))"
-/// Assumes reply is large enough to host message for multiple tile reveals
-int requestReveal(GameState* game, int x, int y, char* reply)
+/// initGameOnBoard
+/// Sets up a new game on the mine layout of board, whose mines must already
+/// be placed; only the revealed and flagged planes are the game's own, the
+/// rest is read from board, which must not change or be freed before it
+/// Any previous game in the structure must have been released with freeGame
+void initGameOnBoard(GameState* game, const GameState* board)
 {
-	// Clone GameState
-	GameState oldGame = *game;
-	
-	// Reveal tile
-	int err = revealTile(game, x, y);
-	
-	// Mine hit!
-	if (err == MINE_HIT){
-		game->isOver = true;
-		game->endTime = time(0);
-		return 0; // game over
+	// Same layout, fresh counters
+	*game = *board;
+	game->isOver = false;
+	game->isWon = false;
+	game->remainingMines = board->nMines;
+	game->wrongFlags = 0;
+	game->hiddenSafe = board->width * board->height - board->nMines;
+	game->startTime = time(0);
+	game->endTime = 0;
+	game->borrowed = true;
+
+	// Own cleared revealed and flagged planes, and the scratch list
+	game->revealed = calloc(2 * game->planeWords, sizeof(uint64_t));
+	game->flagged = game->revealed + game->planeWords;
+	game->changed.capacity = 64;
+	game->changed.tiles = malloc(game->changed.capacity * sizeof(int));
+	game->changed.count = 0;
+	if (!game->revealed || !game->changed.tiles) {
+		perror("Out of memory in initGameOnBoard");
+		exit(1);
 	}
-	
-	// Already revealed
-	if (err == WARNING){
-		sprintf(reply, "error");
-		return 6;
+}
+
+
+/// placeFirstMines
+/// Places the mines initGame deferred, keeping (x, y) clear along with its
+/// neighbours within FIRST_CLICK_RADIUS when the mine count leaves room
+/// An off-board (x, y) keeps nothing clear
+void placeFirstMines(GameState* game, int x, int y)
+{
+	int nTiles = game->width * game->height;
+	int radius = -1;
+	if (tileInBounds(game, x, y)) {
+		// Clipped neighbourhood size, dense boards only keep the tile itself
+		radius = FIRST_CLICK_RADIUS;
+		int columns = (x + radius < game->width ? x + radius : game->width - 1) - (x > radius ? x - radius : 0) + 1;
+		int rows = (y + radius < game->height ? y + radius : game->height - 1) - (y > radius ? y - radius : 0) + 1;
+		if (game->nMines > nTiles - columns * rows)
+			radius = 0;
 	}
-	
-	// Compose message of all newly revealed tiles
-	int replyLen = 0;
-	char buffer[13]; // t,<x>,<y>,<n>,<flagged>,<mine>,
-	for (int i=0; i<N_TILES_X; i++) {
-		for (int j=0; j<N_TILES_Y; j++) {
-			if (!tileIsRevealed(&oldGame,i,j) && tileIsRevealed(game,i,j)) {
-				// Format tile data
-				memset(buffer, 0, sizeof(buffer)/sizeof(char));
-				sprintf(buffer, "t,%d,%d,%d,%d,%d,", i, j, tileAdjacentMines(game,i,j), tileIsFlagged(game,i,j), tileIsMine(game,i,j));
-				replyLen += strlen(buffer);
-				
-				// Append to the reply
-				strcat(reply, buffer);
+
+	Rng rng;
+	seedRng(&rng, game->seed);
+	placeMines(game, &rng, x, y, radius);
+	findOpenings(game);
+	game->minesPlaced = true;
+
+	// Index openings of large boards
+	if (nTiles >= REGION_INDEX_MIN_TILES)
+		buildRegionIndex(game);
+}
+
+
+/// freeGame
+/// Deallocates the heap storage of a GameState set up by initGame
+/// Safe to call on a zeroed GameState
+void freeGame(GameState* game)
+{
+	if (game->borrowed) {
+		free(game->revealed); // the game's own planes, see initGameOnBoard
+		game->regions = NULL;
+		game->borrowed = false;
+	}
+	else {
+		freeRegionIndex(game);
+		free(game->mines);
+	}
+	free(game->changed.tiles);
+	game->mines = game->revealed = game->flagged = game->openings = NULL;
+	game->changed.tiles = NULL;
+}
+
+
+/// presetConfig
+/// Returns the board configuration of a difficulty preset
+BoardConfig presetConfig(Difficulty difficulty)
+{
+	switch (difficulty) {
+		case INTERMEDIATE:
+			return (BoardConfig){.difficulty = INTERMEDIATE, .width = 16, .height = 16, .nMines = 40, .noGuess = false};
+		case EXPERT:
+			return (BoardConfig){.difficulty = EXPERT, .width = 30, .height = 16, .nMines = 99, .noGuess = false};
+		case BEGINNER:
+		default:
+			return (BoardConfig){.difficulty = BEGINNER, .width = 9, .height = 9, .nMines = 10, .noGuess = false};
+	}
+}
+
+
+/// validConfig
+/// Returns whether a board can be set up as configured
+bool validConfig(const BoardConfig* config)
+{
+	// Bounds first, so the tile count cannot overflow
+	if (config->width <= 0 || config->width > MAX_BOARD_SIZE ||
+	    config->height <= 0 || config->height > MAX_BOARD_SIZE)
+		return false;
+
+	int nTiles = config->width * config->height;
+	if (config->noGuess && nTiles > NOGUESS_MAX_TILES)
+		return false;
+	if (config->noGuess && config->nMines > nTiles * NOGUESS_MAX_DENSITY / 100)
+		return false; // also leaves room for the opening around the first click
+	return config->nMines > 0 && config->nMines < nTiles;
+}
+
+
+/// tileInBounds
+/// Returns whether (x, y) lies on the board
+bool tileInBounds(GameState* game, int x, int y)
+{
+	return x >= 0 && x < game->width && y >= 0 && y < game->height;
+}
+
+
+/// buildRegionIndex
+/// Groups connected openings so revealing one becomes a lookup
+/// initGame calls this for boards of at least REGION_INDEX_MIN_TILES
+void buildRegionIndex(GameState* game)
+{
+	int nTiles = game->width * game->height;
+	RegionIndex* index = malloc(sizeof(RegionIndex));
+	int* parent = malloc(nTiles * sizeof(int));
+	if (!index || !parent) {
+		perror("Out of memory in buildRegionIndex");
+		exit(1);
+	}
+	index->regionOf = malloc(nTiles * sizeof(int));
+	if (!index->regionOf) {
+		perror("Out of memory in buildRegionIndex");
+		exit(1);
+	}
+
+	// Union each zero with the zeros east, southwest, south and southeast,
+	// which covers every 8-neighbour pair exactly once
+	for (int t=0; t<nTiles; t++)
+		parent[t] = t;
+	for (int j=0; j<game->height; j++) {
+		for (int i=0; i<game->width; i++) {
+			if (!isOpening(game, i, j))
+				continue;
+
+			int neighbours[4][2] = {{i+1, j}, {i-1, j+1}, {i, j+1}, {i+1, j+1}};
+			for (int k=0; k<4; k++) {
+				int ni = neighbours[k][0], nj = neighbours[k][1];
+				if (ni < 0 || ni >= game->width || nj >= game->height || !isOpening(game, ni, nj))
+					continue;
+
+				int a = findRegion(parent, j*game->width + i);
+				int b = findRegion(parent, nj*game->width + ni);
+				if (a != b)
+					parent[a > b ? a : b] = (a > b ? b : a);
 			}
 		}
 	}
-	
-	// Replace last , with 0
-	reply[replyLen-1] = 0;
 
-	return replyLen;
+	// Number regions by root, in row-major order of their first tile
+	index->nRegions = 0;
+	for (int t=0; t<nTiles; t++) {
+		index->regionOf[t] = -1;
+		if (isOpening(game, t % game->width, t / game->width)) {
+			int root = findRegion(parent, t);
+			index->regionOf[t] = (root == t) ? index->nRegions++ : index->regionOf[root];
+		}
+	}
+	free(parent);
+
+	// Count members: zeros, then each border tile once per region it touches
+	int regions[8];
+	index->start = calloc(index->nRegions + 1, sizeof(int));
+	if (!index->start) {
+		perror("Out of memory in buildRegionIndex");
+		exit(1);
+	}
+	for (int t=0; t<nTiles; t++) {
+		int i = t % game->width, j = t / game->width;
+		if (index->regionOf[t] >= 0) {
+			index->start[index->regionOf[t] + 1]++;
+		}
+		else if (!tileIsMine(game, i, j)) {
+			int count = borderRegions(game, index->regionOf, i, j, regions);
+			for (int k=0; k<count; k++)
+				index->start[regions[k] + 1]++;
+		}
+	}
+	for (int r=0; r<index->nRegions; r++)
+		index->start[r+1] += index->start[r];
+
+	// Fill member lists, in row-major order within each region
+	int* fill = malloc((index->nRegions + 1) * sizeof(int));
+	index->tiles = malloc((index->start[index->nRegions] + 1) * sizeof(int));
+	if (!fill || !index->tiles) {
+		perror("Out of memory in buildRegionIndex");
+		exit(1);
+	}
+	memcpy(fill, index->start, (index->nRegions + 1) * sizeof(int));
+	for (int t=0; t<nTiles; t++) {
+		int i = t % game->width, j = t / game->width;
+		if (index->regionOf[t] >= 0) {
+			index->tiles[fill[index->regionOf[t]]++] = t;
+		}
+		else if (!tileIsMine(game, i, j)) {
+			int count = borderRegions(game, index->regionOf, i, j, regions);
+			for (int k=0; k<count; k++)
+				index->tiles[fill[regions[k]]++] = t;
+		}
+	}
+	free(fill);
+
+	game->regions = index;
 }
 
 
-/// requestFlag
-/// Requests a flag placement
-/// Assumes reply has been cleared with "memset(reply, 0, sizeof(reply)/sizeof(char))"
-int requestFlag(GameState* game, int x, int y, char* reply)
+/// freeRegionIndex
+/// Deallocates the opening index, flood fills then search neighbours instead
+void freeRegionIndex(GameState* game)
 {
-	// Place flag
-	int err = placeFlag(game, x, y);
-	
-	// Tile revealed or flag aready placed
-	if (err == WARNING){
-		sprintf(reply, "error");
-		return 6; // warn player the tile is already revealed
+	if (game->regions == NULL)
+		return;
+
+	free(game->regions->regionOf);
+	free(game->regions->start);
+	free(game->regions->tiles);
+	free(game->regions);
+	game->regions = NULL;
+}
+
+
+/// moveMine
+/// Moves the mine at (fromX, fromY) to the safe tile (toX, toY), updating
+/// the openings around both; the region index is not updated
+void moveMine(GameState* game, int fromX, int fromY, int toX, int toY)
+{
+	toggleMine(game, fromY*game->width + fromX);
+	toggleMine(game, toY*game->width + toX);
+
+	int ends[2][2] = {{fromX, fromY}, {toX, toY}};
+	for (int e=0; e<2; e++) {
+		for (int j = ends[e][1] - 1; j <= ends[e][1] + 1; j++) {
+			for (int i = ends[e][0] - 1; i <= ends[e][0] + 1; i++) {
+				if (!tileInBounds(game, i, j))
+					continue;
+				uint64_t* word = &game->openings[tileWord(game, i, j)];
+				if (!tileIsMine(game, i, j) && tileAdjacentMines(game, i, j) == 0)
+					*word |= tileBit(i);
+				else
+					*word &= ~tileBit(i);
+			}
+		}
 	}
-	
-	// Check for successful flag on mine
-	if (err == FLAGGED_MINE){
-		--(game->remainingMines);
-		
-		// Win condition
-		if (game->remainingMines == 0) {
-			game->isOver = true;
-			game->isWon  = true;
-			game->endTime = time(0);
-			return 0;
+}
+
+
+/// requestReveal
+/// Requests a tile reveal, encoding every newly revealed tile into reply
+/// Returns the number of tiles encoded, the last safe tile's too (see isWon),
+/// 0 if a mine was hit, or WARNING
+int requestReveal(GameState* game, int x, int y, TileEncoder* reply)
+{
+	game->changed.count = 0;
+	int err = revealMove(game, x, y);
+	if (game->isOver && !game->isWon)
+		return 0; // mine hit
+	if (err == WARNING)
+		return WARNING;
+
+	return encodeChanged(game, reply);
+}
+
+
+/// requestChord
+/// Requests a chord on the revealed tile at (x, y): once as many of its
+/// neighbours are flagged as it has adjacent mines, every other unrevealed
+/// neighbour is revealed, flood fills included, and encoded into reply
+/// Returns the number of tiles encoded, the last safe tile's too (see isWon),
+/// 0 if a mine was hit, or WARNING
+int requestChord(GameState* game, int x, int y, TileEncoder* reply)
+{
+	game->changed.count = 0;
+	int err = chordMove(game, x, y);
+	if (game->isOver && !game->isWon)
+		return 0; // mine hit
+	if (err == WARNING)
+		return WARNING;
+
+	return encodeChanged(game, reply);
+}
+
+
+/// requestFlag
+/// Requests a flag placement, or its removal from a flagged tile, encoding
+/// the tile into reply
+/// Returns 1, 0 if the game was won, or WARNING (also before the first reveal)
+int requestFlag(GameState* game, int x, int y, TileEncoder* reply)
+{
+	game->changed.count = 0;
+	if (flagMove(game, x, y) == WARNING)
+		return WARNING; // warn player the tile is revealed
+
+	// Win condition
+	if (game->isWon)
+		return 0;
+
+	return encodeChanged(game, reply);
+}
+
+
+/// requestMoves
+/// Applies a batch of moves in order, encoding every tile they change into
+/// one reply; moves that would be refused alone are skipped
+/// Stops at the first move that ends the game
+/// Returns the number of tiles encoded, those of a winning move too (see
+/// isWon), 0 if a mine was hit, or WARNING if no move changed anything
+int requestMoves(GameState* game, const Move* moves, int nMoves, TileEncoder* reply)
+{
+	game->changed.count = 0;
+	for (int m=0; m<nMoves && !game->isOver; m++) {
+		switch (moves[m].type) {
+			case MOVE_REVEAL:
+				revealMove(game, moves[m].x, moves[m].y);
+				break;
+			case MOVE_FLAG:
+				flagMove(game, moves[m].x, moves[m].y);
+				break;
+			case MOVE_CHORD:
+				chordMove(game, moves[m].x, moves[m].y);
+				break;
 		}
 	}
 
-	// Compose message indicating flagged tile
-	sprintf(reply, "t,%d,%d,9,1,%d", x, y, tileIsMine(game, x, y)); // note impossible 9 adjacent mines
-	reply[12] = 0;
-	return strlen(reply);
+	if (game->isOver && !game->isWon)
+		return 0; // mine hit
+	if (game->changed.count == 0)
+		return WARNING;
+
+	return encodeChanged(game, reply);
 }
 
 
 /// requestAllTiles
 /// Requests every tile be revealed
-/// Assumes reply has been cleared with "memset(reply, 0, sizeof(reply)/sizeof(char))"
-/// Assumes reply is large enough to host message for multiple tile reveals
-int requestAllTiles(GameState* game, char* reply)
-{
-	// Compose message of all revealed tiles
-	int replyLen = 0;
-	char buffer[13]; // t,<x>,<y>,<n>,<flagged>,<mine>,
-	for (int i=0; i<N_TILES_X; i++) {
-		for (int j=0; j<N_TILES_Y; j++) {
-			// Format tile data
-			memset(buffer, 0, sizeof(buffer)/sizeof(char));
-			sprintf(buffer, "t,%d,%d,%d,%d,%d,", i, j, tileAdjacentMines(game,i,j), tileIsFlagged(game,i,j), tileIsMine(game,i,j));
-			replyLen += strlen(buffer);
-			
-			// Append to the reply
-			strcat(reply, buffer);
+/// Returns the number of tiles encoded into reply
+int requestAllTiles(GameState* game, TileEncoder* reply)
+{
+	uint64_t* count = malloc(4 * game->stride * sizeof(uint64_t));
+	if (!count) {
+		perror("Out of memory in requestAllTiles");
+		exit(1);
+	}
+	uint64_t* slices[4] = {count, count + game->stride, count + 2*game->stride, count + 3*game->stride};
+
+	// Compose message of all tiles, row by row, counting a row's mines at once
+	for (int j=0; j<game->height; j++) {
+		countAdjacentRow(game, j, slices);
+		size_t row = (size_t)(j+1)*game->stride;
+		for (int i=0; i<game->width; i++) {
+			int k = 1 + (i >> 6), bit = i & 63;
+			int n = (int)((slices[0][k] >> bit) & 1) | (int)((slices[1][k] >> bit) & 1) << 1 |
+			        (int)((slices[2][k] >> bit) & 1) << 2 | (int)((slices[3][k] >> bit) & 1) << 3;
+			encodeTile(reply, i, j, n, (game->flagged[row + k] >> bit) & 1, (game->mines[row + k] >> bit) & 1);
 		}
 	}
-	
-	// Replace last , with 0
-	reply[replyLen-1] = 0;
+	free(count);
+
+	return finishTiles(reply);
+}
+
 
-	return replyLen;
+/// requestVisibleTiles
+/// Requests every revealed or flagged tile, encoded as the moves that
+/// changed them were
+/// Returns the number of tiles encoded into reply
+int requestVisibleTiles(GameState* game, TileEncoder* reply)
+{
+	for (int j=0; j<game->height; j++) {
+		size_t row = (size_t)(j+1)*game->stride;
+		for (int k=1; k<game->stride-1; k++) {
+			for (uint64_t bits = game->revealed[row + k] | game->flagged[row + k]; bits != 0; bits &= bits - 1) {
+				int i = ((k-1) << 6) + __builtin_ctzll(bits);
+				if (tileIsFlagged(game, i, j))
+					encodeTile(reply, i, j, 9, true, tileIsMine(game,i,j));
+				else
+					encodeTile(reply, i, j, tileAdjacentMines(game,i,j), false, false);
+			}
+		}
+	}
+	return finishTiles(reply);
 }
 
 
@@ -13,69 +13,284 @@
 /* Includes */
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
+#include "tilecodec.h"
+#include "rng.h"
 
 
 /* Defines */
-#define N_TILES_X 9
-#define N_TILES_Y 9
-#define N_MINES   10
+#define MAX_BOARD_SIZE 1000 // largest custom width or height
+#define REGION_INDEX_MIN_TILES 1024 // smaller boards flood fill without an opening index
+#define MAX_SAFE_RADIUS 1 // largest neighbourhood placeMines can keep clear
+#define FIRST_CLICK_RADIUS 1 // kept clear around the first reveal, 0 for the tile alone
+#define NOGUESS_MAX_DENSITY 25 // percent of tiles, denser no-guess boards are refused
+#define NOGUESS_MAX_TILES (100*100) // larger no-guess boards take seconds to lay out, so are refused
+#define NOGUESS_MAX_BOARDS 64 // fresh layouts tried before a no-guess board is given up on
 #define WARNING   -1
 #define MINE_HIT  -2
-#define FLAGGED_MINE   1
 
 
 /* Types */
-/// Tile structure
+/// Difficulty presets
+typedef enum {BEGINNER, INTERMEDIATE, EXPERT, CUSTOM} Difficulty;
+
+
+/// BoardConfig structure
+/// Board dimensions chosen at game start
+typedef struct
+{
+	Difficulty difficulty;
+	int width;
+	int height;
+	int nMines;
+	bool noGuess; // solvable by logic alone from a designated first click
+} BoardConfig;
+
+
+/// Move types of a batch
+typedef enum {MOVE_REVEAL, MOVE_FLAG, MOVE_CHORD} MoveType;
+
+
+/// Move structure
+/// One reveal, flag or chord of a batch
+typedef struct
+{
+	MoveType type;
+	int x;
+	int y;
+} Move;
+
+
+/// TileList structure
+/// Flat indices (y*width + x) of the tiles changed by a single move or batch
+typedef struct
+{
+	int count;
+	int capacity;
+	int* tiles; // grown on demand, up to every tile of the board
+} TileList;
+
+
+/// RegionIndex structure
+/// Openings precomputed with union-find: every connected group of
+/// zero tiles plus the numbered tiles bordering it, listed per region
 typedef struct
 {
-	int nAdjacentMines;
-	bool isRevealed;
-	bool isMine;
-	bool isFlagged;
-} Tile;
+	int nRegions;
+	int* regionOf; // region of each zero tile, -1 for other tiles
+	int* start;    // region r lists tiles[start[r]] .. tiles[start[r+1]-1]
+	int* tiles;
+} RegionIndex;
 
 
 /// GameState structure
+/// Mine, revealed and flagged state are bit planes, one bit per tile
+/// Each plane has height+2 rows of stride words: a zero guard row above and
+/// below the board, and a zero guard word at each end of every row, so
+/// neighbours can be read by shifting whole words without bounds checks
+/// Adjacent mine counts are not stored, they are summed from the mine plane;
+/// only whether a tile has none is kept, as the openings plane
+/// Every move keeps the flag and safe tile counters current, so a win is
+/// detected without scanning the board
 typedef struct
 {
 	bool isOver;
 	bool isWon;
-	int remainingMines;
+	int remainingMines;   // mines not yet flagged
+	int wrongFlags;       // flags on safe tiles
+	int hiddenSafe;       // safe tiles not yet revealed
 	time_t startTime;
 	time_t endTime;
-	Tile tiles[N_TILES_X][N_TILES_Y];
+	int width;
+	int height;
+	int nMines;
+	uint64_t seed;        // mine layout seed, replays the board with the same first reveal
+	bool minesPlaced;     // false until the first reveal, see placeFirstMines
+	bool noGuess;
+	int startX;           // designated first click of no-guess boards, -1 otherwise
+	int startY;
+	int stride;           // words per plane row, including the two guard words
+	size_t planeWords;    // words per plane
+	uint64_t* mines;      // one allocation holding all four planes
+	uint64_t* revealed;
+	uint64_t* flagged;
+	uint64_t* openings;   // not a mine and no adjacent mines
+	TileList changed;     // scratch: tiles changed by the current moves, also the flood fill queue
+	RegionIndex* regions; // optional opening index, NULL if not built
+	bool borrowed;        // mines, openings and regions belong to another game, see initGameOnBoard
 } GameState;
 
 
 /* Public function prototypes */
 /// initGame
-/// Sets up a new GameState structure, including mine placement
-void initGame(GameState* game);
+/// Sets up a new GameState structure sized by config
+/// Mines are placed on the first reveal, except on no-guess boards
+/// Any previous game in the structure must have been released with freeGame
+/// Returns false, leaving the game freed, if no no-guess layout was found
+bool initGame(GameState* game, const BoardConfig* config);
+
+
+/// initGameFromSeed
+/// As initGame, seeding mine placement with a given seed rather than a new one
+/// The same config, seed and first reveal always produce the same board
+bool initGameFromSeed(GameState* game, const BoardConfig* config, uint64_t seed);
+
+
+/// initGameOnBoard
+/// Sets up a new game on the mine layout of board, whose mines must already
+/// be placed; only the revealed and flagged planes are the game's own, the
+/// rest is read from board, which must not change or be freed before it
+/// Any previous game in the structure must have been released with freeGame
+void initGameOnBoard(GameState* game, const GameState* board);
+
+
+/// placeFirstMines
+/// Places the mines initGame deferred, keeping (x, y) clear along with its
+/// neighbours within FIRST_CLICK_RADIUS when the mine count leaves room
+/// An off-board (x, y) keeps nothing clear
+void placeFirstMines(GameState* game, int x, int y);
+
+
+/// freeGame
+/// Deallocates the heap storage of a GameState set up by initGame
+/// Safe to call on a zeroed GameState
+void freeGame(GameState* game);
+
+
+/// presetConfig
+/// Returns the board configuration of a difficulty preset
+BoardConfig presetConfig(Difficulty difficulty);
+
+
+/// validConfig
+/// Returns whether a board can be set up as configured
+bool validConfig(const BoardConfig* config);
+
+
+/// tileInBounds
+/// Returns whether (x, y) lies on the board
+bool tileInBounds(GameState* game, int x, int y);
+
+
+/// buildRegionIndex
+/// Groups connected openings so revealing one becomes a lookup
+/// initGame calls this for boards of at least REGION_INDEX_MIN_TILES
+void buildRegionIndex(GameState* game);
+
+
+/// freeRegionIndex
+/// Deallocates the opening index, flood fills then search neighbours instead
+void freeRegionIndex(GameState* game);
+
+
+/// tileIsMine, tileIsRevealed, tileIsFlagged, tileAdjacentMines
+/// Tile accessors, for (x < game->width) && (y < game->height)
+bool tileIsMine(GameState* game, int x, int y);
+bool tileIsRevealed(GameState* game, int x, int y);
+bool tileIsFlagged(GameState* game, int x, int y);
+int tileAdjacentMines(GameState* game, int x, int y);
+
+
+/// moveMine
+/// Moves the mine at (fromX, fromY) to the safe tile (toX, toY), updating
+/// the openings around both; the region index is not updated
+void moveMine(GameState* game, int fromX, int fromY, int toX, int toY);
 
 
 /// requestReveal
-/// Requests a tile reveal
-/// Assumes reply has been cleared with "memset(reply, 0, sizeof(reply)/sizeof(char))"
-/// Assumes reply is large enough to host message for multiple tile reveals
-int requestReveal(GameState* game, int x, int y, char* reply);
+/// Requests a tile reveal, encoding every newly revealed tile into reply
+/// Returns the number of tiles encoded, the last safe tile's too (see isWon),
+/// 0 if a mine was hit, or WARNING
+int requestReveal(GameState* game, int x, int y, TileEncoder* reply);
+
+
+/// requestChord
+/// Requests a chord on the revealed tile at (x, y): once as many of its
+/// neighbours are flagged as it has adjacent mines, every other unrevealed
+/// neighbour is revealed, flood fills included, and encoded into reply
+/// Returns the number of tiles encoded, the last safe tile's too (see isWon),
+/// 0 if a mine was hit, or WARNING
+int requestChord(GameState* game, int x, int y, TileEncoder* reply);
 
 
 /// requestFlag
-/// Requests a flag placement
-/// Assumes reply has been cleared with "memset(reply, 0, sizeof(reply)/sizeof(char))"
-int requestFlag(GameState* game, int x, int y, char* reply);
+/// Requests a flag placement, or its removal from a flagged tile, encoding
+/// the tile into reply
+/// Returns 1, 0 if the game was won, or WARNING (also before the first reveal)
+int requestFlag(GameState* game, int x, int y, TileEncoder* reply);
+
+
+/// requestMoves
+/// Applies a batch of moves in order, encoding every tile they change into
+/// one reply; moves that would be refused alone are skipped
+/// Stops at the first move that ends the game
+/// Returns the number of tiles encoded, those of a winning move too (see
+/// isWon), 0 if a mine was hit, or WARNING if no move changed anything
+int requestMoves(GameState* game, const Move* moves, int nMoves, TileEncoder* reply);
 
 
 /// requestAllTiles
 /// Requests every tile be revealed
-/// Assumes reply has been cleared with "memset(reply, 0, sizeof(reply)/sizeof(char))"
-/// Assumes reply is large enough to host message for multiple tile reveals
-int requestAllTiles(GameState* game, char* reply);
+/// Returns the number of tiles encoded into reply
+int requestAllTiles(GameState* game, TileEncoder* reply);
+
+
+/// requestVisibleTiles
+/// Requests every revealed or flagged tile, encoded as the moves that
+/// changed them were
+/// Returns the number of tiles encoded into reply
+int requestVisibleTiles(GameState* game, TileEncoder* reply);
 
 
 /// forceWin
 /// Triggers a game won response (hack, or play-testing)
 void forceWin(GameState* game);
 
+
+
+/* Internal function prototypes, for server/shared.c and the benchmarks */
+/// tileWord
+/// Assumes (x < game->width) && (y < game->height)
+/// Returns the index of the word holding tile (x, y) in each bit plane
+size_t tileWord(GameState* game, int x, int y);
+
+
+/// tileBit
+/// Returns the mask of tile column x within its plane word
+uint64_t tileBit(int x);
+
+
+/// isOpening
+/// Returns whether the tile at (x, y) is a zero, i.e. part of an opening
+bool isOpening(GameState* game, int x, int y);
+
+
+/// appendTile
+/// Appends a flat tile index to list, growing it as needed
+void appendTile(TileList* list, int tile);
+
+
+/// sortTileList
+/// Sorts tiles into row-major order, insertion sort for typical small moves
+void sortTileList(TileList* list);
+
+
+/// revealTile
+/// Assumes (x < game->width) && (y < game->height)
+/// Sets selected tile to revealed, appending it to changed
+/// Flood fills through tiles with nAdjacentMines == 0, using changed as the queue
+int revealTile(GameState* game, int x, int y, TileList* changed);
+
+
+/// placeMines
+/// Randomly sets game->nMines game tiles to be mines, drawn from rng
+/// Tiles within radius of (safeX, safeY) are kept clear, none if radius < 0
+void placeMines(GameState* game, Rng* rng, int safeX, int safeY, int radius);
+
+
+/// findOpenings
+/// Fills the openings plane: tiles that are not a mine and have no adjacent mines
+void findOpenings(GameState* game);
+
 #endif
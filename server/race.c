@@ -0,0 +1,138 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * server/race.c
+ * Server-side boards of head-to-head races
+ * Races on the same preset and seed share one board, looked up by seed in
+ * a list of the boards in use; each player's game holds only its own
+ * revealed and flagged planes on top
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    6/11/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Includes */
+#include "race.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "boardpool.h"
+
+
+/* Defines */
+static RaceBoard* raceBoards = NULL; // boards held by at least one race
+static int nRaceBoards = 0;
+static pthread_mutex_t raceBoardLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Private functions */
+/// findRaceBoard
+/// Returns the board of a preset and seed, taking a reference, or NULL
+/// The caller holds raceBoardLock
+RaceBoard* findRaceBoard(Difficulty difficulty, uint64_t seed)
+{
+	for (RaceBoard* race = raceBoards; race != NULL; race = race->next) {
+		if (race->difficulty == difficulty && race->board.seed == seed) {
+			race->refs++;
+			return race;
+		}
+	}
+	return NULL;
+}
+
+
+
+/* Public functions */
+/// acquireRaceBoard
+/// Returns the board of a no-guess preset with the given seed, laying it out
+/// unless a race already holds it, or a fresh board from the pool if seed is 0
+/// Returns NULL if no no-guess layout was found
+RaceBoard* acquireRaceBoard(Difficulty difficulty, uint64_t seed)
+{
+	if (seed != 0) {
+		pthread_mutex_lock(&raceBoardLock);
+		RaceBoard* race = findRaceBoard(difficulty, seed);
+		pthread_mutex_unlock(&raceBoardLock);
+		if (race != NULL)
+			return race;
+	}
+
+	// Lay the board out without holding the lock
+	RaceBoard* race = malloc(sizeof(RaceBoard));
+	if (!race) {
+		perror("Out of memory in acquireRaceBoard");
+		exit(1);
+	}
+	BoardConfig config = presetConfig(difficulty);
+	config.noGuess = true;
+	bool made;
+	if (seed != 0)
+		made = initGameFromSeed(&race->board, &config, seed);
+	else
+		made = acquireGame(&race->board, &config);
+	if (!made) {
+		free(race);
+		return NULL;
+	}
+	race->refs = 1;
+	race->difficulty = difficulty;
+
+	// Another race may have laid out the same board meanwhile
+	pthread_mutex_lock(&raceBoardLock);
+	RaceBoard* found = findRaceBoard(difficulty, race->board.seed);
+	if (found == NULL) {
+		race->next = raceBoards;
+		raceBoards = race;
+		nRaceBoards++;
+	}
+	pthread_mutex_unlock(&raceBoardLock);
+
+	if (found != NULL) {
+		freeGame(&race->board);
+		free(race);
+		return found;
+	}
+	return race;
+}
+
+
+/// retainRaceBoard
+/// Takes another reference to a board
+void retainRaceBoard(RaceBoard* race)
+{
+	pthread_mutex_lock(&raceBoardLock);
+	race->refs++;
+	pthread_mutex_unlock(&raceBoardLock);
+}
+
+
+/// releaseRaceBoard
+/// Drops one reference, freeing the board when no game is left on it
+void releaseRaceBoard(RaceBoard* race)
+{
+	pthread_mutex_lock(&raceBoardLock);
+	bool last = (--race->refs == 0);
+	if (last) {
+		RaceBoard** link = &raceBoards;
+		while (*link != race)
+			link = &(*link)->next;
+		*link = race->next;
+		nRaceBoards--;
+	}
+	pthread_mutex_unlock(&raceBoardLock);
+
+	if (last) {
+		freeGame(&race->board);
+		free(race);
+	}
+}
+
+
+/// countRaceBoards
+/// Returns the number of boards held by races now
+int countRaceBoards()
+{
+	pthread_mutex_lock(&raceBoardLock);
+	int count = nRaceBoards;
+	pthread_mutex_unlock(&raceBoardLock);
+	return count;
+}
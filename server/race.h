@@ -0,0 +1,54 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * server/race.h
+ * Header for the server-side boards of head-to-head races
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    6/11/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef __server_race__h__
+#define __server_race__h__
+
+/* Includes */
+#include <stdint.h>
+#include "minesweeper.h"
+
+
+/* Types */
+/// RaceBoard structure
+/// The mine layout of a race, shared read-only by every game on it (see
+/// initGameOnBoard), and by every race on the same preset and seed at once
+typedef struct RaceBoard
+{
+	int refs;               // under the board list lock, see race.c
+	Difficulty difficulty;
+	GameState board;        // no-guess, laid out in full; never played on
+	struct RaceBoard* next;
+} RaceBoard;
+
+
+/* Public function prototypes */
+/// acquireRaceBoard
+/// Returns the board of a no-guess preset with the given seed, laying it out
+/// unless a race already holds it, or a fresh board from the pool if seed is 0
+/// Returns NULL if no no-guess layout was found
+RaceBoard* acquireRaceBoard(Difficulty difficulty, uint64_t seed);
+
+
+/// retainRaceBoard
+/// Takes another reference to a board
+void retainRaceBoard(RaceBoard* race);
+
+
+/// releaseRaceBoard
+/// Drops one reference, freeing the board when no game is left on it
+void releaseRaceBoard(RaceBoard* race);
+
+
+/// countRaceBoards
+/// Returns the number of boards held by races now
+int countRaceBoards();
+
+
+#endif
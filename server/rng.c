@@ -0,0 +1,128 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * server/rng.c
+ * Server-side random number generation
+ * xoshiro256** by Blackman and Vigna, seeded through splitmix64
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    30/10/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Includes */
+#include "rng.h"
+#include <stdio.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/* Defines */
+static uint64_t masterSeed = 0;
+static atomic_ullong gameCount = 0; // games seeded so far
+
+
+/* Private functions */
+/// splitmix64
+/// Advances state and returns a well-mixed 64-bit value
+uint64_t splitmix64(uint64_t* state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+
+/// rotl
+/// Rotates x left by k bits
+uint64_t rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+
+
+/* Public functions */
+/// seedRng
+/// Expands a 64-bit seed into a full generator state
+/// The same seed always produces the same sequence
+void seedRng(Rng* rng, uint64_t seed)
+{
+	// splitmix64 never yields an all-zero xoshiro state
+	for (int i=0; i<4; i++)
+		rng->s[i] = splitmix64(&seed);
+}
+
+
+/// nextRng
+/// Returns the next 64 random bits
+uint64_t nextRng(Rng* rng)
+{
+	uint64_t* s = rng->s;
+	uint64_t result = rotl(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+
+	return result;
+}
+
+
+/// boundedRng
+/// Returns a uniformly distributed number in [0, bound), bound > 0
+/// Lemire's multiply-shift, rejecting the few values that would bias it
+uint32_t boundedRng(Rng* rng, uint32_t bound)
+{
+	uint64_t m = (nextRng(rng) >> 32) * bound;
+	if ((uint32_t)m < bound) {
+		uint32_t threshold = -bound % bound;
+		while ((uint32_t)m < threshold)
+			m = (nextRng(rng) >> 32) * bound;
+	}
+	return m >> 32;
+}
+
+
+/// setMasterSeed
+/// Sets the seed that every game seed is derived from
+/// Call once at startup, before any game begins
+void setMasterSeed(uint64_t seed)
+{
+	masterSeed = seed;
+	atomic_store(&gameCount, 0);
+}
+
+
+/// randomMasterSeed
+/// Returns a seed from the operating system, falling back to the clock
+uint64_t randomMasterSeed()
+{
+	uint64_t seed;
+	FILE* urandom = fopen("/dev/urandom", "rb");
+	if (urandom != NULL) {
+		size_t got = fread(&seed, sizeof(seed), 1, urandom);
+		fclose(urandom);
+		if (got == 1)
+			return seed;
+	}
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	seed = ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)ts.tv_nsec ^ ((uint64_t)getpid() << 16);
+	return splitmix64(&seed);
+}
+
+
+/// newGameSeed
+/// Returns a distinct seed for a new game, lock-free and safe from any thread
+/// Game n of a run always gets the same seed for the same master seed
+uint64_t newGameSeed()
+{
+	uint64_t state = masterSeed + atomic_fetch_add(&gameCount, 1) * 0x9e3779b97f4a7c15ULL;
+	return splitmix64(&state);
+}
@@ -0,0 +1,59 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * server/rng.h
+ * Header for server-side random number generation
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    30/10/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef __server_rng__h__
+#define __server_rng__h__
+
+/* Includes */
+#include <stdint.h>
+
+
+/* Types */
+/// Rng structure
+/// xoshiro256** generator state, owned by one thread (or one game) at a time
+typedef struct
+{
+	uint64_t s[4];
+} Rng;
+
+
+/* Public function prototypes */
+/// seedRng
+/// Expands a 64-bit seed into a full generator state
+/// The same seed always produces the same sequence
+void seedRng(Rng* rng, uint64_t seed);
+
+
+/// nextRng
+/// Returns the next 64 random bits
+uint64_t nextRng(Rng* rng);
+
+
+/// boundedRng
+/// Returns a uniformly distributed number in [0, bound), bound > 0
+uint32_t boundedRng(Rng* rng, uint32_t bound);
+
+
+/// setMasterSeed
+/// Sets the seed that every game seed is derived from
+/// Call once at startup, before any game begins
+void setMasterSeed(uint64_t seed);
+
+
+/// randomMasterSeed
+/// Returns a seed from the operating system, falling back to the clock
+uint64_t randomMasterSeed();
+
+
+/// newGameSeed
+/// Returns a distinct seed for a new game, lock-free and safe from any thread
+uint64_t newGameSeed();
+
+
+#endif
@@ -0,0 +1,393 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * server/shared.c
+ * Server-side shared multiplayer board
+ * Moves lock only the stripes they touch, one at a time, so players far
+ * apart never contend; see SharedBoard
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    5/11/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Includes */
+#include "shared.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+
+/* Private functions */
+/// initTileList
+/// Sets up an empty, growable tile list
+void initTileList(TileList* list)
+{
+	list->count = 0;
+	list->capacity = 64;
+	list->tiles = malloc(list->capacity * sizeof(int));
+	if (!list->tiles) {
+		perror("Out of memory in initTileList");
+		exit(1);
+	}
+}
+
+
+/// stripeOf
+/// Returns the stripe holding tile (x, y)
+int stripeOf(SharedBoard* board, int x, int y)
+{
+	return (y >> STRIPE_SHIFT) * board->stripesX + (x >> STRIPE_SHIFT);
+}
+
+
+/// inSharedBounds
+/// Returns whether (x, y) lies on the board, without reading the game,
+/// which is replaced between rounds
+bool inSharedBounds(SharedBoard* board, int x, int y)
+{
+	return x >= 0 && x < board->config.width && y >= 0 && y < board->config.height;
+}
+
+
+/// layoutRound
+/// Places a fresh round's mines, keeping the centre clear
+void layoutRound(SharedBoard* board)
+{
+	GameState* game = &board->game;
+	initGame(game, &board->config);
+	board->startX = board->config.width / 2;
+	board->startY = board->config.height / 2;
+	placeFirstMines(game, board->startX, board->startY);
+	freeRegionIndex(game); // flood fills here go stripe by stripe
+
+	atomic_store(&board->hiddenSafe, game->hiddenSafe);
+	atomic_store(&board->cleared, false);
+	board->roundStart = time(0);
+}
+
+
+/// lockRound
+/// Locks a stripe for a move begun in round
+/// Returns false, unlocked, if a new round has started since
+bool lockRound(SharedBoard* board, int stripe, int round)
+{
+	pthread_mutex_lock(&board->stripes[stripe]);
+	if (atomic_load(&board->round) == round)
+		return true;
+	pthread_mutex_unlock(&board->stripes[stripe]);
+	return false;
+}
+
+
+/// revealSharedTile
+/// Reveals a single unrevealed safe tile, clearing any misplaced flag
+/// The caller holds its stripe
+void revealSharedTile(SharedBoard* board, int x, int y, TileList* changed)
+{
+	GameState* game = &board->game;
+	size_t word = tileWord(game, x, y);
+	game->revealed[word] |= tileBit(x);
+	game->flagged[word] &= ~tileBit(x);
+	appendTile(changed, y*game->width + x);
+
+	// Exactly one reveal takes the count to zero
+	if (atomic_fetch_sub(&board->hiddenSafe, 1) == 1)
+		atomic_store(&board->cleared, true);
+}
+
+
+/// floodShared
+/// Reveals the pending tiles, all known to be safe, flood filling through
+/// zeros; each stripe is locked in turn and its share of the fill
+/// published before moving on, tiles over its border left pending
+/// Returns the number of tiles revealed
+int floodShared(SharedBoard* board, int round, TileList* pending, SharedPublish publish, void* context)
+{
+	GameState* game = &board->game;
+	TileList changed;
+	initTileList(&changed);
+	int nRevealed = 0;
+
+	while (pending->count > 0) {
+		int stripe = stripeOf(board, pending->tiles[0] % board->config.width, pending->tiles[0] / board->config.width);
+		if (!lockRound(board, stripe, round))
+			break; // board cleared and replaced under us
+
+		// Take the pending tiles of this stripe
+		changed.count = 0;
+		int kept = 0;
+		for (int k=0; k<pending->count; k++) {
+			int i = pending->tiles[k] % game->width;
+			int j = pending->tiles[k] / game->width;
+			if (stripeOf(board, i, j) != stripe)
+				pending->tiles[kept++] = pending->tiles[k];
+			else if (!tileIsRevealed(game, i, j))
+				revealSharedTile(board, i, j, &changed);
+		}
+		pending->count = kept;
+
+		// Flood fill breadth-first within the stripe, neighbours of a zero are never mines
+		for (int head=0; head<changed.count; head++) {
+			int i = changed.tiles[head] % game->width;
+			int j = changed.tiles[head] / game->width;
+			if (!isOpening(game, i, j))
+				continue;
+
+			for (int nj = (j > 0 ? j-1 : j); nj <= j+1 && nj < game->height; nj++) {
+				for (int ni = (i > 0 ? i-1 : i); ni <= i+1 && ni < game->width; ni++) {
+					if (stripeOf(board, ni, nj) != stripe)
+						appendTile(pending, nj*game->width + ni);
+					else if (!tileIsRevealed(game, ni, nj))
+						revealSharedTile(board, ni, nj, &changed);
+				}
+			}
+		}
+
+		if (changed.count > 0) {
+			sortTileList(&changed);
+			publish(board, &changed, context);
+			nRevealed += changed.count;
+		}
+		pthread_mutex_unlock(&board->stripes[stripe]);
+	}
+
+	free(changed.tiles);
+	return nRevealed;
+}
+
+
+/// stripesAround
+/// Lists the stripes holding (x, y) and its neighbours, ascending, which is
+/// the order any move holding several stripes locks them in
+/// Returns the number of stripes, at most 4
+int stripesAround(SharedBoard* board, int x, int y, int* stripes)
+{
+	int nStripes = 0;
+	for (int j = (y > 0 ? y-1 : y); j <= y+1 && j < board->config.height; j++) {
+		for (int i = (x > 0 ? x-1 : x); i <= x+1 && i < board->config.width; i++) {
+			int stripe = stripeOf(board, i, j);
+			int k = nStripes;
+			while (k > 0 && stripes[k-1] > stripe)
+				k--;
+			if (k > 0 && stripes[k-1] == stripe)
+				continue;
+			memmove(stripes + k + 1, stripes + k, (nStripes - k) * sizeof(int));
+			stripes[k] = stripe;
+			nStripes++;
+		}
+	}
+	return nStripes;
+}
+
+
+
+/* Public functions */
+/// initSharedBoard
+/// Sets up a shared board sized by config, mines placed around its centre
+void initSharedBoard(SharedBoard* board, const BoardConfig* config)
+{
+	board->config = *config;
+	board->config.noGuess = false;
+	board->stripesX = (config->width + (1 << STRIPE_SHIFT) - 1) >> STRIPE_SHIFT;
+	board->nStripes = board->stripesX * ((config->height + (1 << STRIPE_SHIFT) - 1) >> STRIPE_SHIFT);
+	board->stripes = malloc(board->nStripes * sizeof(pthread_mutex_t));
+	if (!board->stripes) {
+		perror("Out of memory in initSharedBoard");
+		exit(1);
+	}
+	for (int s=0; s<board->nStripes; s++)
+		pthread_mutex_init(&board->stripes[s], NULL);
+
+	atomic_init(&board->round, 0);
+	atomic_init(&board->hiddenSafe, 0);
+	atomic_init(&board->cleared, false);
+	layoutRound(board);
+}
+
+
+/// freeSharedBoard
+/// Deallocates a shared board, which nothing may be using
+void freeSharedBoard(SharedBoard* board)
+{
+	for (int s=0; s<board->nStripes; s++)
+		pthread_mutex_destroy(&board->stripes[s]);
+	free(board->stripes);
+	board->stripes = NULL;
+	freeGame(&board->game);
+}
+
+
+/// sharedReveal
+/// Reveals (x, y), flood filling across stripes, publishing the tiles
+/// changed in each stripe as it goes
+/// Returns the number of tiles revealed, MINE_HIT, or WARNING
+int sharedReveal(SharedBoard* board, int x, int y, SharedPublish publish, void* context)
+{
+	GameState* game = &board->game;
+	if (!inSharedBounds(board, x, y))
+		return WARNING;
+
+	// Mine hit, or nothing to reveal
+	int round = atomic_load(&board->round);
+	int stripe = stripeOf(board, x, y);
+	if (!lockRound(board, stripe, round))
+		return WARNING;
+	bool isMine = tileIsMine(game, x, y);
+	bool isRevealed = tileIsRevealed(game, x, y);
+	pthread_mutex_unlock(&board->stripes[stripe]);
+	if (isMine)
+		return MINE_HIT;
+	if (isRevealed)
+		return WARNING;
+
+	TileList pending;
+	initTileList(&pending);
+	appendTile(&pending, y*board->config.width + x);
+	int nRevealed = floodShared(board, round, &pending, publish, context);
+	free(pending.tiles);
+	return (nRevealed > 0) ? nRevealed : WARNING; // another player got there first
+}
+
+
+/// sharedChord
+/// Reveals the unflagged neighbours of the revealed tile at (x, y), if as
+/// many of its neighbours are flagged as it has adjacent mines
+/// Returns the number of tiles revealed, MINE_HIT, or WARNING
+int sharedChord(SharedBoard* board, int x, int y, SharedPublish publish, void* context)
+{
+	GameState* game = &board->game;
+	if (!inSharedBounds(board, x, y))
+		return WARNING;
+
+	// Read the neighbourhood with every stripe it spans locked
+	int round = atomic_load(&board->round);
+	int stripes[4];
+	int nStripes = stripesAround(board, x, y, stripes);
+	for (int s=0; s<nStripes; s++)
+		pthread_mutex_lock(&board->stripes[stripes[s]]);
+
+	TileList pending;
+	initTileList(&pending);
+	bool isMine = false;
+	int nFlags = 0;
+	for (int j = (y > 0 ? y-1 : y); j <= y+1 && j < game->height; j++) {
+		for (int i = (x > 0 ? x-1 : x); i <= x+1 && i < game->width; i++) {
+			if (tileIsFlagged(game, i, j))
+				nFlags++;
+			else if (!tileIsRevealed(game, i, j)) {
+				isMine |= tileIsMine(game, i, j);
+				appendTile(&pending, j*game->width + i);
+			}
+		}
+	}
+	bool valid = atomic_load(&board->round) == round && tileIsRevealed(game, x, y) &&
+	             nFlags == tileAdjacentMines(game, x, y);
+
+	for (int s=nStripes-1; s>=0; s--)
+		pthread_mutex_unlock(&board->stripes[stripes[s]]);
+
+	// Flags not matching the number, a misplaced flag, or nothing to reveal
+	int result = WARNING;
+	if (valid && isMine)
+		result = MINE_HIT;
+	else if (valid && pending.count > 0)
+		result = floodShared(board, round, &pending, publish, context);
+	free(pending.tiles);
+	return (result != 0) ? result : WARNING;
+}
+
+
+/// sharedFlag
+/// Flags (x, y), or unflags it if flagged, publishing the tile
+/// Returns 1, or WARNING if the tile is revealed
+int sharedFlag(SharedBoard* board, int x, int y, SharedPublish publish, void* context)
+{
+	GameState* game = &board->game;
+	if (!inSharedBounds(board, x, y))
+		return WARNING;
+
+	int stripe = stripeOf(board, x, y);
+	if (!lockRound(board, stripe, atomic_load(&board->round)))
+		return WARNING;
+	if (tileIsRevealed(game, x, y)) {
+		pthread_mutex_unlock(&board->stripes[stripe]);
+		return WARNING;
+	}
+
+	game->flagged[tileWord(game, x, y)] ^= tileBit(x);
+	int tile = y*game->width + x;
+	TileList changed = {1, 1, &tile};
+	publish(board, &changed, context);
+	pthread_mutex_unlock(&board->stripes[stripe]);
+	return 1;
+}
+
+
+/// sharedSnapshot
+/// Publishes every revealed or flagged tile, one stripe at a time
+void sharedSnapshot(SharedBoard* board, SharedPublish publish, void* context)
+{
+	GameState* game = &board->game;
+	TileList changed;
+	initTileList(&changed);
+
+	for (int stripe=0; stripe<board->nStripes; stripe++) {
+		int x = (stripe % board->stripesX) << STRIPE_SHIFT;
+		int top = (stripe / board->stripesX) << STRIPE_SHIFT;
+		int bottom = (top + (1 << STRIPE_SHIFT) < board->config.height) ? top + (1 << STRIPE_SHIFT) : board->config.height;
+
+		// A stripe is one word per row, bits past the board edge are never set
+		pthread_mutex_lock(&board->stripes[stripe]);
+		changed.count = 0;
+		for (int y=top; y<bottom; y++) {
+			size_t word = tileWord(game, x, y);
+			for (uint64_t bits = game->revealed[word] | game->flagged[word]; bits != 0; bits &= bits - 1)
+				appendTile(&changed, y*game->width + x + __builtin_ctzll(bits));
+		}
+		if (changed.count > 0)
+			publish(board, &changed, context);
+		pthread_mutex_unlock(&board->stripes[stripe]);
+	}
+
+	free(changed.tiles);
+}
+
+
+/// newSharedRound
+/// Lays out a fresh board once the last one was cleared (see cleared),
+/// publishing the new round before any move can be made on it
+void newSharedRound(SharedBoard* board, SharedPublish publish, void* context)
+{
+	for (int s=0; s<board->nStripes; s++)
+		pthread_mutex_lock(&board->stripes[s]);
+
+	freeGame(&board->game);
+	layoutRound(board);
+	atomic_fetch_add(&board->round, 1);
+	publish(board, NULL, context);
+
+	for (int s=board->nStripes-1; s>=0; s--)
+		pthread_mutex_unlock(&board->stripes[s]);
+}
+
+
+/// encodeSharedTiles
+/// Encodes tiles passed to a SharedPublish; flags never show whether they
+/// cover a mine
+/// Returns the number of tiles encoded
+int encodeSharedTiles(SharedBoard* board, const TileList* changed, TileEncoder* reply)
+{
+	GameState* game = &board->game;
+	for (int k=0; k<changed->count; k++) {
+		if (k > 0 && changed->tiles[k] == changed->tiles[k-1])
+			continue;
+		int i = changed->tiles[k] % game->width;
+		int j = changed->tiles[k] / game->width;
+		if (tileIsRevealed(game, i, j))
+			encodeTile(reply, i, j, tileAdjacentMines(game, i, j), false, false);
+		else if (tileIsFlagged(game, i, j))
+			encodeTile(reply, i, j, 9, true, false);
+		else
+			encodeTile(reply, i, j, TILE_HIDDEN_COUNT, false, false); // unflagged
+	}
+	return finishTiles(reply);
+}
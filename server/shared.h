@@ -0,0 +1,113 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * server/shared.h
+ * Header for the server-side shared multiplayer board
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    5/11/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef __server_shared__h__
+#define __server_shared__h__
+
+/* Includes */
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include "minesweeper.h"
+#include "tilecodec.h"
+
+
+/* Defines */
+#define STRIPE_SHIFT 6 // stripes of 64x64 tiles, whole plane words
+#define SHARED_WIDTH   MAX_BOARD_SIZE
+#define SHARED_HEIGHT  MAX_BOARD_SIZE
+#define SHARED_MINES   (SHARED_WIDTH * SHARED_HEIGHT * 15 / 100)
+
+
+/* Types */
+struct SharedBoard;
+
+/// SharedPublish
+/// Called with the tiles one move changed within a stripe, while that
+/// stripe is still locked, so tiles are published in the order they changed
+/// Called with changed == NULL once a new round has started, with every
+/// stripe locked
+typedef void (*SharedPublish)(struct SharedBoard* board, const TileList* changed, void* context);
+
+
+/// SharedBoard structure
+/// One board played by many sessions at once
+/// The board is split into stripes of 64x64 tiles, each with its own lock;
+/// a stripe's words of the revealed and flagged planes are only touched
+/// under its lock, so moves on different stripes never wait on each other
+/// Flood fills lock one stripe at a time, passing tiles over the border on
+/// to the next stripe once the current one is done
+/// Mines and openings only change between rounds, with every stripe locked
+typedef struct SharedBoard
+{
+	GameState game;           // planes only, the counters are kept below
+	BoardConfig config;
+	pthread_mutex_t* stripes;
+	int stripesX;             // stripes per row of stripes
+	int nStripes;
+	atomic_int round;         // bumped by each new round, moves spanning one give up
+	atomic_int hiddenSafe;    // safe tiles not yet revealed this round
+	atomic_bool cleared;      // set by the reveal that cleared the board, see newSharedRound
+	time_t roundStart;
+	int startX;               // tile kept clear for players to open first
+	int startY;
+} SharedBoard;
+
+
+/* Public function prototypes */
+/// initSharedBoard
+/// Sets up a shared board sized by config, mines placed around its centre
+void initSharedBoard(SharedBoard* board, const BoardConfig* config);
+
+
+/// freeSharedBoard
+/// Deallocates a shared board, which nothing may be using
+void freeSharedBoard(SharedBoard* board);
+
+
+/// sharedReveal
+/// Reveals (x, y), flood filling across stripes, publishing the tiles
+/// changed in each stripe as it goes
+/// Returns the number of tiles revealed, MINE_HIT, or WARNING
+int sharedReveal(SharedBoard* board, int x, int y, SharedPublish publish, void* context);
+
+
+/// sharedChord
+/// Reveals the unflagged neighbours of the revealed tile at (x, y), if as
+/// many of its neighbours are flagged as it has adjacent mines
+/// Returns the number of tiles revealed, MINE_HIT, or WARNING
+int sharedChord(SharedBoard* board, int x, int y, SharedPublish publish, void* context);
+
+
+/// sharedFlag
+/// Flags (x, y), or unflags it if flagged, publishing the tile
+/// Returns 1, or WARNING if the tile is revealed
+int sharedFlag(SharedBoard* board, int x, int y, SharedPublish publish, void* context);
+
+
+/// sharedSnapshot
+/// Publishes every revealed or flagged tile, one stripe at a time
+void sharedSnapshot(SharedBoard* board, SharedPublish publish, void* context);
+
+
+/// newSharedRound
+/// Lays out a fresh board once the last one was cleared (see cleared),
+/// publishing the new round before any move can be made on it
+void newSharedRound(SharedBoard* board, SharedPublish publish, void* context);
+
+
+/// encodeSharedTiles
+/// Encodes tiles passed to a SharedPublish; flags never show whether they
+/// cover a mine
+/// Returns the number of tiles encoded
+int encodeSharedTiles(SharedBoard* board, const TileList* changed, TileEncoder* reply);
+
+
+#endif
@@ -0,0 +1,658 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * server/solver.c
+ * Server-side minesweeper solver
+ * Deduces safe tiles and mines from open tiles the way a player would,
+ * never guessing
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    2/11/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Includes */
+#include "solver.h"
+#include <stdio.h>
+
+
+/* Defines */
+#define CELL_SEEN 0x10 // frontier tile already grouped into a component
+
+#define ENUM_MAX_CONSTRAINTS (8 * SOLVER_MAX_ENUM)
+
+
+/* Types */
+/// Enumeration structure
+/// One frontier component: its unknown tiles and the open tiles around them
+typedef struct
+{
+	int nCells;
+	int nConstraints;
+	int need[ENUM_MAX_CONSTRAINTS];    // mines among the constraint's cells
+	int placed[ENUM_MAX_CONSTRAINTS];  // mines assigned so far
+	int left[ENUM_MAX_CONSTRAINTS];    // cells not yet assigned
+	int cellConstraints[SOLVER_MAX_ENUM][8];
+	int nCellConstraints[SOLVER_MAX_ENUM];
+	bool assign[SOLVER_MAX_ENUM];
+	long mineCount[SOLVER_MAX_ENUM];   // solutions with a mine at each cell
+	long nSolutions;
+} Enumeration;
+
+
+/* Private functions */
+/// neighbours
+/// Lists the on-board 8-neighbours of tile t
+/// Returns how many there are
+int neighbours(Solver* solver, int t, int* out)
+{
+	int width = solver->game->width, height = solver->game->height;
+	int x = t % width, y = t / width, n = 0;
+	for (int nj = (y > 0 ? y-1 : y); nj <= y+1 && nj < height; nj++) {
+		for (int ni = (x > 0 ? x-1 : x); ni <= x+1 && ni < width; ni++) {
+			if (ni != x || nj != y)
+				out[n++] = nj*width + ni;
+		}
+	}
+	return n;
+}
+
+
+/// isUnknown
+/// Returns whether nothing is known about tile t yet
+bool isUnknown(Solver* solver, int t)
+{
+	return (solver->cell[t] & (CELL_SAFE | CELL_MINE)) == 0;
+}
+
+
+/// queueTile
+/// Queues an open tile to be examined again, once
+void queueTile(Solver* solver, int t)
+{
+	if ((solver->cell[t] & (CELL_OPEN | CELL_QUEUED)) != CELL_OPEN)
+		return;
+	solver->cell[t] |= CELL_QUEUED;
+	solver->queue[(solver->head + solver->count++) % solver->nTiles] = t;
+}
+
+
+/// queueNeighbours
+/// Queues the open tiles around t, whose constraints t just changed
+void queueNeighbours(Solver* solver, int t)
+{
+	int around[8];
+	int n = neighbours(solver, t, around);
+	for (int i=0; i<n; i++)
+		queueTile(solver, around[i]);
+}
+
+
+/// markSafe
+/// Records tile t as safe, to be opened when simulating
+/// Returns whether it was unknown
+int markSafe(Solver* solver, int t)
+{
+	if (!isUnknown(solver, t))
+		return 0;
+	solver->cell[t] |= CELL_SAFE;
+	queueNeighbours(solver, t);
+	if (solver->simulate)
+		solver->toOpen[solver->nToOpen++] = t;
+	else if (solver->hint < 0)
+		solver->hint = t;
+	return 1;
+}
+
+
+/// markMine
+/// Records tile t as a mine
+/// Returns whether it was unknown
+int markMine(Solver* solver, int t)
+{
+	if (!isUnknown(solver, t))
+		return 0;
+	solver->cell[t] |= CELL_MINE;
+	queueNeighbours(solver, t);
+	int width = solver->game->width;
+	if (!solver->simulate && solver->hint < 0 && !tileIsFlagged(solver->game, t % width, t / width))
+		solver->hint = t;
+	return 1;
+}
+
+
+/// examineTile
+/// Reads the number of open tile t from the board, and lists it for deduction
+void examineTile(Solver* solver, int t)
+{
+	int width = solver->game->width;
+	solver->number[t] = tileAdjacentMines(solver->game, t % width, t / width);
+	solver->examine[solver->nExamine++] = t;
+	queueTile(solver, t);
+}
+
+
+/// openTile
+/// Opens a safe tile, reading its number from the board
+void openTile(Solver* solver, int t)
+{
+	solver->cell[t] |= CELL_OPEN | CELL_SAFE;
+	solver->nOpen++;
+	examineTile(solver, t);
+}
+
+
+/// spanBits
+/// Returns the bits of plane row word w whose left and right neighbours are
+/// also set; the guard words read as zero
+uint64_t spanBits(const uint64_t* row, int w)
+{
+	return row[w] & (row[w] << 1 | row[w-1] >> 63) & (row[w] >> 1 | row[w+1] << 63);
+}
+
+
+/// openPending
+/// Opens every tile marked safe since the last call, flood filling zeros
+void openPending(Solver* solver)
+{
+	while (solver->nToOpen > 0) {
+		int t = solver->toOpen[--solver->nToOpen];
+		if (solver->cell[t] & CELL_OPEN)
+			continue;
+
+		openTile(solver, t);
+		if (solver->number[t] == 0) {
+			int around[8];
+			int n = neighbours(solver, t, around);
+			for (int i=0; i<n; i++)
+				markSafe(solver, around[i]);
+		}
+	}
+}
+
+
+/// constraint
+/// Collects the unknown neighbours of open tile t
+/// Returns how many there are, with the mines still among them in need
+int constraint(Solver* solver, int t, int* unknown, int* need)
+{
+	int around[8];
+	int n = neighbours(solver, t, around), nUnknown = 0, mines = 0;
+	for (int i=0; i<n; i++) {
+		if (solver->cell[around[i]] & CELL_MINE)
+			mines++;
+		else if (!(solver->cell[around[i]] & CELL_SAFE))
+			unknown[nUnknown++] = around[i];
+	}
+	*need = solver->number[t] - mines;
+	return nUnknown;
+}
+
+
+/// singlePoint
+/// Settles open tiles whose unknown neighbours are all safe or all mines
+/// Returns the number of tiles deduced
+int singlePoint(Solver* solver)
+{
+	int found = 0;
+	while (solver->count > 0 && solver->hint < 0) {
+		int t = solver->queue[solver->head];
+		solver->head = (solver->head + 1) % solver->nTiles;
+		solver->count--;
+		solver->cell[t] &= ~CELL_QUEUED;
+
+		int unknown[8], need;
+		int nUnknown = constraint(solver, t, unknown, &need);
+		if (nUnknown == 0)
+			continue;
+
+		for (int i=0; i<nUnknown; i++) {
+			if (need == 0)
+				found += markSafe(solver, unknown[i]);
+			else if (need == nUnknown)
+				found += markMine(solver, unknown[i]);
+		}
+		openPending(solver);
+	}
+	return found;
+}
+
+
+/// difference
+/// Lists the tiles of a that are not in b
+/// Returns how many there are
+int difference(const int* a, int nA, const int* b, int nB, int* out)
+{
+	int n = 0;
+	for (int i=0; i<nA; i++) {
+		bool shared = false;
+		for (int j=0; j<nB; j++)
+			shared |= (a[i] == b[j]);
+		if (!shared)
+			out[n++] = a[i];
+	}
+	return n;
+}
+
+
+/// reducePairs
+/// Compares the constraints of open tiles up to 2 apart, which may share
+/// unknowns: mines(onlyA) - mines(onlyB) == needA - needB, so when that
+/// equals |onlyA|, onlyA holds only mines and onlyB none
+/// This covers subsets, where one side is empty
+/// Returns the number of tiles deduced
+int reducePairs(Solver* solver)
+{
+	int width = solver->game->width, height = solver->game->height;
+	int found = 0;
+
+	for (int e=0; e<solver->nExamine && solver->hint < 0; e++) {
+		int a = solver->examine[e];
+		int unknownA[8], needA;
+		int nA = constraint(solver, a, unknownA, &needA);
+		if (nA == 0)
+			continue;
+
+		int ax = a % width, ay = a / width;
+		for (int by = (ay > 1 ? ay-2 : 0); by <= ay+2 && by < height; by++) {
+			for (int bx = (ax > 1 ? ax-2 : 0); bx <= ax+2 && bx < width; bx++) {
+				int b = by*width + bx;
+				if (b == a || !(solver->cell[b] & CELL_OPEN))
+					continue;
+				int unknownB[8], needB;
+				int nB = constraint(solver, b, unknownB, &needB);
+				if (nB == 0)
+					continue;
+
+				int onlyA[8], onlyB[8];
+				int nOnlyA = difference(unknownA, nA, unknownB, nB, onlyA);
+				if (nOnlyA == nA || needA - needB != nOnlyA)
+					continue; // disjoint, or nothing follows
+				int nOnlyB = difference(unknownB, nB, unknownA, nA, onlyB);
+
+				for (int i=0; i<nOnlyA; i++)
+					found += markMine(solver, onlyA[i]);
+				for (int i=0; i<nOnlyB; i++)
+					found += markSafe(solver, onlyB[i]);
+			}
+		}
+	}
+
+	openPending(solver);
+	return found;
+}
+
+
+/// enumerate
+/// Counts the mine assignments of cells i.. that satisfy every constraint
+void enumerate(Enumeration* e, int i)
+{
+	if (i == e->nCells) {
+		e->nSolutions++;
+		for (int c=0; c<e->nCells; c++)
+			e->mineCount[c] += e->assign[c];
+		return;
+	}
+
+	for (int mine=0; mine<=1; mine++) {
+		bool ok = true;
+		e->assign[i] = mine;
+		for (int k=0; k<e->nCellConstraints[i]; k++) {
+			int c = e->cellConstraints[i][k];
+			e->placed[c] += mine;
+			e->left[c]--;
+			ok &= (e->placed[c] <= e->need[c] && e->placed[c] + e->left[c] >= e->need[c]);
+		}
+		if (ok)
+			enumerate(e, i+1);
+		for (int k=0; k<e->nCellConstraints[i]; k++) {
+			int c = e->cellConstraints[i][k];
+			e->placed[c] -= mine;
+			e->left[c]++;
+		}
+	}
+}
+
+
+/// solveComponent
+/// Enumerates one frontier component, settling tiles that are the same
+/// in every solution
+/// Returns the number of tiles deduced
+int solveComponent(Solver* solver, const int* cells, int nCells)
+{
+	Enumeration e;
+	e.nCells = nCells;
+	e.nConstraints = 0;
+	e.nSolutions = 0;
+	int constraints[ENUM_MAX_CONSTRAINTS];
+
+	for (int i=0; i<nCells; i++) {
+		e.nCellConstraints[i] = 0;
+		e.mineCount[i] = 0;
+	}
+
+	// Every open tile around the component constrains only its cells
+	for (int i=0; i<nCells; i++) {
+		int around[8];
+		int n = neighbours(solver, cells[i], around);
+		for (int j=0; j<n; j++) {
+			int a = around[j];
+			if (!(solver->cell[a] & CELL_OPEN))
+				continue;
+
+			int c = 0;
+			while (c < e.nConstraints && constraints[c] != a)
+				c++;
+			if (c == e.nConstraints) {
+				int unknown[8];
+				constraints[c] = a;
+				e.left[c] = constraint(solver, a, unknown, &e.need[c]);
+				e.placed[c] = 0;
+				e.nConstraints++;
+			}
+			e.cellConstraints[i][e.nCellConstraints[i]++] = c;
+		}
+	}
+
+	enumerate(&e, 0);
+
+	int found = 0;
+	if (e.nSolutions == 0)
+		return 0; // open tiles contradict, nothing sound follows
+	for (int i=0; i<nCells; i++) {
+		if (e.mineCount[i] == 0)
+			found += markSafe(solver, cells[i]);
+		else if (e.mineCount[i] == e.nSolutions)
+			found += markMine(solver, cells[i]);
+	}
+	return found;
+}
+
+
+/// enumerateFrontier
+/// Groups unknown tiles bordering open tiles into components that share
+/// constraints, and enumerates those of up to SOLVER_MAX_ENUM tiles
+/// Returns the number of tiles deduced
+int enumerateFrontier(Solver* solver)
+{
+	int found = 0;
+	int* cells = solver->scratch;
+
+	for (int e=0; e<solver->nExamine && solver->hint < 0; e++) {
+		int around[8];
+		int n = neighbours(solver, solver->examine[e], around);
+		for (int j=0; j<n; j++) {
+			int u = around[j];
+			if (!isUnknown(solver, u) || (solver->cell[u] & CELL_SEEN))
+				continue;
+
+			// Gather the component of u breadth-first through shared open tiles
+			int nCells = 0;
+			solver->cell[u] |= CELL_SEEN;
+			cells[nCells++] = u;
+			for (int i=0; i<nCells; i++) {
+				int openAround[8];
+				int nOpen = neighbours(solver, cells[i], openAround);
+				for (int k=0; k<nOpen; k++) {
+					if (!(solver->cell[openAround[k]] & CELL_OPEN))
+						continue;
+					int next[8];
+					int nNext = neighbours(solver, openAround[k], next);
+					for (int m=0; m<nNext; m++) {
+						int v = next[m];
+						if (isUnknown(solver, v) && !(solver->cell[v] & CELL_SEEN)) {
+							solver->cell[v] |= CELL_SEEN;
+							cells[nCells++] = v;
+						}
+					}
+				}
+			}
+
+			if (nCells <= SOLVER_MAX_ENUM)
+				found += solveComponent(solver, cells, nCells);
+		}
+	}
+
+	// Every tile grouped borders a listed open tile
+	for (int e=0; e<solver->nExamine; e++) {
+		int around[8];
+		int n = neighbours(solver, solver->examine[e], around);
+		for (int j=0; j<n; j++)
+			solver->cell[around[j]] &= ~CELL_SEEN;
+	}
+	openPending(solver);
+	return found;
+}
+
+
+
+/* Public functions */
+/// initSolver
+/// Sets up a solver over game
+/// Simulating starts with nothing open, otherwise with the game's revealed tiles
+void initSolver(Solver* solver, GameState* game, bool simulate)
+{
+	int nTiles = game->width * game->height;
+	solver->game = game;
+	solver->simulate = simulate;
+	solver->nTiles = nTiles;
+	solver->nOpen = 0;
+	solver->head = 0;
+	solver->count = 0;
+	solver->nToOpen = 0;
+	solver->nExamine = 0;
+	solver->hint = -1;
+	solver->cell = calloc(nTiles, sizeof(unsigned char));
+	solver->number = calloc(nTiles, sizeof(signed char));
+	solver->queue = malloc(nTiles * sizeof(int));
+	solver->toOpen = malloc(nTiles * sizeof(int));
+	solver->scratch = malloc(nTiles * sizeof(int));
+	solver->examine = malloc(nTiles * sizeof(int));
+	if (!solver->cell || !solver->number || !solver->queue || !solver->toOpen ||
+	    !solver->scratch || !solver->examine) {
+		perror("Out of memory in initSolver");
+		exit(1);
+	}
+
+	// A player's view: what the game has revealed, flags aside; open tiles
+	// away from unrevealed ones say nothing, so are never examined
+	if (!simulate) {
+		int nBorder = 0;
+		for (int y=0; y<game->height; y++) {
+			const uint64_t* above = game->revealed + (size_t)y*game->stride;
+			const uint64_t* row = above + game->stride;
+			const uint64_t* below = row + game->stride;
+			for (int w=1; w<game->stride-1; w++) {
+				// Revealed tiles with every neighbour revealed, the board's edge counting as not
+				uint64_t surrounded = spanBits(above, w) & spanBits(row, w) & spanBits(below, w);
+				for (uint64_t bits = row[w]; bits != 0; bits &= bits - 1) {
+					int t = y*game->width + ((w-1) << 6) + __builtin_ctzll(bits);
+					solver->cell[t] = CELL_OPEN | CELL_SAFE;
+					solver->nOpen++;
+					if (!(surrounded & bits & -bits))
+						solver->examine[nBorder++] = t;
+				}
+			}
+		}
+
+		// Numbers are read once every open tile is marked
+		for (int i=0; i<nBorder; i++)
+			examineTile(solver, solver->examine[i]);
+	}
+}
+
+
+/// freeSolver
+/// Deallocates the heap storage of a solver
+void freeSolver(Solver* solver)
+{
+	free(solver->cell);
+	free(solver->number);
+	free(solver->queue);
+	free(solver->toOpen);
+	free(solver->scratch);
+	free(solver->examine);
+	solver->cell = NULL;
+	solver->number = NULL;
+	solver->queue = solver->toOpen = solver->scratch = solver->examine = NULL;
+}
+
+
+/// solverOpen
+/// Simulating only: opens the tile at (x, y), flood filling openings
+/// Returns false if it is a mine
+bool solverOpen(Solver* solver, int x, int y)
+{
+	if (tileIsMine(solver->game, x, y))
+		return false;
+	int t = y*solver->game->width + x;
+	if (!(solver->cell[t] & CELL_OPEN)) {
+		if (!markSafe(solver, t))
+			solver->toOpen[solver->nToOpen++] = t; // already known safe
+		openPending(solver);
+	}
+	return true;
+}
+
+
+/// solverDeduce
+/// Applies single-point deduction, pairwise constraint reduction, then exact
+/// enumeration of small frontier components, until nothing more follows or,
+/// not simulating, a hint is found
+/// Returns the number of tiles newly known to be safe or mines
+int solverDeduce(Solver* solver)
+{
+	int found = 0;
+	while (solver->hint < 0) {
+		// Cheapest rule first, falling back only once it runs dry
+		found += singlePoint(solver);
+		int more = reducePairs(solver);
+		if (more == 0)
+			more = enumerateFrontier(solver);
+		if (more == 0)
+			break;
+		found += more;
+	}
+	return found;
+}
+
+
+/// solverDone
+/// Returns whether every safe tile is open
+bool solverDone(Solver* solver)
+{
+	return solver->nOpen == solver->nTiles - solver->game->nMines;
+}
+
+
+/// solveBoard
+/// Returns whether the board can be cleared by logic alone after opening (x, y)
+bool solveBoard(GameState* game, int x, int y)
+{
+	Solver solver;
+	initSolver(&solver, game, true);
+	bool solved = solverOpen(&solver, x, y);
+	if (solved) {
+		solverDeduce(&solver);
+		solved = solverDone(&solver);
+	}
+	freeSolver(&solver);
+	return solved;
+}
+
+
+/// makeSolvable
+/// Moves mines until the board can be cleared by logic alone after opening
+/// (x, y): whenever the solver is stuck, a mine on its frontier is moved to
+/// a tile away from everything opened so far
+/// Returns false if MAX_REPAIRS moves were not enough
+bool makeSolvable(GameState* game, Rng* rng, int x, int y)
+{
+	Solver solver;
+	initSolver(&solver, game, true);
+	int* frontier = malloc(solver.nTiles * sizeof(int));
+	int* interior = malloc(solver.nTiles * sizeof(int));
+	if (!frontier || !interior) {
+		perror("Out of memory in makeSolvable");
+		exit(1);
+	}
+
+	bool solved = false;
+	solverOpen(&solver, x, y);
+	for (int repair=0; repair<=MAX_REPAIRS; repair++) {
+		// Solve as far as logic goes
+		solverDeduce(&solver);
+		if (solverDone(&solver)) {
+			solved = true;
+			break;
+		}
+
+		// Mines the solver could not place next to open tiles, and
+		// unknown safe tiles out of sight of every open tile
+		int* walls = solver.scratch; // free once deduction is over
+		int nFrontier = 0, nInterior = 0, nWalls = 0;
+		for (int t=0; t<solver.nTiles; t++) {
+			int i = t % game->width, j = t / game->width;
+			if (solver.cell[t] & CELL_OPEN)
+				continue;
+
+			int around[8];
+			int n = neighbours(&solver, t, around);
+			bool seen = false;
+			for (int k=0; k<n; k++)
+				seen |= (solver.cell[around[k]] & CELL_OPEN) != 0;
+
+			if (seen && tileIsMine(game, i, j)) {
+				// Prefer mines the solver is unsure of, walls of known mines otherwise
+				if (isUnknown(&solver, t))
+					frontier[nFrontier++] = t;
+				else
+					walls[nWalls++] = t;
+			}
+			else if (!seen && !tileIsMine(game, i, j)) {
+				interior[nInterior++] = t;
+			}
+		}
+		if (nFrontier == 0) {
+			for (int k=0; k<nWalls; k++)
+				frontier[nFrontier++] = walls[k];
+		}
+		if (nFrontier == 0 || nInterior == 0)
+			break;
+
+		int from = frontier[boundedRng(rng, nFrontier)];
+		int to = interior[boundedRng(rng, nInterior)];
+		moveMine(game, from % game->width, from / game->width, to % game->width, to / game->width);
+
+		// What was deduced may have leant on the old numbers around from,
+		// and a player would not know it now: solve again from the start
+		freeSolver(&solver);
+		initSolver(&solver, game, true);
+		solverOpen(&solver, x, y);
+	}
+
+	free(frontier);
+	free(interior);
+	freeSolver(&solver);
+	return solved;
+}
+
+
+/// findHint
+/// Finds an unrevealed tile the revealed tiles prove safe, or to be a mine
+/// not yet flagged, stopping at the first; only open tiles next to
+/// unrevealed ones are examined
+/// Returns false if nothing follows without guessing
+bool findHint(GameState* game, int* x, int* y, bool* isMine)
+{
+	Solver solver;
+	initSolver(&solver, game, false);
+	solverDeduce(&solver);
+
+	int hint = solver.hint;
+	if (hint >= 0) {
+		*x = hint % game->width;
+		*y = hint / game->width;
+		*isMine = (solver.cell[hint] & CELL_MINE) != 0;
+	}
+	freeSolver(&solver);
+	return hint >= 0;
+}
@@ -0,0 +1,107 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * server/solver.h
+ * Header for the server-side minesweeper solver
+ *
+ * Author:  Keagan Godfrey
+ * Version: 1.0
+ * Date:    2/11/2018
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef __server_solver__h__
+#define __server_solver__h__
+
+/* Includes */
+#include <stdbool.h>
+#include "minesweeper.h"
+#include "rng.h"
+
+
+/* Defines */
+#define SOLVER_MAX_ENUM 20 // largest frontier component solved by exact enumeration
+#define MAX_REPAIRS 400     // mine moves tried on one layout before giving up on it
+
+#define CELL_OPEN   0x1 // revealed, its number is known
+#define CELL_SAFE   0x2 // known not to be a mine (every open tile is safe)
+#define CELL_MINE   0x4 // known to be a mine
+#define CELL_QUEUED 0x8 // open tile waiting to be re-examined
+
+
+/* Types */
+/// Solver structure
+/// What can be known about a board from its open tiles, grown by deduction
+/// When simulating, tiles deduced safe are opened using the board itself,
+/// as a player would; otherwise only the game's revealed tiles are open,
+/// and deduction stops at the first tile worth a hint
+typedef struct
+{
+	GameState* game;
+	bool simulate;
+	int nTiles;
+	int nOpen;
+	unsigned char* cell;  // CELL_* bits per tile
+	signed char* number;  // adjacent mines of open tiles
+	int* queue;           // ring of open tiles to re-examine
+	int head;
+	int count;
+	int* toOpen;          // stack of safe tiles to open when simulating
+	int nToOpen;
+	int* scratch;         // scratch for enumeration
+	int* examine;         // open tiles deduction looks at, those that may border unknown ones
+	int nExamine;
+	int hint;             // not simulating: first tile deduced safe, or a mine not flagged; -1 until then
+} Solver;
+
+
+/* Public function prototypes */
+/// initSolver
+/// Sets up a solver over game
+/// Simulating starts with nothing open, otherwise with the game's revealed tiles
+void initSolver(Solver* solver, GameState* game, bool simulate);
+
+
+/// freeSolver
+/// Deallocates the heap storage of a solver
+void freeSolver(Solver* solver);
+
+
+/// solverOpen
+/// Simulating only: opens the tile at (x, y), flood filling openings
+/// Returns false if it is a mine
+bool solverOpen(Solver* solver, int x, int y);
+
+
+/// solverDeduce
+/// Applies single-point deduction, pairwise constraint reduction, then exact
+/// enumeration of small frontier components, until nothing more follows or,
+/// not simulating, a hint is found
+/// Returns the number of tiles newly known to be safe or mines
+int solverDeduce(Solver* solver);
+
+
+/// solverDone
+/// Returns whether every safe tile is open
+bool solverDone(Solver* solver);
+
+
+/// solveBoard
+/// Returns whether the board can be cleared by logic alone after opening (x, y)
+bool solveBoard(GameState* game, int x, int y);
+
+
+/// makeSolvable
+/// Moves mines until the board can be cleared by logic alone after opening
+/// (x, y): whenever the solver is stuck, a mine on its frontier is moved to
+/// a tile away from everything opened so far
+/// Returns false if MAX_REPAIRS moves were not enough
+bool makeSolvable(GameState* game, Rng* rng, int x, int y);
+
+
+/// findHint
+/// Finds an unrevealed tile the revealed tiles prove safe, or to be a mine
+/// not yet flagged, stopping at the first; only open tiles next to
+/// unrevealed ones are examined
+/// Returns false if nothing follows without guessing
+bool findHint(GameState* game, int* x, int* y, bool* isMine);
+
+
+#endif
@@ -61,7 +61,6 @@ Request* getRequest()
 /// A function used by threads to pull new requests as they are made
 void* handleRequests(void* data)
 {
-    int threadId = *((int*)data);
     Request* request;
 
     // Lock reqLock
@@ -71,9 +70,6 @@ void* handleRequests(void* data)
         if (nRequests > 0) {
             request = getRequest();
             if (request) {
-                // Notify we are handling request
-				printf("Thread %d handling request...\n", threadId);
-				
 				// Unlock reqLock while we handle ours
                 pthread_mutex_unlock(&reqLock);
 				
@@ -81,9 +77,6 @@ void* handleRequests(void* data)
                 (*request->callback)(request->data);
                 free(request);
 				
-				// Notify thread is finished with request
-				printf("Thread %d finished with request...\n", threadId);
-				
 				// Check for thread cancellation
 				pthread_testcancel();
 				
@@ -102,7 +95,7 @@ void* handleRequests(void* data)
 /* Public functions */
 /// newRequest
 /// Adds a request to the requests list
-void newRequest(void (*callback)(int), int data)
+void newRequest(void (*callback)(void*), void* data)
 {
     // Allocate memory for request
     Request* request = malloc(sizeof(Request));
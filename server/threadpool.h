@@ -24,8 +24,8 @@
 /// Request structure
 /// Linked list
 typedef struct Request {
-    void (*callback)(int);
-	int data;
+    void (*callback)(void*);
+	void* data;
     struct Request* next;
 } Request;
 
@@ -33,7 +33,7 @@ typedef struct Request {
 /* Public function prototypes */
 /// newRequest
 /// Adds a request to the requests list
-void newRequest(void (*callback)(int), int data);
+void newRequest(void (*callback)(void*), void* data);
 
 
 /// initThreadpool